@@ -0,0 +1,135 @@
+#include "AsyncWriter.h"
+#include <cstring>
+#include <algorithm>
+#include <ios>
+
+
+const std::size_t AsyncWriter::DEFAULT_BUFFER_SIZE;
+
+
+AsyncWriter::AsyncWriter(std::ostream& os, std::size_t bufferSize):
+    _os(os),
+    _bufferSize(std::max<std::size_t>(bufferSize, 1)),
+    _current(0),
+    _filled(0),
+    _pending(-1),
+    _pendingSize(0),
+    _stop(false)
+{
+    _buffers[0].allocate(1, _bufferSize, SampleBuffer<char>::INTERLEAVED);
+    _buffers[1].allocate(1, _bufferSize, SampleBuffer<char>::INTERLEAVED);
+    _thread = std::thread(&AsyncWriter::_run, this);
+}
+
+
+AsyncWriter::~AsyncWriter() {
+    _join();
+}
+
+
+char* AsyncWriter::getBuffer() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _written.wait(lock, [this] { return _pending != _current; });
+
+    return _buffers[_current].data();
+}
+
+
+void AsyncWriter::submit(std::size_t size) {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    // Only one buffer is written at a time; the other one is the caller's.
+    _written.wait(lock, [this] { return _pending == -1; });
+
+    _pending = _current;
+    _pendingSize = size;
+    _current ^= 1;
+    _filled = 0;
+
+    lock.unlock();
+    _submitted.notify_one();
+}
+
+
+void AsyncWriter::write(const char* data, std::size_t size) {
+    while (size > 0) {
+        char* buffer = getBuffer();
+        std::size_t count = std::min(size, _bufferSize - _filled);
+
+        memcpy(buffer + _filled, data, count);
+        _filled += count;
+        data += count;
+        size -= count;
+
+        if (_filled == _bufferSize) {
+            submit(_filled);
+        }
+    }
+}
+
+
+void AsyncWriter::finish() {
+    if (_thread.joinable() && _filled > 0) {
+        submit(_filled);
+    }
+
+    _join();
+
+    if (_error) {
+        std::exception_ptr error = _error;
+        _error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+
+void AsyncWriter::_join() {
+    if (!_thread.joinable()) {
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _written.wait(lock, [this] { return _pending == -1; });
+        _stop = true;
+    }
+    _submitted.notify_one();
+
+    _thread.join();
+}
+
+
+void AsyncWriter::_run() {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (;;) {
+        _submitted.wait(lock, [this] { return _stop || _pending != -1; });
+
+        if (_pending == -1) {
+            return;
+        }
+
+        const char* data = _buffers[_pending].data();
+        std::size_t size = _pendingSize;
+
+        lock.unlock();
+
+        try {
+            // Once the stream has failed the rest is only let through.
+            if (!_error) {
+                _os.write(data, size);
+
+                if (!_os) {
+                    throw std::ios_base::failure("AsyncWriter: write failed");
+                }
+            }
+        } catch (...) {
+            _error = std::current_exception();
+        }
+
+        lock.lock();
+
+        _pending = -1;
+        _written.notify_all();
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef ASYNCWRITER_H
+#define ASYNCWRITER_H
+
+
+#include <cstddef>
+#include <ostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include "SampleBuffer/SampleBuffer.h"
+
+
+// Writes to a stream from a thread of its own, so that preparing the next
+// block overlaps with writing the previous one. There are two buffers: the
+// caller fills one while the other is being written. The stream must not be
+// touched by anyone else until finish() returns.
+class AsyncWriter {
+    public:
+        static const std::size_t DEFAULT_BUFFER_SIZE = 4 << 20;
+
+        explicit AsyncWriter(std::ostream& os, std::size_t bufferSize = DEFAULT_BUFFER_SIZE);
+        ~AsyncWriter();
+
+        AsyncWriter(const AsyncWriter&) = delete;
+        AsyncWriter& operator =(const AsyncWriter&) = delete;
+
+        // Buffer to fill and hand over with submit(size); the next call
+        // returns the other buffer, waiting for it to be written if need be.
+        char*       getBuffer();
+        std::size_t getBufferSize() const { return _bufferSize; }
+        void        submit(std::size_t size);
+
+        // Copies data in through the same buffers.
+        void        write(const char* data, std::size_t size);
+
+        // Writes whatever is left and stops the thread. A write that failed
+        // in the thread is thrown here: what the stream threw, or
+        // std::ios_base::failure if it only went bad.
+        void        finish();
+
+    private:
+        std::ostream&       _os;
+        std::size_t         _bufferSize;
+        SampleBuffer<char>  _buffers[2];
+        int                 _current;
+        std::size_t         _filled;        // by write() into the current buffer
+
+        std::thread                 _thread;
+        std::mutex                  _mutex;
+        std::condition_variable     _submitted;
+        std::condition_variable     _written;
+        int                         _pending;       // buffer being written, -1 if none
+        std::size_t                 _pendingSize;
+        bool                        _stop;
+        std::exception_ptr          _error;         // first failed write
+
+        void _join();
+        void _run();
+};
+
+
+#endif // ASYNCWRITER_H
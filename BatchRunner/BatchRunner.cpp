@@ -0,0 +1,611 @@
+// Runs the mix, duck and convert jobs of a manifest in one process, as a
+// pipeline: the inputs of the next job are loaded while the current one is
+// computed and the previous one is written, so a batch is bound by the disk
+// or the CPU rather than by starting a process and warming it up per job.
+//
+//   srcs=$(find . -mindepth 2 -name '*.cpp' -not -path './Benchmark/*' -not -path './BatchRunner/*' -not -path './Tests/*')
+//   g++ -std=c++11 -O2 -I. -pthread BatchRunner/BatchRunner.cpp $srcs -o batchrunner
+//   ./batchrunner --output=csv nightly.jobs
+//
+// A manifest has one job per line, whitespace separated, '#' starting a
+// comment:
+//
+//   mix       <out> <in> <other>   [delay=0] [gain=1] [own=1]
+//   addmono   <out> <in> <mono>
+//   duck      <out> <in> <voice>   [attack=0.2] [release=1.3] [silence=0.4]
+//                                  [threshold=-30] [ratio=15] [detector=legacy]
+//   voiceover <out> <in> <voice>   duck, then mix the voice in after the preroll
+//   convert   <out> <in>           format=8|16|24|f32 [dither=1]
+//
+// detector is legacy, peak or rms (with window=0.01 seconds). Throughput is
+// reported per job as it is written; a job that fails is reported and the
+// rest of the batch goes on. Run with --help for every option.
+
+#include "WavFile/WavFile.h"
+#include "BufferPool/BufferPool.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdlib>
+#include <memory>
+#include <functional>
+#include <iterator>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+
+struct Options {
+    std::string                 manifest;
+    std::string                 output;         // console, json or csv
+    WavFile::StorageLayout      layout;
+    unsigned                    threads;
+    std::size_t                 depth;          // jobs waiting between two stages
+    bool                        floatProcessing;
+    bool                        pool;
+};
+
+
+struct Job {
+    int                         line;
+    std::string                 op;
+    std::string                 output;
+    std::vector<std::string>    inputs;
+    std::map<std::string, std::string>  params;
+
+    double param(const std::string& key, double fallback) const {
+        auto it = params.find(key);
+        return it == params.end() ? fallback : std::atof(it->second.c_str());
+    }
+
+    std::string param(const std::string& key, const std::string& fallback) const {
+        auto it = params.find(key);
+        return it == params.end() ? fallback : it->second;
+    }
+};
+
+
+// A job on its way through the stages, with what each of them took.
+struct Run {
+    const Job*                  job;
+    std::vector<std::unique_ptr<WavFile>>   files;      // the inputs, files[0] the one worked on
+    std::string                 error;
+    uint64_t                    numFrames;
+    uint64_t                    bytesRead;
+    uint64_t                    bytesWritten;
+    double                      loadSeconds;
+    double                      computeSeconds;
+    double                      writeSeconds;
+};
+
+
+// Passes runs from one stage to the next. push() waits while capacity runs
+// are queued, pop() while none are; pop() returns false once the queue is
+// closed and empty.
+template<typename T>
+class HandOff {
+    public:
+        explicit HandOff(std::size_t capacity):
+            _capacity(std::max<std::size_t>(capacity, 1)),
+            _closed(false)
+        {}
+
+        void push(T item) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _changed.wait(lock, [this] { return _items.size() < _capacity; });
+            _items.push_back(std::move(item));
+            _changed.notify_all();
+        }
+
+        bool pop(T& item) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _changed.wait(lock, [this] { return !_items.empty() || _closed; });
+
+            if (_items.empty()) {
+                return false;
+            }
+
+            item = std::move(_items.front());
+            _items.pop_front();
+            _changed.notify_all();
+
+            return true;
+        }
+
+        void close() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _closed = true;
+            _changed.notify_all();
+        }
+
+    private:
+        std::size_t                 _capacity;
+        bool                        _closed;
+        std::deque<T>               _items;
+        std::mutex                  _mutex;
+        std::condition_variable     _changed;
+};
+
+
+static const std::size_t NUM_OPS = 5;
+static const char* OPS[NUM_OPS] = { "mix", "addmono", "duck", "voiceover", "convert" };
+static const std::size_t OP_INPUTS[NUM_OPS] = { 2, 2, 2, 2, 1 };
+
+static const char* PARAMS[] = {
+    "delay", "gain", "own", "attack", "release", "silence", "threshold", "ratio", "detector", "window",
+    "format", "dither"
+};
+
+
+static std::size_t opIndex(const std::string& op) {
+    return std::find(OPS, OPS + NUM_OPS, op) - OPS;
+}
+
+
+static bool parseFormat(const std::string& format, WavFile::DataType& dataType) {
+    if (format == "8") {
+        dataType = WavFile::INT_8_DATA;
+    } else if (format == "16") {
+        dataType = WavFile::INT_16_DATA;
+    } else if (format == "24") {
+        dataType = WavFile::INT_24_DATA;
+    } else if (format == "f32") {
+        dataType = WavFile::FLT_32_DATA;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+
+// Every line is checked before the first job starts, so a typo doesn't cost
+// half a night's batch.
+static bool readManifest(const std::string& path, std::vector<Job>& jobs) {
+    std::ifstream ifs(path);
+    std::string text;
+    int line = 0;
+
+    if (!ifs) {
+        std::cerr << "Can't open '" << path << "'!" << std::endl;
+        return false;
+    }
+
+    while (std::getline(ifs, text)) {
+        line++;
+        text = text.substr(0, text.find('#'));
+
+        std::stringstream ss(text);
+        std::string token;
+        Job job;
+
+        job.line = line;
+
+        while (ss >> token) {
+            std::size_t eq = token.find('=');
+
+            if (job.op.empty()) {
+                job.op = token;
+            } else if (eq != std::string::npos) {
+                job.params[token.substr(0, eq)] = token.substr(eq + 1);
+            } else if (job.output.empty()) {
+                job.output = token;
+            } else {
+                job.inputs.push_back(token);
+            }
+        }
+
+        if (job.op.empty()) {
+            continue;
+        }
+
+        std::size_t op = opIndex(job.op);
+        WavFile::DataType dataType;
+        std::string detector = job.param("detector", "legacy");
+        std::string problem;
+
+        if (op == NUM_OPS) {
+            problem = "unknown job '" + job.op + "'";
+        } else if (job.output.empty() || job.inputs.size() != OP_INPUTS[op]) {
+            problem = job.op + " takes an output and " + std::to_string(OP_INPUTS[op]) + " input(s)";
+        } else if (job.op == "convert" && !parseFormat(job.param("format", ""), dataType)) {
+            problem = "convert needs format=8, 16, 24 or f32";
+        } else if (detector != "legacy" && detector != "peak" && detector != "rms") {
+            problem = "detector is legacy, peak or rms";
+        }
+
+        for (const auto& param : job.params) {
+            if (std::find(std::begin(PARAMS), std::end(PARAMS), param.first) == std::end(PARAMS)) {
+                problem = "unknown parameter '" + param.first + "'";
+            }
+        }
+
+        if (!problem.empty()) {
+            std::cerr << path << ":" << line << ": " << problem << std::endl;
+            return false;
+        }
+
+        jobs.push_back(job);
+    }
+
+    return true;
+}
+
+
+static uint64_t dataBytes(const WavFile& file) {
+    return file.getNumFrames() * file.getHeader().blockAlign;
+}
+
+
+static uint64_t fileSize(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? (uint64_t) st.st_size : 0;
+}
+
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+// Opens and decodes the inputs. A conversion only maps its input, saveAs()
+// reads straight from the mapping; so does --layout=lazy, which leaves the
+// decoding to the compute stage.
+static void load(const Options& options, Run& run) {
+    const Job& job = *run.job;
+
+    for (const std::string& path : job.inputs) {
+        run.files.emplace_back(new WavFile(path));
+        WavFile& file = *run.files.back();
+
+        if (job.op == "convert") {
+            file.mapData();
+        } else {
+            file.setStorageLayout(options.layout);
+            file.setFloatProcessing(options.floatProcessing);
+            file.loadData();
+        }
+
+        run.bytesRead += dataBytes(file);
+    }
+
+    run.numFrames = run.files[0]->getNumFrames();
+}
+
+
+static void compute(Run& run) {
+    const Job& job = *run.job;
+
+    if (job.op == "convert") {
+        return;
+    }
+
+    WavFile& file = *run.files[0];
+    WavFile& other = *run.files[1];
+
+    if (job.op == "mix") {
+        file.mixWith(other, (uint64_t) job.param("delay", 0.), (float) job.param("gain", 1.), (float) job.param("own", 1.));
+        return;
+    }
+
+    if (job.op == "addmono") {
+        file.addMonoFrom(other);
+        return;
+    }
+
+    std::string detector = job.param("detector", "legacy");
+
+    if (detector != "legacy") {
+        file.setBlockDetection(true, detector == "rms" ? LevelDetector::RMS_DETECTION : LevelDetector::PEAK_DETECTION,
+                               job.param("window", 0.01));
+    }
+
+    file.overVoice(other, job.param("attack", 0.2), job.param("release", 1.3), job.param("silence", 0.4),
+                   job.param("threshold", -30.), job.param("ratio", 15.));
+
+    if (job.op == "voiceover") {
+        file.mixWith(other, WavFile::OVERVOICE_PREROLL);
+    }
+}
+
+
+static void write(Run& run) {
+    const Job& job = *run.job;
+    WavFile& file = *run.files[0];
+
+    if (job.op == "convert") {
+        WavFile::DataType dataType = WavFile::INT_16_DATA;
+
+        parseFormat(job.param("format", ""), dataType);
+        file.saveAs(job.output, dataType, job.param("dither", 1.) != 0);
+    } else {
+        file.save(job.output);
+    }
+
+    run.bytesWritten = fileSize(job.output);
+}
+
+
+// Runs one stage of a job unless an earlier one failed, and times it.
+static void runStage(Run& run, double& seconds, const std::function<void()>& stage) {
+    if (!run.error.empty()) {
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    try {
+        stage();
+    } catch (std::exception& e) {
+        run.error = e.what();
+    }
+
+    seconds = secondsSince(start);
+}
+
+
+static std::string runName(const Run& run) {
+    return std::to_string(run.job->line) + ":" + run.job->op + ":" + run.job->output;
+}
+
+
+// The time the job spent in the stages; they overlap with other jobs, so
+// the sum over a batch comes out above its wall time.
+static double busySeconds(const Run& run) {
+    return run.loadSeconds + run.computeSeconds + run.writeSeconds;
+}
+
+
+static double megabytesPerSecond(const Run& run) {
+    double seconds = busySeconds(run);
+    return seconds > 0 && run.error.empty() ? (run.bytesRead + run.bytesWritten) / seconds / 1e6 : 0;
+}
+
+
+static void printConsoleHeader() {
+    std::cout << std::left << std::setw(40) << "Job" << std::right
+              << std::setw(12) << "Frames" << std::setw(10) << "Load ms" << std::setw(10) << "Work ms"
+              << std::setw(10) << "Write ms" << std::setw(10) << "MB/s" << "  Status\n"
+              << std::string(100, '-') << std::endl;
+}
+
+
+static void printConsoleRow(const Run& run) {
+    std::cout << std::left << std::setw(40) << runName(run) << std::right << std::fixed
+              << std::setw(12) << run.numFrames << std::setprecision(1)
+              << std::setw(10) << run.loadSeconds * 1e3
+              << std::setw(10) << run.computeSeconds * 1e3
+              << std::setw(10) << run.writeSeconds * 1e3
+              << std::setw(10) << megabytesPerSecond(run)
+              << "  " << (run.error.empty() ? "ok" : run.error) << std::endl;
+}
+
+
+static void printConsoleSummary(const std::vector<Run>& runs, double wallSeconds) {
+    uint64_t bytes = 0;
+    double busy = 0;
+    int failed = 0;
+
+    for (const Run& run : runs) {
+        bytes += run.bytesRead + run.bytesWritten;
+        busy += busySeconds(run);
+        failed += !run.error.empty();
+    }
+
+    std::cout << std::string(100, '-') << "\n" << std::fixed << std::setprecision(2)
+              << runs.size() << " jobs, " << failed << " failed, " << wallSeconds << " s wall, "
+              << busy << " s in stages, " << std::setprecision(1)
+              << (wallSeconds > 0 ? bytes / wallSeconds / 1e6 : 0) << " MB/s" << std::endl;
+}
+
+
+static std::string jsonString(const std::string& text) {
+    std::string quoted = "\"";
+
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+        }
+        quoted += c;
+    }
+
+    return quoted + "\"";
+}
+
+
+static void printCsv(const std::vector<Run>& runs) {
+    std::cout << "line,op,output,frames,bytes_read,bytes_written,load_s,compute_s,write_s,mb_per_s,error\n";
+
+    for (const Run& run : runs) {
+        std::cout << run.job->line << "," << run.job->op << "," << run.job->output << ","
+                  << run.numFrames << "," << run.bytesRead << "," << run.bytesWritten << ","
+                  << std::setprecision(9) << run.loadSeconds << "," << run.computeSeconds << ","
+                  << run.writeSeconds << "," << megabytesPerSecond(run) << "," << jsonString(run.error) << "\n";
+    }
+}
+
+
+static void printJson(const Options& options, const std::vector<Run>& runs, double wallSeconds) {
+    std::cout << "{\n"
+              << "  \"context\": {\n"
+              << "    \"manifest\": " << jsonString(options.manifest) << ",\n"
+              << "    \"threads\": " << options.threads << ",\n"
+              << "    \"depth\": " << options.depth << ",\n"
+              << "    \"float_processing\": " << (options.floatProcessing ? "true" : "false") << ",\n"
+              << "    \"wall_s\": " << std::setprecision(9) << wallSeconds << "\n"
+              << "  },\n"
+              << "  \"jobs\": [";
+
+    for (std::size_t i = 0; i < runs.size(); i++) {
+        const Run& run = runs[i];
+
+        std::cout << (i ? "," : "") << "\n    {"
+                  << "\"line\": " << run.job->line << ", "
+                  << "\"op\": \"" << run.job->op << "\", "
+                  << "\"output\": " << jsonString(run.job->output) << ", "
+                  << "\"frames\": " << run.numFrames << ", "
+                  << "\"bytes_read\": " << run.bytesRead << ", "
+                  << "\"bytes_written\": " << run.bytesWritten << ", "
+                  << std::setprecision(9)
+                  << "\"load_s\": " << run.loadSeconds << ", "
+                  << "\"compute_s\": " << run.computeSeconds << ", "
+                  << "\"write_s\": " << run.writeSeconds << ", "
+                  << "\"mb_per_s\": " << megabytesPerSecond(run) << ", "
+                  << "\"error\": " << jsonString(run.error) << "}";
+    }
+
+    std::cout << "\n  ]\n}" << std::endl;
+}
+
+
+static void usage() {
+    std::cerr << "usage: batchrunner [options] <manifest>\n"
+                 "  --output=console            console, json or csv\n"
+                 "  --layout=vector             vector, interleaved, planar or lazy\n"
+                 "  --float                     float processing, quantized once on saving\n"
+                 "  --threads=0                 0 is one per hardware thread\n"
+                 "  --depth=1                   jobs waiting between two stages\n"
+                 "  --pool                      allocate through a BufferPool\n";
+}
+
+
+static bool parseOptions(int argc, char** argv, Options& options) {
+    options.output = "console";
+    options.layout = WavFile::VECTOR_STORAGE;
+    options.threads = 0;
+    options.depth = 1;
+    options.floatProcessing = false;
+    options.pool = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::size_t eq = arg.find('=');
+        std::string key = arg.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        if (arg.compare(0, 2, "--") != 0 && options.manifest.empty()) {
+            options.manifest = arg;
+        } else if (key == "--output" && (value == "console" || value == "json" || value == "csv")) {
+            options.output = value;
+        } else if (key == "--layout") {
+            if (value == "vector") {
+                options.layout = WavFile::VECTOR_STORAGE;
+            } else if (value == "interleaved") {
+                options.layout = WavFile::INTERLEAVED_STORAGE;
+            } else if (value == "planar") {
+                options.layout = WavFile::PLANAR_STORAGE;
+            } else if (value == "lazy") {
+                options.layout = WavFile::LAZY_STORAGE;
+            } else {
+                return false;
+            }
+        } else if (key == "--float") {
+            options.floatProcessing = true;
+        } else if (key == "--threads") {
+            options.threads = (unsigned) std::atoi(value.c_str());
+        } else if (key == "--depth") {
+            options.depth = (std::size_t) std::max(1, std::atoi(value.c_str()));
+        } else if (key == "--pool") {
+            options.pool = true;
+        } else {
+            return false;
+        }
+    }
+
+    return !options.manifest.empty();
+}
+
+
+int main(int argc, char** argv) {
+    Options options;
+    std::vector<Job> jobs;
+
+    if (!parseOptions(argc, argv, options)) {
+        usage();
+        return 1;
+    }
+
+    if (!readManifest(options.manifest, jobs)) {
+        return 1;
+    }
+
+    WavFile::setNumThreads(options.threads);
+
+    BufferPool pool;
+    if (options.pool) {
+        WavFile::setBufferPool(&pool);
+    }
+
+    // The loader and the writer have a thread each, computing is done on
+    // this one; the parallel loops of all three share the WavFile pool.
+    HandOff<std::unique_ptr<Run>> loaded(options.depth), computed(options.depth);
+    std::vector<Run> runs;
+    bool console = options.output == "console";
+    auto start = std::chrono::steady_clock::now();
+
+    if (console) {
+        printConsoleHeader();
+    }
+
+    std::thread loader([&] {
+        for (const Job& job : jobs) {
+            std::unique_ptr<Run> run(new Run());
+
+            run->job = &job;
+            runStage(*run, run->loadSeconds, [&] { load(options, *run); });
+            loaded.push(std::move(run));
+        }
+
+        loaded.close();
+    });
+
+    std::thread writer([&] {
+        std::unique_ptr<Run> run;
+
+        while (computed.pop(run)) {
+            runStage(*run, run->writeSeconds, [&] { write(*run); });
+            run->files.clear();
+
+            if (console) {
+                printConsoleRow(*run);
+            }
+
+            runs.push_back(std::move(*run));
+        }
+    });
+
+    std::unique_ptr<Run> run;
+
+    while (loaded.pop(run)) {
+        runStage(*run, run->computeSeconds, [&] { compute(*run); });
+        computed.push(std::move(run));
+    }
+
+    computed.close();
+    loader.join();
+    writer.join();
+
+    double wallSeconds = secondsSince(start);
+    bool failed = std::any_of(runs.begin(), runs.end(), [](const Run& run) { return !run.error.empty(); });
+
+    WavFile::setBufferPool(nullptr);
+
+    if (console) {
+        printConsoleSummary(runs, wallSeconds);
+    } else if (options.output == "json") {
+        printJson(options, runs, wallSeconds);
+    } else {
+        printCsv(runs);
+    }
+
+    return failed ? 1 : 0;
+}
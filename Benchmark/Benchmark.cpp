@@ -0,0 +1,546 @@
+// Throughput of loadData, mixWith, addMonoFrom, overVoice and save on
+// synthetic files, written next to the benchmark and removed afterwards.
+//
+//   srcs=$(find . -mindepth 2 -name '*.cpp' -not -path './Benchmark/*' -not -path './BatchRunner/*' -not -path './Tests/*')
+//   g++ -std=c++11 -O2 -I. -pthread Benchmark/Benchmark.cpp $srcs -o benchmark
+//   ./benchmark --formats=16,f32 --channels=2,8 --seconds=60 --output=json
+//
+// Every case is timed --repetitions times after an untimed warm-up run; the
+// best and the mean run are reported. Run with --help for every option.
+
+#include "WavFile/WavFile.h"
+#include "RiffLayout/RiffLayout.h"
+#include "BufferPool/BufferPool.h"
+#include "Int24/Int24.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <ctime>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <algorithm>
+
+
+static const uint32_t SAMPLE_RATE = 48000;
+static const uint64_t WRITE_BLOCK_FRAMES = 65536;
+
+
+struct Options {
+    std::vector<int>            formats;        // bits per sample, 32 is float
+    std::vector<int>            channels;
+    std::vector<double>         seconds;
+    std::vector<std::string>    ops;
+    int                         repetitions;
+    std::string                 output;         // console, json or csv
+    std::string                 dir;
+    WavFile::StorageLayout      layout;
+    unsigned                    threads;
+    bool                        pool;
+    bool                        hugePages;
+    bool                        keep;
+};
+
+
+struct Result {
+    std::string op;
+    int         bits;
+    int         numChannels;
+    uint64_t    numFrames;
+    uint64_t    bytes;          // of sample data handled per run
+    double      bestSeconds;
+    double      meanSeconds;
+};
+
+
+static std::string formatName(int bits) {
+    return bits == 32 ? "f32" : "i" + std::to_string(bits);
+}
+
+
+static const char* layoutName(WavFile::StorageLayout layout) {
+    switch (layout) {
+        case WavFile::VECTOR_STORAGE:       return "vector";
+        case WavFile::INTERLEAVED_STORAGE:  return "interleaved";
+        case WavFile::PLANAR_STORAGE:       return "planar";
+        case WavFile::LAZY_STORAGE:         return "lazy";
+    }
+    return "";
+}
+
+
+// Synthetic program material: a different tone per channel with some noise.
+// The voice is a one second burst every other second so that overVoice has
+// something to duck for and something to release on.
+class SignalGenerator {
+    public:
+        SignalGenerator(uint32_t seed, bool bursts):
+            _state(seed * 2654435761u + 1),
+            _bursts(bursts)
+        {}
+
+        float sample(uint64_t frame, int channel) {
+            if (_bursts && (frame / SAMPLE_RATE) % 2 == 1) {
+                return 0.f;
+            }
+
+            float phase = (float) ((frame * (220 + 55 * channel)) % SAMPLE_RATE) / SAMPLE_RATE;
+            float tone = phase < 0.5f ? 4 * phase - 1 : 3 - 4 * phase;      // triangle, cheap to make
+
+            return 0.3f * tone + 0.1f * _noise();
+        }
+
+    private:
+        uint32_t    _state;
+        bool        _bursts;
+
+        float _noise() {
+            _state ^= _state << 13;
+            _state ^= _state >> 17;
+            _state ^= _state << 5;
+            return (_state >> 8) / 8388608.f - 1.f;
+        }
+};
+
+
+static void putSample(char* dst, int bits, float value) {
+    switch (bits) {
+        case 8: {
+            uint8_t s = (uint8_t) (128 + (int) std::lrint(value * 127));
+            memcpy(dst, &s, 1);
+            break;
+        }
+
+        case 16: {
+            int16_t s = (int16_t) std::lrint(value * 32767);
+            memcpy(dst, &s, 2);
+            break;
+        }
+
+        case 24: {
+            Int24 s = (int) std::lrint(value * 8388607);
+            memcpy(dst, &s, 3);
+            break;
+        }
+
+        default:
+            memcpy(dst, &value, 4);
+            break;
+    }
+}
+
+
+// Written a block at a time, so files of any length take little memory.
+static void writeSynthetic(const std::string& path, int bits, int numChannels, uint64_t numFrames,
+                           uint32_t seed, bool bursts) {
+    int sampleSize = bits / 8;
+    uint16_t blockAlign = numChannels * sampleSize;
+    WavFile::Header header;
+
+    header.audioFormat = bits == 32 ? RiffLayout::WAVE_FORMAT_IEEE_FLOAT : RiffLayout::WAVE_FORMAT_PCM;
+    header.numChannels = numChannels;
+    header.sampleRate = SAMPLE_RATE;
+    header.byteRate = SAMPLE_RATE * blockAlign;
+    header.blockAlign = blockAlign;
+    header.bitsPerSample = bits;
+
+    std::vector<char> format(16);
+    memcpy(format.data(), &header.audioFormat, 16);
+
+    std::ofstream ofs(path, std::ios::out|std::ios::binary|std::ios::trunc);
+    RiffLayout layout;
+    uint64_t dataSize = numFrames * blockAlign;
+    RiffLayout::Placement placement = layout.writeHead(ofs, format, dataSize);
+
+    SignalGenerator generator(seed, bursts);
+    std::vector<char> block(WRITE_BLOCK_FRAMES * blockAlign);
+
+    for (uint64_t first = 0; first < numFrames; first += WRITE_BLOCK_FRAMES) {
+        uint64_t count = std::min(WRITE_BLOCK_FRAMES, numFrames - first);
+        char* p = block.data();
+
+        for (uint64_t f = 0; f < count; f++) {
+            for (int c = 0; c < numChannels; c++, p += sampleSize) {
+                putSample(p, bits, generator.sample(first + f, c));
+            }
+        }
+
+        ofs.write(block.data(), count * blockAlign);
+    }
+
+    layout.writeTail(ofs, placement, dataSize, numFrames);
+
+    if (!ofs) {
+        throw std::runtime_error("Can't write '" + path + "'!");
+    }
+}
+
+
+static double timeRun(const std::function<void()>& run) {
+    auto start = std::chrono::steady_clock::now();
+    run();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+// setup() runs before every run, untimed; the first run is a warm-up.
+static Result measure(const Options& options, const std::string& op, int bits, int numChannels,
+                      uint64_t numFrames, uint64_t bytes,
+                      const std::function<void()>& setup, const std::function<void()>& run) {
+    Result result = { op, bits, numChannels, numFrames, bytes, 0, 0 };
+    double total = 0;
+
+    for (int i = 0; i <= options.repetitions; i++) {
+        setup();
+        double seconds = timeRun(run);
+
+        if (i == 0) {
+            continue;
+        }
+
+        result.bestSeconds = i == 1 ? seconds : std::min(result.bestSeconds, seconds);
+        total += seconds;
+    }
+
+    result.meanSeconds = total / options.repetitions;
+
+    return result;
+}
+
+
+static bool wants(const Options& options, const std::string& op) {
+    return std::find(options.ops.begin(), options.ops.end(), op) != options.ops.end();
+}
+
+
+static void runCase(const Options& options, int bits, int numChannels, uint64_t numFrames,
+                    std::vector<Result>& results, const std::function<void(const Result&)>& report) {
+    std::string prefix = options.dir + "/bench_" + formatName(bits) + "_" + std::to_string(numChannels) + "ch_";
+    std::string programPath = prefix + "program.wav";
+    std::string otherPath = prefix + "other.wav";
+    std::string voicePath = prefix + "voice.wav";
+    std::string savePath = prefix + "saved.wav";
+
+    writeSynthetic(programPath, bits, numChannels, numFrames, 1, false);
+    writeSynthetic(otherPath, bits, numChannels, numFrames, 2, false);
+    writeSynthetic(voicePath, bits, 1, numFrames, 3, true);
+
+    uint64_t bytes = numFrames * numChannels * (bits / 8);
+    std::unique_ptr<WavFile> program, other, voice;
+
+    auto open = [&](std::unique_ptr<WavFile>& file, const std::string& path) {
+        file.reset(new WavFile(path));
+        file->setStorageLayout(options.layout);
+    };
+
+    auto add = [&](const Result& result) {
+        results.push_back(result);
+        report(result);
+    };
+
+    if (wants(options, "load")) {
+        add(measure(options, "load", bits, numChannels, numFrames, bytes,
+                    [&] { program.reset(); },
+                    [&] { open(program, programPath); program->loadData(); }));
+    }
+
+    open(program, programPath);
+    open(other, otherPath);
+    open(voice, voicePath);
+    program->loadData();
+    other->loadData();
+    voice->loadData();
+
+    // mixWith and addMonoFrom read one more file of the same size.
+    if (wants(options, "mix")) {
+        add(measure(options, "mix", bits, numChannels, numFrames, 2 * bytes,
+                    [] {},
+                    [&] { program->mixWith(*other, 0, 0.5f, 0.5f); }));
+    }
+
+    if (wants(options, "addmono")) {
+        add(measure(options, "addmono", bits, numChannels, numFrames, bytes + bytes / numChannels,
+                    [] {},
+                    [&] { program->addMonoFrom(*voice); }));
+    }
+
+    // overVoice doesn't handle 8-bit programs.
+    if (wants(options, "overvoice") && bits != 8) {
+        add(measure(options, "overvoice", bits, numChannels, numFrames, bytes + bytes / numChannels,
+                    [] {},
+                    [&] { program->overVoice(*voice, 0.2, 1.3, 0.4, -30, 15); }));
+    }
+
+    if (wants(options, "save")) {
+        add(measure(options, "save", bits, numChannels, numFrames, bytes,
+                    [] {},
+                    [&] { program->save(savePath); }));
+    }
+
+    program.reset();
+    other.reset();
+    voice.reset();
+
+    if (!options.keep) {
+        std::remove(programPath.c_str());
+        std::remove(otherPath.c_str());
+        std::remove(voicePath.c_str());
+        std::remove(savePath.c_str());
+    }
+}
+
+
+static std::string resultName(const Result& result) {
+    return result.op + "/" + formatName(result.bits) + "/" + std::to_string(result.numChannels) + "ch/" +
+           std::to_string(result.numFrames);
+}
+
+
+static double framesPerSecond(const Result& result) {
+    return result.bestSeconds > 0 ? result.numFrames / result.bestSeconds : 0;
+}
+
+
+static double megabytesPerSecond(const Result& result) {
+    return result.bestSeconds > 0 ? result.bytes / result.bestSeconds / 1e6 : 0;
+}
+
+
+static void printConsoleHeader() {
+    std::cout << std::left << std::setw(36) << "Benchmark" << std::right
+              << std::setw(12) << "Best ms" << std::setw(12) << "Mean ms"
+              << std::setw(16) << "Frames/s" << std::setw(12) << "MB/s" << "\n"
+              << std::string(88, '-') << std::endl;
+}
+
+
+static void printConsoleRow(const Result& result) {
+    std::cout << std::left << std::setw(36) << resultName(result) << std::right << std::fixed
+              << std::setw(12) << std::setprecision(2) << result.bestSeconds * 1e3
+              << std::setw(12) << std::setprecision(2) << result.meanSeconds * 1e3
+              << std::setw(16) << std::setprecision(0) << framesPerSecond(result)
+              << std::setw(12) << std::setprecision(1) << megabytesPerSecond(result) << std::endl;
+}
+
+
+static void printCsv(const std::vector<Result>& results) {
+    std::cout << "name,op,format,channels,frames,bytes,best_s,mean_s,frames_per_s,mb_per_s\n";
+
+    for (const Result& result : results) {
+        std::cout << resultName(result) << "," << result.op << "," << formatName(result.bits) << ","
+                  << result.numChannels << "," << result.numFrames << "," << result.bytes << ","
+                  << std::setprecision(9) << result.bestSeconds << "," << result.meanSeconds << ","
+                  << framesPerSecond(result) << "," << megabytesPerSecond(result) << "\n";
+    }
+}
+
+
+static void printJson(const Options& options, const std::vector<Result>& results) {
+    char date[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof (date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+    std::cout << "{\n"
+              << "  \"context\": {\n"
+              << "    \"date\": \"" << date << "\",\n"
+              << "    \"storage_layout\": \"" << layoutName(options.layout) << "\",\n"
+              << "    \"threads\": " << options.threads << ",\n"
+              << "    \"buffer_pool\": " << (options.pool ? "true" : "false") << ",\n"
+              << "    \"huge_pages\": " << (options.hugePages ? "true" : "false") << ",\n"
+              << "    \"repetitions\": " << options.repetitions << "\n"
+              << "  },\n"
+              << "  \"benchmarks\": [";
+
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const Result& result = results[i];
+
+        std::cout << (i ? "," : "") << "\n    {"
+                  << "\"name\": \"" << resultName(result) << "\", "
+                  << "\"op\": \"" << result.op << "\", "
+                  << "\"format\": \"" << formatName(result.bits) << "\", "
+                  << "\"channels\": " << result.numChannels << ", "
+                  << "\"frames\": " << result.numFrames << ", "
+                  << "\"bytes\": " << result.bytes << ", "
+                  << std::setprecision(9)
+                  << "\"best_s\": " << result.bestSeconds << ", "
+                  << "\"mean_s\": " << result.meanSeconds << ", "
+                  << "\"frames_per_s\": " << framesPerSecond(result) << ", "
+                  << "\"mb_per_s\": " << megabytesPerSecond(result) << "}";
+    }
+
+    std::cout << "\n  ]\n}" << std::endl;
+}
+
+
+static void usage() {
+    std::cerr << "usage: benchmark [options]\n"
+                 "  --formats=8,16,24,f32       sample formats\n"
+                 "  --channels=1,2,8,32         channel counts\n"
+                 "  --seconds=10                file lengths at 48 kHz, e.g. 10,3600\n"
+                 "  --ops=load,mix,addmono,overvoice,save\n"
+                 "  --repetitions=3             timed runs per case\n"
+                 "  --output=console            console, json or csv\n"
+                 "  --layout=vector             vector, interleaved, planar or lazy\n"
+                 "  --threads=0                 0 is one per hardware thread\n"
+                 "  --pool                      allocate through a BufferPool\n"
+                 "  --huge-pages                back the pool with huge pages\n"
+                 "  --dir=.                     where the synthetic files go\n"
+                 "  --keep                      leave the synthetic files behind\n";
+}
+
+
+static std::vector<std::string> split(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+
+    return items;
+}
+
+
+static bool parseOptions(int argc, char** argv, Options& options) {
+    options.formats = { 8, 16, 24, 32 };
+    options.channels = { 1, 2, 8, 32 };
+    options.seconds = { 10 };
+    options.ops = { "load", "mix", "addmono", "overvoice", "save" };
+    options.repetitions = 3;
+    options.output = "console";
+    options.dir = ".";
+    options.layout = WavFile::VECTOR_STORAGE;
+    options.threads = 0;
+    options.pool = false;
+    options.hugePages = false;
+    options.keep = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::size_t eq = arg.find('=');
+        std::string key = arg.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        if (key == "--formats") {
+            options.formats.clear();
+            for (const std::string& item : split(value)) {
+                int bits = item == "f32" ? 32 : std::atoi(item.c_str());
+                if (bits != 8 && bits != 16 && bits != 24 && bits != 32) {
+                    return false;
+                }
+                options.formats.push_back(bits);
+            }
+        } else if (key == "--channels") {
+            options.channels.clear();
+            for (const std::string& item : split(value)) {
+                int numChannels = std::atoi(item.c_str());
+                if (numChannels < 1 || numChannels > 64) {
+                    return false;
+                }
+                options.channels.push_back(numChannels);
+            }
+        } else if (key == "--seconds") {
+            options.seconds.clear();
+            for (const std::string& item : split(value)) {
+                options.seconds.push_back(std::atof(item.c_str()));
+            }
+        } else if (key == "--ops") {
+            options.ops = split(value);
+        } else if (key == "--repetitions") {
+            options.repetitions = std::max(1, std::atoi(value.c_str()));
+        } else if (key == "--output" && (value == "console" || value == "json" || value == "csv")) {
+            options.output = value;
+        } else if (key == "--layout") {
+            if (value == "vector") {
+                options.layout = WavFile::VECTOR_STORAGE;
+            } else if (value == "interleaved") {
+                options.layout = WavFile::INTERLEAVED_STORAGE;
+            } else if (value == "planar") {
+                options.layout = WavFile::PLANAR_STORAGE;
+            } else if (value == "lazy") {
+                options.layout = WavFile::LAZY_STORAGE;
+            } else {
+                return false;
+            }
+        } else if (key == "--threads") {
+            options.threads = (unsigned) std::atoi(value.c_str());
+        } else if (key == "--pool") {
+            options.pool = true;
+        } else if (key == "--huge-pages") {
+            options.pool = true;
+            options.hugePages = true;
+        } else if (key == "--dir" && !value.empty()) {
+            options.dir = value;
+        } else if (key == "--keep") {
+            options.keep = true;
+        } else {
+            return false;
+        }
+    }
+
+    return !options.formats.empty() && !options.channels.empty() && !options.seconds.empty();
+}
+
+
+int main(int argc, char** argv) {
+    Options options;
+
+    if (!parseOptions(argc, argv, options)) {
+        usage();
+        return 1;
+    }
+
+    WavFile::setNumThreads(options.threads);
+
+    BufferPool pool(BufferPool::DEFAULT_MAX_IDLE_BYTES, options.hugePages);
+    if (options.pool) {
+        WavFile::setBufferPool(&pool);
+    }
+
+    std::vector<Result> results;
+    bool console = options.output == "console";
+
+    if (console) {
+        printConsoleHeader();
+    }
+
+    try {
+        for (double seconds : options.seconds) {
+            for (int bits : options.formats) {
+                for (int numChannels : options.channels) {
+                    uint64_t numFrames = (uint64_t) (seconds * SAMPLE_RATE);
+
+                    runCase(options, bits, numChannels, numFrames, results, [&](const Result& result) {
+                        if (console) {
+                            printConsoleRow(result);
+                        }
+                    });
+                }
+            }
+        }
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        WavFile::setBufferPool(nullptr);
+        return 1;
+    }
+
+    WavFile::setBufferPool(nullptr);
+
+    if (options.output == "json") {
+        printJson(options, results);
+    } else if (options.output == "csv") {
+        printCsv(results);
+    }
+
+    return 0;
+}
@@ -0,0 +1,151 @@
+#include "BlockCache.h"
+
+
+BlockCache::BlockCache(std::size_t blockSize, std::size_t capacity):
+    _blockSize(blockSize),
+    _capacity(capacity),
+    _hits(0),
+    _misses(0)
+{}
+
+
+void BlockCache::setCapacity(std::size_t capacity) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _capacity = capacity;
+    _evict();
+}
+
+
+char* BlockCache::acquire(uint64_t index, const std::function<void(char*)>& decode) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto found = _blocks.find(index);
+
+    // A block whose decoding fails is erased, and its waiters start over.
+    while (found != _blocks.end()) {
+        uint64_t fill = found->second.fill;
+        Block& block = found->second;
+
+        block.users++;
+        _lru.splice(_lru.begin(), _lru, block.use);
+        _decoded.wait(lock, [&] {
+            found = _blocks.find(index);
+            return found == _blocks.end() || found->second.fill != fill || found->second.ready;
+        });
+
+        if (found != _blocks.end() && found->second.fill == fill) {
+            _hits++;
+            return found->second.data.data();
+        }
+    }
+
+    Block& block = _blocks[index];
+    block.users = 1;
+    block.ready = false;
+    block.dirty = false;
+    _lru.push_front(index);
+    block.use = _lru.begin();
+    _misses++;
+    block.fill = _misses;
+
+    if (!_spare.empty()) {
+        block.data = std::move(_spare.back());
+        _spare.pop_back();
+    } else {
+        block.data.allocate(1, _blockSize, SampleBuffer<char>::INTERLEAVED);
+    }
+
+    _evict();
+
+    // Decoding runs unlocked; the entry can't go away while it has a user.
+    char* data = block.data.data();
+    lock.unlock();
+
+    try {
+        decode(data);
+    } catch (...) {
+        lock.lock();
+
+        if (_spare.size() < 2) {
+            _spare.push_back(std::move(block.data));
+        }
+
+        _lru.erase(block.use);
+        _blocks.erase(index);
+        _decoded.notify_all();
+        throw;
+    }
+
+    lock.lock();
+    block.ready = true;
+    _decoded.notify_all();
+
+    return data;
+}
+
+
+void BlockCache::release(uint64_t index, bool dirty) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    Block& block = _blocks.at(index);
+
+    block.users--;
+    block.dirty = block.dirty || dirty;
+    _evict();
+}
+
+
+bool BlockCache::isDirty(uint64_t index) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto found = _blocks.find(index);
+
+    return found != _blocks.end() && found->second.dirty;
+}
+
+
+std::size_t BlockCache::getNumBlocks() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _blocks.size();
+}
+
+
+uint64_t BlockCache::getHits() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _hits;
+}
+
+
+uint64_t BlockCache::getMisses() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _misses;
+}
+
+
+void BlockCache::clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _blocks.clear();
+    _lru.clear();
+    _spare.clear();
+}
+
+
+// Drops clean, unused blocks from the cold end until the cache fits or
+// nothing more can go.
+void BlockCache::_evict() {
+    auto use = _lru.end();
+
+    while (_blocks.size() > _capacity && use != _lru.begin()) {
+        --use;
+        auto found = _blocks.find(*use);
+        Block& block = found->second;
+
+        if (block.users > 0 || block.dirty) {
+            continue;
+        }
+
+        if (_spare.size() < 2) {
+            _spare.push_back(std::move(block.data));
+        }
+
+        _blocks.erase(found);
+        use = _lru.erase(use);
+    }
+}
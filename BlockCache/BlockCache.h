@@ -0,0 +1,71 @@
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include "SampleBuffer/SampleBuffer.h"
+
+
+// Fixed-size blocks of decoded data, keyed by block index, kept while there
+// is room and evicted least recently used first. A block is filled by the
+// caller's decoder the first time it is acquired and can't be evicted while
+// acquired. Blocks released as dirty hold changes that exist nowhere else,
+// so they stay until clear(), over the capacity if need be. Thread safe; a
+// block being decoded by one thread is waited for by the others.
+class BlockCache {
+    public:
+        BlockCache(std::size_t blockSize, std::size_t capacity);
+
+        BlockCache(const BlockCache&) = delete;
+        BlockCache& operator =(const BlockCache&) = delete;
+
+        std::size_t getBlockSize() const { return _blockSize; }
+        std::size_t getCapacity() const { return _capacity; }
+        void        setCapacity(std::size_t capacity);
+
+        // Every acquire() needs a matching release(). If decode throws, the
+        // block is dropped and the exception passed on; threads waiting for
+        // it try again, decoding it themselves.
+        char*       acquire(uint64_t index, const std::function<void(char*)>& decode);
+        void        release(uint64_t index, bool dirty);
+
+        bool        isDirty(uint64_t index) const;
+        std::size_t getNumBlocks() const;
+        uint64_t    getHits() const;
+        uint64_t    getMisses() const;
+
+        void        clear();
+
+    private:
+        struct Block {
+            SampleBuffer<char>              data;
+            std::list<uint64_t>::iterator   use;        // position in _lru
+            uint64_t                        fill;       // the miss that made it, tells a refill apart
+            unsigned                        users;
+            bool                            ready;
+            bool                            dirty;
+        };
+
+        std::size_t _blockSize;
+        std::size_t _capacity;
+
+        mutable std::mutex                  _mutex;
+        std::condition_variable             _decoded;
+        std::unordered_map<uint64_t, Block> _blocks;
+        std::list<uint64_t>                 _lru;       // most recently used first
+        std::vector<SampleBuffer<char>>     _spare;     // storage of evicted blocks
+        uint64_t                            _hits;
+        uint64_t                            _misses;
+
+        void    _evict();
+};
+
+
+#endif // BLOCKCACHE_H
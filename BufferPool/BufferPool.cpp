@@ -0,0 +1,216 @@
+#include "BufferPool.h"
+#include <new>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+
+const std::size_t BufferPool::ALIGNMENT;
+const std::size_t BufferPool::GRANULE;
+const std::size_t BufferPool::DEFAULT_MAX_IDLE_BYTES;
+
+std::atomic<BufferPool*> BufferPool::_shared(nullptr);
+
+
+BufferPool::BufferPool(std::size_t maxIdleBytes, bool hugePages):
+    _maxIdleBytes(maxIdleBytes),
+    _hugePages(hugePages),
+    _usedBytes(0),
+    _idleBytes(0),
+    _numAllocated(0),
+    _numReused(0)
+{}
+
+
+BufferPool::~BufferPool() {
+    trim();
+}
+
+
+void* BufferPool::allocate(std::size_t bytes) {
+    std::size_t size = _roundUp(bytes);
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto found = _idle.lower_bound(size);
+
+        if (found != _idle.end() && size >= found->first - found->first / 4) {
+            void* data = found->second;
+            std::size_t blockSize = found->first;
+
+            _idle.erase(found);
+            _idleBytes -= blockSize;
+            _usedBytes += blockSize;
+            _numReused++;
+
+            return data;
+        }
+    }
+
+    // The system call runs unlocked, other threads keep using the pool.
+    Block block;
+    void* data = _systemAllocate(size, block);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _blocks[data] = block;
+    _usedBytes += block.size;
+    _numAllocated++;
+
+    return data;
+}
+
+
+void BufferPool::release(void* data) {
+    if (data == nullptr) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto found = _blocks.find(data);
+    Block block = found->second;
+
+    _usedBytes -= block.size;
+
+    if (_idleBytes + block.size <= _maxIdleBytes) {
+        _idle.insert(std::make_pair(block.size, data));
+        _idleBytes += block.size;
+        return;
+    }
+
+    _blocks.erase(found);
+    lock.unlock();
+
+    _systemFree(block);
+}
+
+
+void BufferPool::trim() {
+    std::vector<Block> freed;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        for (auto& idle : _idle) {
+            auto found = _blocks.find(idle.second);
+            freed.push_back(found->second);
+            _blocks.erase(found);
+        }
+
+        _idle.clear();
+        _idleBytes = 0;
+    }
+
+    for (const Block& block : freed) {
+        _systemFree(block);
+    }
+}
+
+
+std::size_t BufferPool::getUsedBytes() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _usedBytes;
+}
+
+
+std::size_t BufferPool::getIdleBytes() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _idleBytes;
+}
+
+
+BufferPool* BufferPool::shared() {
+    return _shared.load();
+}
+
+
+void BufferPool::setShared(BufferPool* pool) {
+    _shared.store(pool);
+}
+
+
+std::size_t BufferPool::_roundUp(std::size_t bytes) {
+    if (bytes >= GRANULE) {
+        return (bytes + GRANULE - 1) / GRANULE * GRANULE;
+    }
+
+    std::size_t size = 4096;
+
+    while (size < bytes) {
+        size *= 2;
+    }
+
+    return size;
+}
+
+
+void* BufferPool::_systemAllocate(std::size_t size, Block& block) {
+    block.size = size;
+
+#ifndef _WIN32
+    if (size >= GRANULE) {
+        void* data = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+        // Only works with huge pages set aside by the administrator.
+        if (_hugePages) {
+            data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        }
+#endif
+
+        if (data == MAP_FAILED) {
+            // Transparent huge pages need the block to start on a boundary:
+            // map a granule more and cut off what is left at either end.
+            std::size_t extra = _hugePages ? GRANULE : 0;
+            char* raw = (char*) mmap(nullptr, size + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if (raw == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+
+            std::size_t head = extra ? (GRANULE - reinterpret_cast<uintptr_t>(raw) % GRANULE) % GRANULE : 0;
+
+            if (head > 0) {
+                munmap(raw, head);
+            }
+
+            if (extra - head > 0) {
+                munmap(raw + head + size, extra - head);
+            }
+
+            data = raw + head;
+
+#ifdef MADV_HUGEPAGE
+            if (_hugePages) {
+                madvise(data, size, MADV_HUGEPAGE);
+            }
+#endif
+        }
+
+        block.raw = data;
+        block.mapped = true;
+
+        return data;
+    }
+#endif
+
+    char* raw = static_cast<char*>(::operator new(size + ALIGNMENT));
+
+    block.raw = raw;
+    block.mapped = false;
+
+    return raw + ALIGNMENT - reinterpret_cast<uintptr_t>(raw) % ALIGNMENT;
+}
+
+
+void BufferPool::_systemFree(const Block& block) {
+#ifndef _WIN32
+    if (block.mapped) {
+        munmap(block.raw, block.size);
+        return;
+    }
+#endif
+
+    ::operator delete(block.raw);
+}
@@ -0,0 +1,82 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+
+
+// Keeps large aligned blocks around after they are released and hands them
+// out again, so that a batch of similar jobs stops calling malloc and free,
+// and stops faulting in fresh pages, after the first few files. Sizes are
+// rounded up (to a power of two below GRANULE, to a multiple of it above),
+// and a released block serves any later request up to a quarter smaller.
+//
+// Blocks of GRANULE and up are mapped straight from the system; with huge
+// pages they are aligned to GRANULE and backed by huge pages where the
+// system allows it, falling back to normal pages where it doesn't.
+//
+// Thread safe. Every block must be released before the pool is destroyed.
+class BufferPool {
+    public:
+        static const std::size_t ALIGNMENT = 64;
+        static const std::size_t GRANULE = 2 << 20;     // a huge page on x86-64 and ARM64
+        static const std::size_t DEFAULT_MAX_IDLE_BYTES = std::size_t(1) << 30;
+
+        // Idle blocks beyond maxIdleBytes go back to the system.
+        explicit BufferPool(std::size_t maxIdleBytes = DEFAULT_MAX_IDLE_BYTES, bool hugePages = false);
+        ~BufferPool();
+
+        BufferPool(const BufferPool&) = delete;
+        BufferPool& operator =(const BufferPool&) = delete;
+
+        // At least bytes, aligned to ALIGNMENT, contents undefined.
+        void*       allocate(std::size_t bytes);
+        void        release(void* block);
+
+        // Returns every idle block to the system, e.g. between batches of
+        // very different file sizes.
+        void        trim();
+
+        std::size_t getUsedBytes() const;
+        std::size_t getIdleBytes() const;
+        uint64_t    getNumAllocated() const { return _numAllocated; }     // from the system
+        uint64_t    getNumReused() const { return _numReused; }
+
+        // Pool used by SampleBuffer, and so by WavFile, BlockCache and
+        // AsyncWriter; nullptr, the default, allocates every buffer anew.
+        static BufferPool*  shared();
+        static void         setShared(BufferPool* pool);
+
+    private:
+        struct Block {
+            void*       raw;            // as allocated, before aligning
+            std::size_t size;           // usable bytes
+            bool        mapped;
+        };
+
+        std::size_t _maxIdleBytes;
+        bool        _hugePages;
+
+        mutable std::mutex                          _mutex;
+        std::multimap<std::size_t, void*>           _idle;      // by size
+        std::unordered_map<void*, Block>            _blocks;    // idle and in use
+        std::size_t                                 _usedBytes;
+        std::size_t                                 _idleBytes;
+        uint64_t                                    _numAllocated;
+        uint64_t                                    _numReused;
+
+        static std::atomic<BufferPool*>  _shared;
+
+        static std::size_t  _roundUp(std::size_t bytes);
+
+        void*   _systemAllocate(std::size_t size, Block& block);
+        void    _systemFree(const Block& block);
+};
+
+
+#endif // BUFFERPOOL_H
@@ -0,0 +1,106 @@
+#include "DuckingEngine.h"
+
+
+DuckingEngine::DuckingEngine(uint32_t sampleRate, double attack, double release, double silence,
+                             double ratio, uint64_t preroll):
+    _silenceFrames((uint64_t)(silence*sampleRate)),
+    _ratio(ratio),
+    _attackStep(ratio/(attack*sampleRate)),
+    _releaseStep(ratio/(release*sampleRate)),
+    _ratioGain(DecibelMath::dbToGain(-_ratio)),
+    _attackFactor(DecibelMath::dbToGain(-_attackStep)),
+    _releaseFactor(DecibelMath::dbToGain(_releaseStep)),
+    _leadingQuiet(0),
+    _skipFrames(0),
+    _window(_silenceFrames + 1, 0),
+    _head(0),
+    _count(0),
+    _loudCount(0),
+    _voiceEnded(false),
+    _envelope(0.),
+    _gain(1.),
+    _held(0)
+{
+    uint64_t lead = (uint64_t)(attack*sampleRate);
+
+    // A voice that starts later than the track is padded with quiet frames.
+    _leadingQuiet = preroll > lead ? preroll - lead : 0;
+    _skipFrames = lead > preroll ? lead - preroll : 0;
+    _fill();
+}
+
+
+void DuckingEngine::pushVoice(bool loud) {
+    if (_skipFrames > 0) {
+        _skipFrames--;
+        return;
+    }
+
+    _window[_wrap(_head + _count)] = loud;
+    _count++;
+    _loudCount += loud;
+}
+
+
+double DuckingEngine::next() {
+    bool loud = _window[_head] != 0;
+
+    if (loud) {
+        _held = 0;
+        _attack();
+    } else if (_held < _silenceFrames && _envelope != 0) {
+        // All of the look-ahead quiet means the hold is going to run out.
+        if (_held == 0 && _count == _window.size() && _loudCount == 0) {
+            _envelope = std::min(_envelope + _silenceFrames * _attackStep, _ratio);
+            _gain = DecibelMath::dbToGain(-_envelope);
+            _held = _silenceFrames + 1;
+            _release();
+        } else {
+            _attack();
+            _held++;
+        }
+    } else {
+        if (_held == _silenceFrames) {
+            _held++;
+        }
+        _release();
+    }
+
+    _loudCount -= loud;
+    _head = _wrap(_head + 1);
+    _count--;
+    _fill();
+
+    return _envelope;
+}
+
+
+void DuckingEngine::_attack() {
+    if (_envelope < _ratio) {
+        _envelope += _attackStep;
+        _gain *= _attackFactor;
+    } else {
+        _envelope = _ratio;
+        _gain = _ratioGain;
+    }
+}
+
+
+void DuckingEngine::_release() {
+    if (_envelope > 0) {
+        _envelope -= _releaseStep;
+        _gain *= _releaseFactor;
+    } else {
+        _envelope = 0;
+        _gain = 1.;
+    }
+}
+
+
+void DuckingEngine::_fill() {
+    while (_leadingQuiet > 0 && _count < _window.size()) {
+        _window[_wrap(_head + _count)] = 0;
+        _count++;
+        _leadingQuiet--;
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef DUCKINGENGINE_H
+#define DUCKINGENGINE_H
+
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include "Decibel/decibel.h"
+
+
+// Gain envelope of overVoice(), computed strictly forward with constant work
+// per frame. Loud voice frames ramp the attenuation up to the ratio over the
+// attack time; once the voice goes quiet the attenuation is held for the
+// silence time and then released. Voice frames are looked at getLookAhead()
+// frames ahead of the frame being ducked, which is enough to tell at the
+// start of a quiet stretch whether the hold will run out. If it will, the
+// release starts right there rather than after the hold.
+//
+// The voice is aligned the way overVoice() always has: frame f of the ducked
+// track is keyed by voice frame f + attack * sampleRate - preroll.
+class DuckingEngine {
+    public:
+        DuckingEngine(uint32_t sampleRate, double attack, double release, double silence,
+                      double ratio, uint64_t preroll);
+
+        // Level detector of the legacy loop: peak over the channels against
+        // the threshold.
+        template<typename T>
+        static bool isLoud(const T* frame, uint16_t numChannels, const DecibelGate<T>& threshold) {
+            T mux = 0;
+
+            for (uint16_t i = 0; i < numChannels; i++) {
+                mux = std::max(mux, frame[i]);
+            }
+
+            return threshold.passes(T(mux / (std::size_t) numChannels));
+        }
+
+        uint64_t    getLookAhead() const { return _window.size(); }
+
+        // Voice frames go in, in order, until isReady() or the voice runs out.
+        void        pushVoice(bool loud);
+        void        endVoice() { _voiceEnded = true; }
+        bool        isReady() const { return _voiceEnded || _count == _window.size(); }
+
+        // True once there is no voice left for the next frame; the rest of
+        // the track is left as it is.
+        bool        isDone() const { return _count == 0 && _voiceEnded && _leadingQuiet == 0; }
+
+        // Attenuation in dB for the next frame. Requires isReady() && !isDone().
+        double      next();
+
+        // The same attenuation as a factor. It follows the attack and release
+        // ramps by multiplication, so there is no dB conversion per frame.
+        double      getGain() const { return _gain; }
+
+    private:
+        uint64_t            _silenceFrames;
+        double              _ratio;
+        double              _attackStep;
+        double              _releaseStep;
+        double              _ratioGain;
+        double              _attackFactor;
+        double              _releaseFactor;
+        uint64_t            _leadingQuiet;
+        uint64_t            _skipFrames;
+
+        std::vector<char>   _window;    // loud flags, ring of lookahead frames
+        uint64_t            _head;
+        uint64_t            _count;
+        uint64_t            _loudCount;
+        bool                _voiceEnded;
+
+        double              _envelope;
+        double              _gain;
+        uint64_t            _held;      // quiet frames held so far, > _silenceFrames once released
+
+        void    _attack();
+        void    _release();
+        void    _fill();
+
+        // Ring index of _head + n, n being at most the window size; a
+        // division per frame would cost more than the envelope itself.
+        uint64_t _wrap(uint64_t index) const {
+            return index >= _window.size() ? index - _window.size() : index;
+        }
+};
+
+
+#endif // DUCKINGENGINE_H
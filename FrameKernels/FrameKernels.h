@@ -0,0 +1,136 @@
+#ifndef FRAMEKERNELS_H
+#define FRAMEKERNELS_H
+
+
+#include <cstdint>
+#include <algorithm>
+#include <cmath>
+
+
+// Whole frame loops between interleaved samples and one contiguous array per
+// channel. Mono, stereo, 5.1 and 7.1 get their own instances with the
+// channel count known at compile time, so the loop over the channels of a
+// frame is unrolled and the divisions are by a constant; other counts take
+// the generic instance. Pick the instance once per call, not per sample.
+//
+// convert(sample) turns a source sample into a destination one; Copy is the
+// plain assignment.
+class FrameKernels {
+    public:
+        template<typename T>
+        struct Copy {
+            T operator()(const T& sample) const { return sample; }
+        };
+
+        // dst[c][f] = convert(src[f * numChannels + c]) for frames f in
+        // [first, first + numFrames), src and dst pointing at frame 0.
+        template<typename S, typename D, typename Convert>
+        static void deinterleave(const S* src, D* const* dst, uint64_t first, uint64_t numFrames,
+                                 int numChannels, Convert convert) {
+            switch (numChannels) {
+                case 1: _deinterleave<1>(src, dst, first, numFrames, 1, convert); break;
+                case 2: _deinterleave<2>(src, dst, first, numFrames, 2, convert); break;
+                case 6: _deinterleave<6>(src, dst, first, numFrames, 6, convert); break;
+                case 8: _deinterleave<8>(src, dst, first, numFrames, 8, convert); break;
+                default: _deinterleave<0>(src, dst, first, numFrames, numChannels, convert); break;
+            }
+        }
+
+        // dst[f * numChannels + c] = convert(src[c][f]), the other way round.
+        template<typename S, typename D, typename Convert>
+        static void interleave(const S* const* src, D* dst, uint64_t first, uint64_t numFrames,
+                               int numChannels, Convert convert) {
+            switch (numChannels) {
+                case 1: _interleave<1>(src, dst, first, numFrames, 1, convert); break;
+                case 2: _interleave<2>(src, dst, first, numFrames, 2, convert); break;
+                case 6: _interleave<6>(src, dst, first, numFrames, 6, convert); break;
+                case 8: _interleave<8>(src, dst, first, numFrames, 8, convert); break;
+                default: _interleave<0>(src, dst, first, numFrames, numChannels, convert); break;
+            }
+        }
+
+        // dst[f] += src[f] / numChannels, a mono track's share of one of
+        // numChannels channels, with the division of the sample type; 8-bit
+        // samples see _addSample(). dst and src are pointers or ChannelViews.
+        template<typename Dst, typename Src>
+        static void addShare(Dst dst, Src src, uint64_t numFrames, int numChannels) {
+            switch (numChannels) {
+                case 1: _addShare<1>(dst, src, numFrames, 1); break;
+                case 2: _addShare<2>(dst, src, numFrames, 2); break;
+                case 6: _addShare<6>(dst, src, numFrames, 6); break;
+                case 8: _addShare<8>(dst, src, numFrames, 8); break;
+                default: _addShare<0>(dst, src, numFrames, numChannels); break;
+            }
+        }
+
+    private:
+        // CHANNELS is 0 for the generic instance, which reads numChannels.
+        template<int CHANNELS, typename S, typename D, typename Convert>
+        static void _deinterleave(const S* src, D* const* dst, uint64_t first, uint64_t numFrames,
+                                  int numChannels, Convert convert) {
+            const int channels = CHANNELS ? CHANNELS : numChannels;
+            const S* frame = src + first * channels;
+
+            // Local copies, so that the stores can't alias the pointers.
+            D* lanes[CHANNELS ? CHANNELS : 1];
+            D* const* out = dst;
+
+            if (CHANNELS) {
+                std::copy(dst, dst + channels, lanes);
+                out = lanes;
+            }
+
+            for (uint64_t f = first; f < first + numFrames; f++, frame += channels) {
+                for (int c = 0; c < channels; c++) {
+                    out[c][f] = convert(frame[c]);
+                }
+            }
+        }
+
+        template<int CHANNELS, typename S, typename D, typename Convert>
+        static void _interleave(const S* const* src, D* dst, uint64_t first, uint64_t numFrames,
+                                int numChannels, Convert convert) {
+            const int channels = CHANNELS ? CHANNELS : numChannels;
+            D* frame = dst + first * channels;
+
+            const S* lanes[CHANNELS ? CHANNELS : 1];
+            const S* const* in = src;
+
+            if (CHANNELS) {
+                std::copy(src, src + channels, lanes);
+                in = lanes;
+            }
+
+            for (uint64_t f = first; f < first + numFrames; f++, frame += channels) {
+                for (int c = 0; c < channels; c++) {
+                    frame[c] = convert(in[c][f]);
+                }
+            }
+        }
+
+        template<int CHANNELS, typename Dst, typename Src>
+        static void _addShare(Dst dst, Src src, uint64_t numFrames, int numChannels) {
+            const int channels = CHANNELS ? CHANNELS : numChannels;
+
+            for (uint64_t f = 0; f < numFrames; f++) {
+                _addSample(dst[f], src[f], channels);
+            }
+        }
+
+        template<typename T>
+        static void _addSample(T& dst, const T& src, int channels) {
+            dst += src / channels;
+        }
+
+        // 8-bit bytes are unsigned, centred on 128. The share is added to
+        // the offset of dst in float, saturated and rounded back to a byte
+        // the way float processing quantizes it, so both give the same bytes.
+        static void _addSample(int8_t& dst, int8_t src, int channels) {
+            float sum = ((uint8_t) dst - 128) * (1.f / 128) + ((uint8_t) src - 128) * (1.f / 128) / channels;
+
+            dst = (int8_t) (uint8_t) (lrintf(std::min(std::max(sum * 128.f, -128.f), 127.f)) + 128);
+        }
+};
+
+
+#endif // FRAMEKERNELS_H
@@ -32,14 +32,9 @@ public:
 
     operator int() const
     {
-        if ( m_Internal[2] & 0x80 ) // Is this a negative?  Then we need to siingn extend.
-        {
-            return (0xff << 24) | (m_Internal[2] << 16) | (m_Internal[1] << 8) | (m_Internal[0] << 0);
-        }
-        else
-        {
-            return (m_Internal[2] << 16) | (m_Internal[1] << 8) | (m_Internal[0] << 0);
-        }
+        // Build the value in the top 24 bits, the arithmetic shift sign extends it.
+        unsigned int bits   = ((unsigned int)m_Internal[2] << 24) | (m_Internal[1] << 16) | (m_Internal[0] << 8);
+        return (int)bits >> 8;
     }
 
     operator float() const
@@ -72,19 +67,13 @@ public:
 
     Int24& operator =( const float input )
     {
-        m_Internal[0]   = ((unsigned char*)&input)[0];
-        m_Internal[1]   = ((unsigned char*)&input)[1];
-        m_Internal[2]   = ((unsigned char*)&input)[2];
-
+        *this   = (int)input;  // the value, not the first three bytes of its representation
         return *this;
     }
 
     Int24& operator =( const double input )
     {
-        m_Internal[0]   = ((unsigned char*)&input)[0];
-        m_Internal[1]   = ((unsigned char*)&input)[1];
-        m_Internal[2]   = ((unsigned char*)&input)[2];
-
+        *this   = (int)input;
         return *this;
     }
 
@@ -0,0 +1,229 @@
+#include "LevelDetector.h"
+#include "MixKernels/MixKernels.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define LEVELDETECTOR_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define LEVELDETECTOR_AVX2
+#else
+#define LEVELDETECTOR_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+
+// level[f] = max(level[f], x) or level[f] + x, x being src[f] or |src[f]|.
+template<bool LOUDEST, bool ABSOLUTE>
+static void foldScalar(float* level, const float* src, uint64_t n) {
+    for (uint64_t f = 0; f < n; f++) {
+        float x = ABSOLUTE ? std::fabs(src[f]) : src[f];
+        level[f] = LOUDEST ? std::max(level[f], x) : level[f] + x;
+    }
+}
+
+
+static void squareScalar(float* dst, const float* src, uint64_t n) {
+    for (uint64_t f = 0; f < n; f++) {
+        dst[f] = src[f] * src[f];
+    }
+}
+
+
+static void compareScalar(const float* level, uint64_t n, float limit, char* loud) {
+    for (uint64_t f = 0; f < n; f++) {
+        loud[f] = level[f] > limit;
+    }
+}
+
+
+#ifdef LEVELDETECTOR_X86
+
+template<bool LOUDEST, bool ABSOLUTE>
+static void foldSse(float* level, const float* src, uint64_t n) {
+    const __m128 sign = _mm_set1_ps(-0.f);
+    uint64_t f = 0;
+
+    for (; f + 4 <= n; f += 4) {
+        __m128 x = _mm_loadu_ps(src + f);
+        __m128 l = _mm_loadu_ps(level + f);
+
+        if (ABSOLUTE) {
+            x = _mm_andnot_ps(sign, x);
+        }
+
+        _mm_storeu_ps(level + f, LOUDEST ? _mm_max_ps(l, x) : _mm_add_ps(l, x));
+    }
+
+    foldScalar<LOUDEST, ABSOLUTE>(level + f, src + f, n - f);
+}
+
+
+static void squareSse(float* dst, const float* src, uint64_t n) {
+    uint64_t f = 0;
+
+    for (; f + 4 <= n; f += 4) {
+        __m128 x = _mm_loadu_ps(src + f);
+        _mm_storeu_ps(dst + f, _mm_mul_ps(x, x));
+    }
+
+    squareScalar(dst + f, src + f, n - f);
+}
+
+
+// 16 comparisons packed down to 16 bytes of 0 or 1.
+static void compareSse(const float* level, uint64_t n, float limit, char* loud) {
+    const __m128 l = _mm_set1_ps(limit);
+    const __m128i one = _mm_set1_epi8(1);
+    uint64_t f = 0;
+
+    for (; f + 16 <= n; f += 16) {
+        __m128i a = _mm_castps_si128(_mm_cmpgt_ps(_mm_loadu_ps(level + f), l));
+        __m128i b = _mm_castps_si128(_mm_cmpgt_ps(_mm_loadu_ps(level + f + 4), l));
+        __m128i c = _mm_castps_si128(_mm_cmpgt_ps(_mm_loadu_ps(level + f + 8), l));
+        __m128i d = _mm_castps_si128(_mm_cmpgt_ps(_mm_loadu_ps(level + f + 12), l));
+        __m128i bytes = _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+
+        _mm_storeu_si128((__m128i*) (loud + f), _mm_and_si128(bytes, one));
+    }
+
+    compareScalar(level + f, n - f, limit, loud + f);
+}
+
+
+template<bool LOUDEST, bool ABSOLUTE>
+LEVELDETECTOR_AVX2
+static void foldAvx2(float* level, const float* src, uint64_t n) {
+    const __m256 sign = _mm256_set1_ps(-0.f);
+    uint64_t f = 0;
+
+    for (; f + 8 <= n; f += 8) {
+        __m256 x = _mm256_loadu_ps(src + f);
+        __m256 l = _mm256_loadu_ps(level + f);
+
+        if (ABSOLUTE) {
+            x = _mm256_andnot_ps(sign, x);
+        }
+
+        _mm256_storeu_ps(level + f, LOUDEST ? _mm256_max_ps(l, x) : _mm256_add_ps(l, x));
+    }
+
+    foldScalar<LOUDEST, ABSOLUTE>(level + f, src + f, n - f);
+}
+
+
+LEVELDETECTOR_AVX2
+static void squareAvx2(float* dst, const float* src, uint64_t n) {
+    uint64_t f = 0;
+
+    for (; f + 8 <= n; f += 8) {
+        __m256 x = _mm256_loadu_ps(src + f);
+        _mm256_storeu_ps(dst + f, _mm256_mul_ps(x, x));
+    }
+
+    squareScalar(dst + f, src + f, n - f);
+}
+
+#endif // LEVELDETECTOR_X86
+
+
+// The loops of the ISA in use. Comparing is bound by the stores, the SSE
+// version serves AVX2 as well.
+struct DetectorKernels {
+    void (*foldLoudest)(float*, const float*, uint64_t);
+    void (*foldMean)(float*, const float*, uint64_t);
+    void (*foldLoudestAbsolute)(float*, const float*, uint64_t);
+    void (*foldMeanAbsolute)(float*, const float*, uint64_t);
+    void (*square)(float*, const float*, uint64_t);
+    void (*compare)(const float*, uint64_t, float, char*);
+};
+
+
+static DetectorKernels detectorKernels() {
+#ifdef LEVELDETECTOR_X86
+    switch (MixKernels::getIsa()) {
+        case MixKernels::AVX2_ISA:
+            return { foldAvx2<true, false>, foldAvx2<false, false>, foldAvx2<true, true>, foldAvx2<false, true>,
+                     squareAvx2, compareSse };
+
+        case MixKernels::SSE2_ISA:
+            return { foldSse<true, false>, foldSse<false, false>, foldSse<true, true>, foldSse<false, true>,
+                     squareSse, compareSse };
+
+        case MixKernels::SCALAR_ISA:
+            break;
+    }
+#endif
+
+    return { foldScalar<true, false>, foldScalar<false, false>, foldScalar<true, true>, foldScalar<false, true>,
+             squareScalar, compareScalar };
+}
+
+
+LevelDetector::LevelDetector(Mode mode, Linking linking, double threshold, uint16_t numChannels, uint64_t windowFrames):
+    _mode(mode),
+    _linking(linking),
+    _numChannels(numChannels),
+    _windowFrames(std::max<uint64_t>(windowFrames, 1))
+{
+    // The mean is left as a sum, so the limit takes the channel count.
+    double limit = mode == RMS_DETECTION ? threshold * threshold : threshold;
+    _limit = (float) (linking == MEAN_LINKING ? limit * numChannels : limit);
+
+    reset();
+}
+
+
+void LevelDetector::reset() {
+    if (_mode == RMS_DETECTION) {
+        _squares.assign(_numChannels, std::vector<float>(_windowFrames, 0.f));
+        _sums.assign(_numChannels, 0.);
+    }
+}
+
+
+void LevelDetector::process(const float* const* channels, uint64_t numFrames, char* loud) {
+    DetectorKernels kernels = detectorKernels();
+
+    _level.assign(numFrames, 0.f);
+
+    for (int c = 0; c < _numChannels; c++) {
+        if (_mode == PEAK_DETECTION) {
+            (_linking == LOUDEST_LINKING ? kernels.foldLoudestAbsolute : kernels.foldMeanAbsolute)
+                (_level.data(), channels[c], numFrames);
+            continue;
+        }
+
+        _meanSquare(c, channels[c], numFrames);
+        (_linking == LOUDEST_LINKING ? kernels.foldLoudest : kernels.foldMean)
+            (_level.data(), _meanSquares.data(), numFrames);
+    }
+
+    kernels.compare(_level.data(), numFrames, _limit, loud);
+}
+
+
+// Mean squares over the window ending at each frame of the block, into
+// _meanSquares. The squares are vectorized; the running sum is a double so
+// that it returns to silence after any amount of adding and subtracting.
+void LevelDetector::_meanSquare(int channel, const float* src, uint64_t numFrames) {
+    std::vector<float>& squares = _squares[channel];
+    const uint64_t window = _windowFrames;
+    const double scale = 1. / window;
+    double sum = _sums[channel];
+
+    squares.resize(window + numFrames);
+    _meanSquares.resize(numFrames);
+    detectorKernels().square(squares.data() + window, src, numFrames);
+
+    for (uint64_t f = 0; f < numFrames; f++) {
+        sum += (double) squares[window + f] - squares[f];
+        _meanSquares[f] = (float) (sum * scale);
+    }
+
+    // The last window of squares starts the next block.
+    std::copy(squares.begin() + numFrames, squares.end(), squares.begin());
+    squares.resize(window);
+    _sums[channel] = sum;
+}
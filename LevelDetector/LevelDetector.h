@@ -0,0 +1,66 @@
+#ifndef LEVELDETECTOR_H
+#define LEVELDETECTOR_H
+
+
+#include <cstdint>
+#include <vector>
+
+
+// Sidechain level detector of overVoice(): tells for every voice frame
+// whether it is above a threshold, a block of frames at a time, from one
+// array of normalized floats per channel.
+//
+// PEAK_DETECTION looks at the absolute value of each sample, so negative
+// peaks count as well; RMS_DETECTION at the root mean square over the last
+// windowFrames frames, kept up to date with one add and one subtract per
+// frame. The channels are linked into one level, by the loudest or by the
+// mean, which is compared with a limit worked out once from the threshold
+// (squared for RMS), so there is no logarithm or square root per frame. The
+// block loops use AVX2 or SSE when MixKernels does.
+class LevelDetector {
+    public:
+        enum Mode {
+            PEAK_DETECTION,
+            RMS_DETECTION
+        };
+
+        enum Linking {
+            LOUDEST_LINKING,        // the loudest channel keys
+            MEAN_LINKING            // the mean level of the channels
+        };
+
+        // threshold is a fraction of full scale, e.g. Decibel::getAmplitude().
+        // windowFrames only matters to RMS_DETECTION.
+        LevelDetector(Mode mode, Linking linking, double threshold, uint16_t numChannels, uint64_t windowFrames = 1);
+
+        Mode        getMode() const { return _mode; }
+        Linking     getLinking() const { return _linking; }
+        uint64_t    getWindowFrames() const { return _windowFrames; }
+
+        // Takes the next numFrames frames, channels[c][f], and sets loud[f]
+        // to 1 where the level is above the threshold and to 0 elsewhere.
+        void        process(const float* const* channels, uint64_t numFrames, char* loud);
+
+        // Back to the start of a new stream, the window all silence.
+        void        reset();
+
+    private:
+        Mode        _mode;
+        Linking     _linking;
+        uint16_t    _numChannels;
+        uint64_t    _windowFrames;
+        float       _limit;             // the linked level is loud above it
+
+        std::vector<float>  _level;     // linked level of the block
+
+        // RMS: per channel the squares of the last _windowFrames frames
+        // followed by those of the block, and their running sum.
+        std::vector<std::vector<float>> _squares;
+        std::vector<double> _sums;
+        std::vector<float>  _meanSquares;
+
+        void    _meanSquare(int channel, const float* src, uint64_t numFrames);
+};
+
+
+#endif // LEVELDETECTOR_H
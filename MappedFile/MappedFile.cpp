@@ -0,0 +1,219 @@
+#include "MappedFile.h"
+#include <algorithm>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+MappedFile::MappedFile():
+    _data(nullptr),
+    _size(0)
+#ifdef _WIN32
+    , _fileHandle(INVALID_HANDLE_VALUE)
+    , _mapHandle(nullptr)
+#else
+    , _fd(-1)
+#endif
+{}
+
+
+MappedFile::MappedFile(const std::string& filePath):
+    MappedFile()
+{
+    open(filePath);
+}
+
+
+MappedFile::MappedFile(MappedFile&& other):
+    MappedFile()
+{
+    *this = std::move(other);
+}
+
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+
+MappedFile& MappedFile::operator =(MappedFile&& other) {
+    if (this != &other) {
+        close();
+
+        _data = other._data;
+        _size = other._size;
+        _copy = std::move(other._copy);
+        other._data = nullptr;
+        other._size = 0;
+
+#ifdef _WIN32
+        _fileHandle = other._fileHandle;
+        _mapHandle = other._mapHandle;
+        other._fileHandle = INVALID_HANDLE_VALUE;
+        other._mapHandle = nullptr;
+#else
+        _fd = other._fd;
+        other._fd = -1;
+#endif
+    }
+
+    return *this;
+}
+
+
+void MappedFile::align(uint64_t offset, std::size_t alignment) {
+    if (_data == nullptr || (uintptr_t) (_data + offset) % alignment == 0) {
+        return;
+    }
+
+    std::vector<char> copy(_size + alignment);
+    std::size_t shift = (alignment - (uintptr_t) (copy.data() + offset) % alignment) % alignment;
+    uint64_t size = _size;
+
+    std::copy(_data, _data + _size, copy.data() + shift);
+    close();
+
+    _copy = std::move(copy);
+    _data = _copy.data() + shift;
+    _size = size;
+}
+
+
+#ifdef _WIN32
+
+void MappedFile::open(const std::string& filePath) {
+    close();
+
+    _fileHandle = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+    if (_fileHandle == INVALID_HANDLE_VALUE) {
+        throw MapFailedException(std::string("File '") + filePath +
+                                 std::string("' can't be opened!"));
+    }
+
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(_fileHandle, &fileSize);
+    _size = (uint64_t) fileSize.QuadPart;
+
+    if (_size == 0) {
+        return;
+    }
+
+    _mapHandle = CreateFileMappingA(_fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+    if (_mapHandle != nullptr) {
+        _data = (const char*) MapViewOfFile(_mapHandle, FILE_MAP_READ, 0, 0, 0);
+    }
+
+    if (_data == nullptr) {
+        close();
+        throw MapFailedException(std::string("File '") + filePath +
+                                 std::string("' can't be mapped!"));
+    }
+}
+
+
+void MappedFile::close() {
+    if (_data != nullptr && _copy.empty()) {
+        UnmapViewOfFile(_data);
+    }
+
+    _data = nullptr;
+    std::vector<char>().swap(_copy);
+
+    if (_mapHandle != nullptr) {
+        CloseHandle(_mapHandle);
+        _mapHandle = nullptr;
+    }
+
+    if (_fileHandle != INVALID_HANDLE_VALUE) {
+        CloseHandle(_fileHandle);
+        _fileHandle = INVALID_HANDLE_VALUE;
+    }
+
+    _size = 0;
+}
+
+
+void MappedFile::adviseSequential(uint64_t, uint64_t) const {
+    // FILE_FLAG_SEQUENTIAL_SCAN already covers this on Windows
+}
+
+#else
+
+void MappedFile::open(const std::string& filePath) {
+    close();
+
+    _fd = ::open(filePath.c_str(), O_RDONLY);
+
+    if (_fd < 0) {
+        throw MapFailedException(std::string("File '") + filePath +
+                                 std::string("' can't be opened!"));
+    }
+
+    struct stat st;
+
+    if (fstat(_fd, &st) != 0) {
+        close();
+        throw MapFailedException(std::string("File '") + filePath +
+                                 std::string("' can't be stat'ed!"));
+    }
+
+    _size = (uint64_t) st.st_size;
+
+    if (_size == 0) {
+        return;
+    }
+
+    void* addr = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+
+    if (addr == MAP_FAILED) {
+        close();
+        throw MapFailedException(std::string("File '") + filePath +
+                                 std::string("' can't be mapped!"));
+    }
+
+    _data = (const char*) addr;
+}
+
+
+void MappedFile::close() {
+    if (_data != nullptr && _copy.empty()) {
+        munmap((void*) _data, _size);
+    }
+
+    _data = nullptr;
+    std::vector<char>().swap(_copy);
+
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+
+    _size = 0;
+}
+
+
+void MappedFile::adviseSequential(uint64_t offset, uint64_t length) const {
+    if (_data == nullptr || !_copy.empty() || offset >= _size) {
+        return;
+    }
+
+    // madvise wants a page aligned start
+    uint64_t pageSize = (uint64_t) sysconf(_SC_PAGESIZE);
+    uint64_t begin = offset - offset % pageSize;
+    uint64_t end = std::min(offset + length, _size);
+
+    madvise((void*) (_data + begin), end - begin, MADV_SEQUENTIAL);
+    madvise((void*) (_data + begin), end - begin, MADV_WILLNEED);
+}
+
+#endif
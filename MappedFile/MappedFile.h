@@ -0,0 +1,63 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+
+class MapFailedException : public std::runtime_error {
+    public:
+        MapFailedException(std::string errorMessage):
+            std::runtime_error(errorMessage)
+        {}
+};
+
+
+// Read-only memory mapping of a whole file, or a copy of it after align().
+// Owns the mapping and releases it on destruction; movable, not copyable.
+class MappedFile {
+    public:
+        MappedFile();
+        MappedFile(const std::string& filePath);
+        MappedFile(MappedFile&& other);
+        ~MappedFile();
+
+        MappedFile& operator =(MappedFile&& other);
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator =(const MappedFile&) = delete;
+
+        void        open(const std::string& filePath);
+        void        close();
+
+        bool        isOpen() const { return _data != nullptr; }
+        const char* data() const { return _data; }
+        uint64_t    size() const { return _size; }
+
+        // Hint that [offset, offset + length) will be read front to back.
+        void        adviseSequential(uint64_t offset, uint64_t length) const;
+
+        // Swaps the mapping for a copy in memory in which data() + offset is
+        // a multiple of alignment, unless it already is. Mappings start on a
+        // page, so that only copies for an offset that isn't a multiple.
+        void        align(uint64_t offset, std::size_t alignment);
+
+    private:
+        const char* _data;
+        uint64_t    _size;
+        std::vector<char>   _copy;      // the data of align(), if it copied
+
+#ifdef _WIN32
+        void*       _fileHandle;
+        void*       _mapHandle;
+#else
+        int         _fd;
+#endif
+};
+
+
+#endif // MAPPEDFILE_H
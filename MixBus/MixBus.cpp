@@ -0,0 +1,279 @@
+#include "MixBus.h"
+#include "Pcm24/Pcm24.h"
+#include "ThreadPool/ThreadPool.h"
+#include <cmath>
+#include <memory>
+#include <algorithm>
+
+
+// Range of the summed values, and full scale for normalized floats.
+template<typename T> struct SampleRange;
+template<> struct SampleRange<int8_t>  { static double min() { return -128; } static double max() { return 127; } static double scale() { return 128; } };
+template<> struct SampleRange<int16_t> { static double min() { return -32768; } static double max() { return 32767; } static double scale() { return 32768; } };
+template<> struct SampleRange<Int24>   { static double min() { return Pcm24::MIN_VALUE; } static double max() { return Pcm24::MAX_VALUE; } static double scale() { return 8388608; } };
+template<> struct SampleRange<float>   { static double scale() { return 1; } };
+
+
+// 8-bit samples are the file's unsigned bytes, centred on 128; they are
+// summed as offsets from 128 and stored with the 128 added back.
+static inline int centred(int8_t sample) { return (uint8_t) sample - 128; }
+template<typename T> static inline const T& centred(const T& sample) { return sample; }
+
+template<typename T> static inline T uncentred(int value) { return T(value); }
+template<> inline int8_t uncentred<int8_t>(int value) { return (int8_t) (uint8_t) (value + 128); }
+
+
+template<typename T, typename Acc>
+static void accumulate(Acc* acc, const ChannelView<T>& src, uint64_t n, Acc gain) {
+    const T* p = src.data();
+    std::size_t stride = src.stride();
+
+    if (stride == 1) {
+        for (uint64_t i = 0; i < n; i++) {
+            acc[i] += Acc(centred(p[i])) * gain;
+        }
+        return;
+    }
+
+    for (uint64_t i = 0; i < n; i++) {
+        acc[i] += Acc(centred(p[i * stride])) * gain;
+    }
+}
+
+
+// Normalized floats out of a resampler; gain includes the full scale.
+template<typename Acc>
+static void accumulate(Acc* acc, const float* src, uint64_t n, Acc gain) {
+    for (uint64_t i = 0; i < n; i++) {
+        acc[i] += Acc(src[i]) * gain;
+    }
+}
+
+
+template<typename T, typename Acc>
+static void store(const Acc* acc, const ChannelView<T>& dst, uint64_t first, uint64_t n) {
+    const Acc lo = (Acc) SampleRange<T>::min();
+    const Acc hi = (Acc) SampleRange<T>::max();
+
+    for (uint64_t i = 0; i < n; i++) {
+        dst[first + i] = uncentred<T>((int) std::lrint(std::min(std::max(acc[i], lo), hi)));
+    }
+}
+
+
+// Float samples aren't clamped, the same as in MixKernels.
+template<>
+void store<float, float>(const float* acc, const ChannelView<float>& dst, uint64_t first, uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        dst[first + i] = acc[i];
+    }
+}
+
+
+MixBus::MixBus(uint16_t numChannels):
+    _numChannels(numChannels)
+{}
+
+
+void MixBus::addInput(WavFile& file, float gain, float pan, uint64_t offsetFrames)
+    throw (DifferentNumChannelsException, DifferentBitsPerSampleException) {
+    const WavFile::Header& header = file._header;
+
+    if (_numChannels == 0) {
+        _numChannels = header.numChannels;
+    }
+
+    if (header.numChannels != _numChannels && header.numChannels != 1) {
+        throw DifferentNumChannelsException(std::string("File '") + file._filePath +
+                                            std::string("' has a different numChannels than the bus!"));
+    }
+
+    if (!_inputs.empty() && header.bitsPerSample != _inputs.front().file->_header.bitsPerSample) {
+        throw DifferentBitsPerSampleException(std::string("File '") + file._filePath +
+                                              std::string("' has a different bitsPerSample than the bus!"));
+    }
+
+    if (!_inputs.empty() && file._floatProcessing != _inputs.front().file->_floatProcessing) {
+        throw DifferentBitsPerSampleException(std::string("File '") + file._filePath +
+                                              std::string("' is processed as a different sample type than the bus!"));
+    }
+
+    Input input;
+    input.file = &file;
+    input.gain = gain;
+    input.pan = std::min(std::max(pan, -1.f), 1.f);
+    input.offset = offsetFrames;
+
+    _inputs.push_back(input);
+}
+
+
+uint64_t MixBus::getNumFrames() const {
+    uint64_t numFrames = 0;
+
+    for (const Input& input : _inputs) {
+        numFrames = std::max(numFrames, input.offset + _busFrames(input, input.file->getNumFrames()));
+    }
+
+    return numFrames;
+}
+
+
+// Frames an input covers on the bus, which runs at the rate of the first.
+uint64_t MixBus::_busFrames(const Input& input, uint64_t numFrames) const {
+    uint64_t inRate = input.file->_header.sampleRate;
+    uint64_t outRate = _inputs.front().file->_header.sampleRate;
+
+    return inRate == outRate ? numFrames : (numFrames * outRate + inRate - 1) / inRate;
+}
+
+
+WavFile MixBus::render() throw (EmptyMixBusException) {
+    if (_inputs.empty()) {
+        throw EmptyMixBusException("Nothing to mix, the bus has no inputs!");
+    }
+
+    for (const Input& input : _inputs) {
+        input.file->_ensureLoaded();
+    }
+
+    WavFile& first = *_inputs.front().file;
+    WavFile::Header header = first._header;
+    uint64_t numFrames = getNumFrames();
+
+    header.numChannels = _numChannels;
+    header.blockAlign = _numChannels * (header.bitsPerSample / 8);
+    header.byteRate = header.sampleRate * header.blockAlign;
+
+    uint64_t dataSize = numFrames * header.blockAlign;
+    header.subchunk2Size = (uint32_t) std::min<uint64_t>(dataSize, RiffLayout::RIFF_SIZE_LIMIT);
+    header.chunkSize = (uint32_t) std::min<uint64_t>(sizeof (header) - 8 + dataSize, RiffLayout::RIFF_SIZE_LIMIT);
+
+    WavFile out(header);
+    out._dataSize = dataSize;
+    out._storageLayout = first._storageLayout == WavFile::LAZY_STORAGE ? WavFile::PLANAR_STORAGE
+                                                                      : first._storageLayout;
+    out._floatProcessing = first._floatProcessing;
+    out._floatDither = first._floatDither;
+
+    switch (out.getProcessingType()) {
+        case WavFile::INT_8_DATA:
+            _render<int8_t, float>(out, numFrames);
+            break;
+
+        case WavFile::INT_16_DATA:
+            _render<int16_t, float>(out, numFrames);
+            break;
+
+        case WavFile::INT_24_DATA:
+            // float can't hold a sum of 24-bit samples exactly
+            _render<Int24, double>(out, numFrames);
+            break;
+
+        case WavFile::FLT_32_DATA:
+            _render<float, float>(out, numFrames);
+            break;
+    }
+
+    out._dataLoaded = true;
+
+    return out;
+}
+
+
+float MixBus::_channelGain(const Input& input, int channel) const {
+    if (_numChannels != 2) {
+        return input.gain;
+    }
+
+    return input.gain * (channel == 0 ? std::min(1.f, 1.f - input.pan) : std::min(1.f, 1.f + input.pan));
+}
+
+
+// Each channel is summed a block at a time: the accumulator stays in cache,
+// every input is read once and the output written once. An input at another
+// rate goes through a resampler per channel, with the quality of the first
+// input, and is summed as it comes out without rounding in between.
+template<typename T, typename Acc>
+void MixBus::_render(WavFile& out, uint64_t numFrames) {
+    const WavFile& bus = *_inputs.front().file;
+    std::vector<uint64_t> inputFrames;
+    std::vector<std::unique_ptr<Resampler>> resamplers;
+    bool resampling = false;
+
+    for (const Input& input : _inputs) {
+        uint64_t frames = input.file->_numLoadedFrames<T>();
+
+        if (input.file->_header.sampleRate != bus._header.sampleRate) {
+            resamplers.emplace_back(new Resampler(input.file->_header.sampleRate, bus._header.sampleRate,
+                                                  bus._resampleQuality));
+            frames = resamplers.back()->getOutputFrames(frames);
+            resampling = true;
+        } else {
+            resamplers.emplace_back();
+        }
+
+        inputFrames.push_back(frames);
+    }
+
+    out._allocate<T>(numFrames);
+
+    StageTimer timer(out._stats, WavStats::MIX_STAGE, numFrames);
+
+    auto body = [&](int c, uint64_t first, uint64_t last) {
+        std::vector<Acc> acc(BLOCK_FRAMES);
+        std::vector<float> resampled(resampling ? BLOCK_FRAMES : 0);
+        std::vector<std::unique_ptr<ResampledReader>> readers(_inputs.size());
+        ChannelView<T> dst = out._channel<T>(c);
+
+        for (uint64_t from = first; from < last; from += BLOCK_FRAMES) {
+            uint64_t to = std::min(from + BLOCK_FRAMES, last);
+
+            std::fill(acc.begin(), acc.begin() + (to - from), Acc(0));
+
+            for (std::size_t k = 0; k < _inputs.size(); k++) {
+                const Input& input = _inputs[k];
+                uint64_t begin = std::max(from, input.offset);
+                uint64_t end = std::min(to, input.offset + inputFrames[k]);
+
+                if (begin >= end) {
+                    continue;
+                }
+
+                Acc gain = (Acc) _channelGain(input, c);
+                int channel = input.file->_header.numChannels == 1 ? 0 : c;
+
+                // Resampled frames come in order, the blocks of a channel do too.
+                if (resamplers[k]) {
+                    if (!readers[k]) {
+                        readers[k].reset(new ResampledReader(input.file->_resampled<T>(channel, *resamplers[k])));
+                    }
+
+                    uint64_t count = readers[k]->read(resampled.data(), end - begin);
+                    accumulate(acc.data() + (begin - from), resampled.data(), count,
+                               gain * (Acc) SampleRange<T>::scale());
+                    continue;
+                }
+
+                input.file->_forPieces<T>(channel, begin - input.offset, end - begin, false,
+                                          [&](ChannelView<T> src, uint64_t srcFrom, uint64_t srcTo) {
+                    accumulate(acc.data() + (srcFrom + input.offset - from), src, srcTo - srcFrom, gain);
+                });
+            }
+
+            store(acc.data(), dst, from, to - from);
+
+            if (StatsRecorder::ENABLED) {
+                out._stats.addClipped(countClipped(ChannelView<T>(&dst[from], dst.stride(), to - from), to - from));
+            }
+        }
+    };
+
+    // Resampled inputs are read from their start, so every channel is then
+    // summed in one range.
+    if (resampling) {
+        ThreadPool::shared().parallelFor(_numChannels, [&](uint64_t c) { body((int) c, 0, numFrames); });
+    } else {
+        out._forChannelRanges(numFrames, body);
+    }
+}
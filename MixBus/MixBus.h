@@ -0,0 +1,73 @@
+#ifndef MIXBUS_H
+#define MIXBUS_H
+
+
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include "WavFile/WavFile.h"
+
+
+class EmptyMixBusException : public std::runtime_error {
+    public:
+        EmptyMixBusException(std::string errorMessage):
+            std::runtime_error(errorMessage)
+        {}
+};
+
+
+// Sums any number of loaded or mapped WavFiles into a new one in a single
+// pass. Each input has its own gain, pan and start offset. Samples are
+// accumulated in a wider type a block at a time (float, double for 24-bit)
+// and rounded and saturated once, when the block is stored, so the bus
+// never clips or wraps halfway through the sum.
+//
+// Inputs need the bus' bit depth, float processing or not, and either its
+// channel count or a single channel, which then feeds every bus channel.
+// The bus runs at the sample rate of the first input; inputs at another rate
+// are resampled as they are summed (Resampler, with the first input's
+// getResampleQuality()). 8-bit samples are summed around their 128 centre.
+// With float processing the output is summed and kept in float as well. Pan runs from -1 (left) to
+// 1 (right) and only applies to a stereo bus: the far side is turned down
+// linearly, so 0 leaves both channels at full gain.
+class MixBus {
+    public:
+        // 0 takes the channel count of the first input.
+        explicit MixBus(uint16_t numChannels = 0);
+
+        // The file must outlive render(); offsetFrames delays it on the bus.
+        void        addInput(WavFile& file, float gain = 1.f, float pan = 0.f, uint64_t offsetFrames = 0)
+                        throw (DifferentNumChannelsException, DifferentBitsPerSampleException);
+
+        std::size_t getNumInputs() const { return _inputs.size(); }
+
+        // Up to the end of the input that runs longest.
+        uint64_t    getNumFrames() const;
+
+        // Mixes every input into a new file with the header of the first
+        // one, laid out like it in memory. Save it with save(path).
+        WavFile     render() throw (EmptyMixBusException);
+
+    private:
+        struct Input {
+            WavFile*    file;
+            float       gain;
+            float       pan;
+            uint64_t    offset;
+        };
+
+        uint16_t            _numChannels;
+        std::vector<Input>  _inputs;
+
+        // Frames per channel summed in the accumulator before it is stored.
+        static const uint64_t BLOCK_FRAMES = 4096;
+
+        float       _channelGain(const Input& input, int channel) const;
+        uint64_t    _busFrames(const Input& input, uint64_t numFrames) const;
+
+        template<typename T, typename Acc> void _render(WavFile& out, uint64_t numFrames);
+};
+
+
+#endif // MIXBUS_H
@@ -0,0 +1,387 @@
+#include "MixKernels.h"
+#include "Pcm24/Pcm24.h"
+#include <cmath>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MIXKERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define MIXKERNELS_AVX2
+#else
+#define MIXKERNELS_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+
+const uint64_t MixKernels::STRIDED_BLOCK;
+
+
+// Scalar reference; the SIMD paths fall back to it for the tail.
+
+template<typename T>
+static inline T clampRound(float value, float lo, float hi) {
+    return T((int) lrintf(std::min(std::max(value, lo), hi)));
+}
+
+
+// 8-bit WAV samples are unsigned, centred on 128: they are mixed as offsets
+// from 128 and stored with the 128 added back.
+static inline int centred(int8_t sample) { return (uint8_t) sample - 128; }
+static inline int8_t uncentred(int value) { return (int8_t) (uint8_t) (value + 128); }
+
+
+static void mixInt8Scalar(int8_t* dst, const int8_t* src, uint64_t n, float dstGain, float srcGain) {
+    if (dstGain == 1.f && srcGain == 1.f) {
+        for (uint64_t i = 0; i < n; i++) {
+            dst[i] = uncentred(std::min(std::max(centred(dst[i]) + centred(src[i]), -128), 127));
+        }
+        return;
+    }
+
+    for (uint64_t i = 0; i < n; i++) {
+        dst[i] = uncentred(clampRound<int>(centred(dst[i]) * dstGain + centred(src[i]) * srcGain, -128.f, 127.f));
+    }
+}
+
+
+static void mixInt16Scalar(int16_t* dst, const int16_t* src, uint64_t n, float dstGain, float srcGain) {
+    if (dstGain == 1.f && srcGain == 1.f) {
+        for (uint64_t i = 0; i < n; i++) {
+            dst[i] = (int16_t) std::min(std::max(dst[i] + src[i], -32768), 32767);
+        }
+        return;
+    }
+
+    for (uint64_t i = 0; i < n; i++) {
+        dst[i] = clampRound<int16_t>(dst[i] * dstGain + src[i] * srcGain, -32768.f, 32767.f);
+    }
+}
+
+
+// 24-bit samples are unpacked a block at a time into int32 or float lanes,
+// mixed there and packed back with saturation.
+static void mixInt24Wide(Int24* dst, const Int24* src, uint64_t n, float dstGain, float srcGain) {
+    static const uint64_t BLOCK = 1024;
+    bool unity = dstGain == 1.f && srcGain == 1.f;
+
+    for (uint64_t first = 0; first < n; first += BLOCK) {
+        uint64_t count = std::min(BLOCK, n - first);
+
+        if (unity) {
+            int32_t a[BLOCK], b[BLOCK];
+
+            Pcm24::unpack(dst + first, a, count);
+            Pcm24::unpack(src + first, b, count);
+            for (uint64_t i = 0; i < count; i++) {
+                a[i] += b[i];
+            }
+            Pcm24::pack(a, dst + first, count);
+        } else {
+            float a[BLOCK], b[BLOCK];
+
+            Pcm24::unpack(dst + first, a, count);
+            Pcm24::unpack(src + first, b, count);
+            for (uint64_t i = 0; i < count; i++) {
+                a[i] = a[i] * dstGain + b[i] * srcGain;
+            }
+            Pcm24::pack(a, dst + first, count);
+        }
+    }
+}
+
+
+static void mixFlt32Scalar(float* dst, const float* src, uint64_t n, float dstGain, float srcGain) {
+    if (dstGain == 1.f && srcGain == 1.f) {
+        for (uint64_t i = 0; i < n; i++) {
+            dst[i] += src[i];
+        }
+        return;
+    }
+
+    for (uint64_t i = 0; i < n; i++) {
+        dst[i] = dst[i] * dstGain + src[i] * srcGain;
+    }
+}
+
+
+#ifdef MIXKERNELS_X86
+
+// SSE2. The gain paths widen to float, clamp, round and pack back down.
+
+static inline __m128i gainSse2(__m128i a, __m128i b, __m128 ga, __m128 gb, __m128 lo, __m128 hi) {
+    __m128 r = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(a), ga), _mm_mul_ps(_mm_cvtepi32_ps(b), gb));
+    return _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(r, lo), hi));
+}
+
+
+static inline __m128i widenLo16(__m128i x) { return _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16); }
+static inline __m128i widenHi16(__m128i x) { return _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16); }
+
+
+// The unsigned bytes become signed offsets from 128 by flipping the top
+// bit, which saturating signed adds then handle; the flip undoes it.
+static void mixInt8Sse2(int8_t* dst, const int8_t* src, uint64_t n, float dstGain, float srcGain) {
+    const __m128i bias = _mm_set1_epi8((char) 0x80);
+    uint64_t i = 0;
+
+    if (dstGain == 1.f && srcGain == 1.f) {
+        for (; i + 16 <= n; i += 16) {
+            __m128i a = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (dst + i)), bias);
+            __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (src + i)), bias);
+            _mm_storeu_si128((__m128i*) (dst + i), _mm_xor_si128(_mm_adds_epi8(a, b), bias));
+        }
+    } else {
+        __m128 ga = _mm_set1_ps(dstGain), gb = _mm_set1_ps(srcGain);
+        __m128 lo = _mm_set1_ps(-128.f), hi = _mm_set1_ps(127.f);
+        const __m128i zero = _mm_setzero_si128(), offset = _mm_set1_epi16(128);
+
+        for (; i + 8 <= n; i += 8) {
+            __m128i a = _mm_loadl_epi64((const __m128i*) (dst + i));
+            __m128i b = _mm_loadl_epi64((const __m128i*) (src + i));
+            a = _mm_sub_epi16(_mm_unpacklo_epi8(a, zero), offset);
+            b = _mm_sub_epi16(_mm_unpacklo_epi8(b, zero), offset);
+
+            __m128i r = _mm_packs_epi32(gainSse2(widenLo16(a), widenLo16(b), ga, gb, lo, hi),
+                                        gainSse2(widenHi16(a), widenHi16(b), ga, gb, lo, hi));
+            _mm_storel_epi64((__m128i*) (dst + i), _mm_xor_si128(_mm_packs_epi16(r, r), bias));
+        }
+    }
+
+    mixInt8Scalar(dst + i, src + i, n - i, dstGain, srcGain);
+}
+
+
+static void mixInt16Sse2(int16_t* dst, const int16_t* src, uint64_t n, float dstGain, float srcGain) {
+    uint64_t i = 0;
+
+    if (dstGain == 1.f && srcGain == 1.f) {
+        for (; i + 8 <= n; i += 8) {
+            __m128i a = _mm_loadu_si128((const __m128i*) (dst + i));
+            __m128i b = _mm_loadu_si128((const __m128i*) (src + i));
+            _mm_storeu_si128((__m128i*) (dst + i), _mm_adds_epi16(a, b));
+        }
+    } else {
+        __m128 ga = _mm_set1_ps(dstGain), gb = _mm_set1_ps(srcGain);
+        __m128 lo = _mm_set1_ps(-32768.f), hi = _mm_set1_ps(32767.f);
+
+        for (; i + 8 <= n; i += 8) {
+            __m128i a = _mm_loadu_si128((const __m128i*) (dst + i));
+            __m128i b = _mm_loadu_si128((const __m128i*) (src + i));
+
+            __m128i r = _mm_packs_epi32(gainSse2(widenLo16(a), widenLo16(b), ga, gb, lo, hi),
+                                        gainSse2(widenHi16(a), widenHi16(b), ga, gb, lo, hi));
+            _mm_storeu_si128((__m128i*) (dst + i), r);
+        }
+    }
+
+    mixInt16Scalar(dst + i, src + i, n - i, dstGain, srcGain);
+}
+
+
+static void mixFlt32Sse2(float* dst, const float* src, uint64_t n, float dstGain, float srcGain) {
+    uint64_t i = 0;
+
+    if (dstGain == 1.f && srcGain == 1.f) {
+        for (; i + 4 <= n; i += 4) {
+            _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(src + i)));
+        }
+    } else {
+        __m128 ga = _mm_set1_ps(dstGain), gb = _mm_set1_ps(srcGain);
+
+        for (; i + 4 <= n; i += 4) {
+            __m128 r = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(dst + i), ga), _mm_mul_ps(_mm_loadu_ps(src + i), gb));
+            _mm_storeu_ps(dst + i, r);
+        }
+    }
+
+    mixFlt32Scalar(dst + i, src + i, n - i, dstGain, srcGain);
+}
+
+
+// AVX2. Same structure, twice the width.
+
+MIXKERNELS_AVX2
+static inline __m128i gainAvx2(__m256i a, __m256i b, __m256 ga, __m256 gb, __m256 lo, __m256 hi) {
+    __m256 r = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(a), ga), _mm256_mul_ps(_mm256_cvtepi32_ps(b), gb));
+    __m256i v = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(r, lo), hi));
+    return _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+}
+
+
+MIXKERNELS_AVX2
+static void mixInt8Avx2(int8_t* dst, const int8_t* src, uint64_t n, float dstGain, float srcGain) {
+    const __m256i bias = _mm256_set1_epi8((char) 0x80);
+    uint64_t i = 0;
+
+    if (dstGain == 1.f && srcGain == 1.f) {
+        for (; i + 32 <= n; i += 32) {
+            __m256i a = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*) (dst + i)), bias);
+            __m256i b = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*) (src + i)), bias);
+            _mm256_storeu_si256((__m256i*) (dst + i), _mm256_xor_si256(_mm256_adds_epi8(a, b), bias));
+        }
+    } else {
+        __m256 ga = _mm256_set1_ps(dstGain), gb = _mm256_set1_ps(srcGain);
+        __m256 lo = _mm256_set1_ps(-128.f), hi = _mm256_set1_ps(127.f);
+        const __m256i offset = _mm256_set1_epi32(128);
+
+        for (; i + 8 <= n; i += 8) {
+            __m256i a = _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (dst + i))), offset);
+            __m256i b = _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (src + i))), offset);
+            __m128i r = gainAvx2(a, b, ga, gb, lo, hi);
+            _mm_storel_epi64((__m128i*) (dst + i), _mm_xor_si128(_mm_packs_epi16(r, r), _mm256_castsi256_si128(bias)));
+        }
+    }
+
+    mixInt8Scalar(dst + i, src + i, n - i, dstGain, srcGain);
+}
+
+
+MIXKERNELS_AVX2
+static void mixInt16Avx2(int16_t* dst, const int16_t* src, uint64_t n, float dstGain, float srcGain) {
+    uint64_t i = 0;
+
+    if (dstGain == 1.f && srcGain == 1.f) {
+        for (; i + 16 <= n; i += 16) {
+            __m256i a = _mm256_loadu_si256((const __m256i*) (dst + i));
+            __m256i b = _mm256_loadu_si256((const __m256i*) (src + i));
+            _mm256_storeu_si256((__m256i*) (dst + i), _mm256_adds_epi16(a, b));
+        }
+    } else {
+        __m256 ga = _mm256_set1_ps(dstGain), gb = _mm256_set1_ps(srcGain);
+        __m256 lo = _mm256_set1_ps(-32768.f), hi = _mm256_set1_ps(32767.f);
+
+        for (; i + 8 <= n; i += 8) {
+            __m256i a = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*) (dst + i)));
+            __m256i b = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*) (src + i)));
+            _mm_storeu_si128((__m128i*) (dst + i), gainAvx2(a, b, ga, gb, lo, hi));
+        }
+    }
+
+    mixInt16Scalar(dst + i, src + i, n - i, dstGain, srcGain);
+}
+
+
+MIXKERNELS_AVX2
+static void mixFlt32Avx2(float* dst, const float* src, uint64_t n, float dstGain, float srcGain) {
+    uint64_t i = 0;
+
+    if (dstGain == 1.f && srcGain == 1.f) {
+        for (; i + 8 <= n; i += 8) {
+            _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_loadu_ps(src + i)));
+        }
+    } else {
+        __m256 ga = _mm256_set1_ps(dstGain), gb = _mm256_set1_ps(srcGain);
+
+        for (; i + 8 <= n; i += 8) {
+            __m256 r = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(dst + i), ga),
+                                     _mm256_mul_ps(_mm256_loadu_ps(src + i), gb));
+            _mm256_storeu_ps(dst + i, r);
+        }
+    }
+
+    mixFlt32Scalar(dst + i, src + i, n - i, dstGain, srcGain);
+}
+
+
+static bool cpuHasAvx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // MIXKERNELS_X86
+
+
+struct MixKernelTable {
+    void (*int8)(int8_t*, const int8_t*, uint64_t, float, float);
+    void (*int16)(int16_t*, const int16_t*, uint64_t, float, float);
+    void (*int24)(Int24*, const Int24*, uint64_t, float, float);
+    void (*flt32)(float*, const float*, uint64_t, float, float);
+    MixKernels::Isa isa;
+};
+
+
+static MixKernelTable makeTable(MixKernels::Isa isa) {
+    MixKernelTable table = { mixInt8Scalar, mixInt16Scalar, mixInt24Wide, mixFlt32Scalar, MixKernels::SCALAR_ISA };
+
+#ifdef MIXKERNELS_X86
+    if (isa >= MixKernels::SSE2_ISA) {
+        table.int8 = mixInt8Sse2;
+        table.int16 = mixInt16Sse2;
+        table.flt32 = mixFlt32Sse2;
+        table.isa = MixKernels::SSE2_ISA;
+    }
+
+    if (isa >= MixKernels::AVX2_ISA) {
+        table.int8 = mixInt8Avx2;
+        table.int16 = mixInt16Avx2;
+        table.flt32 = mixFlt32Avx2;
+        table.isa = MixKernels::AVX2_ISA;
+    }
+#endif
+
+    return table;
+}
+
+
+static MixKernelTable& kernels() {
+    static MixKernelTable table = makeTable(MixKernels::getBestIsa());
+    return table;
+}
+
+
+MixKernels::Isa MixKernels::getBestIsa() {
+#ifdef MIXKERNELS_X86
+    static Isa best = cpuHasAvx2() ? AVX2_ISA : SSE2_ISA;
+    return best;
+#else
+    return SCALAR_ISA;
+#endif
+}
+
+
+MixKernels::Isa MixKernels::getIsa() {
+    return kernels().isa;
+}
+
+
+void MixKernels::setIsa(Isa isa) {
+    kernels() = makeTable(std::min(isa, getBestIsa()));
+}
+
+
+void MixKernels::mix(int8_t* dst, const int8_t* src, uint64_t n, float dstGain, float srcGain) {
+    kernels().int8(dst, src, n, dstGain, srcGain);
+}
+
+
+void MixKernels::mix(int16_t* dst, const int16_t* src, uint64_t n, float dstGain, float srcGain) {
+    kernels().int16(dst, src, n, dstGain, srcGain);
+}
+
+
+void MixKernels::mix(Int24* dst, const Int24* src, uint64_t n, float dstGain, float srcGain) {
+    kernels().int24(dst, src, n, dstGain, srcGain);
+}
+
+
+void MixKernels::mix(float* dst, const float* src, uint64_t n, float dstGain, float srcGain) {
+    kernels().flt32(dst, src, n, dstGain, srcGain);
+}
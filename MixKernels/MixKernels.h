@@ -0,0 +1,67 @@
+#ifndef MIXKERNELS_H
+#define MIXKERNELS_H
+
+
+#include <cstdint>
+#include "Int24/Int24.h"
+#include "SampleView/SampleView.h"
+
+
+// dst[i] = dst[i] * dstGain + src[i] * srcGain, saturated to the range of
+// the sample type (float is left unclamped). 8-bit samples are the unsigned
+// bytes of the file, mixed as offsets from 128. The implementation is picked
+// once at startup from what the CPU supports: AVX2, SSE2 or plain C++.
+// Integer results are rounded to nearest, the same way on every path.
+class MixKernels {
+    public:
+        enum Isa {
+            SCALAR_ISA,
+            SSE2_ISA,
+            AVX2_ISA
+        };
+
+        static Isa  getIsa();
+        static Isa  getBestIsa();
+
+        // Forces a slower path, e.g. to compare them; capped at getBestIsa().
+        static void setIsa(Isa isa);
+
+        static void mix(int8_t* dst, const int8_t* src, uint64_t n, float dstGain = 1.f, float srcGain = 1.f);
+        static void mix(int16_t* dst, const int16_t* src, uint64_t n, float dstGain = 1.f, float srcGain = 1.f);
+        static void mix(Int24* dst, const Int24* src, uint64_t n, float dstGain = 1.f, float srcGain = 1.f);
+        static void mix(float* dst, const float* src, uint64_t n, float dstGain = 1.f, float srcGain = 1.f);
+
+        // Same over channel views. Strided views are gathered a block at a
+        // time, mixed there by the same kernel and scattered back.
+        template<typename T>
+        static void mix(ChannelView<T> dst, ChannelView<T> src, uint64_t n,
+                        float dstGain = 1.f, float srcGain = 1.f) {
+            if (dst.isContiguous() && src.isContiguous()) {
+                mix(dst.data(), src.data(), n, dstGain, srcGain);
+                return;
+            }
+
+            T a[STRIDED_BLOCK], b[STRIDED_BLOCK];
+
+            for (uint64_t first = 0; first < n; first += STRIDED_BLOCK) {
+                uint64_t count = n - first < STRIDED_BLOCK ? n - first : STRIDED_BLOCK;
+
+                for (uint64_t i = 0; i < count; i++) {
+                    a[i] = dst[first + i];
+                    b[i] = src[first + i];
+                }
+
+                mix(a, b, count, dstGain, srcGain);
+
+                for (uint64_t i = 0; i < count; i++) {
+                    dst[first + i] = a[i];
+                }
+            }
+        }
+
+    private:
+        static const uint64_t STRIDED_BLOCK = 1024;
+};
+
+
+#endif // MIXKERNELS_H
@@ -0,0 +1,285 @@
+#include "Overview.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+
+const uint64_t Overview::BLOCK_FRAMES;
+const uint64_t Overview::FANOUT;
+
+static const char MAGIC[4] = { 'S', 'H', 'O', 'V' };
+
+
+Overview::Overview():
+    _numChannels(0),
+    _numFrames(0),
+    _sourceSize(0),
+    _sourceTime(0)
+{}
+
+
+Overview::Overview(uint16_t numChannels, uint64_t numFrames):
+    _numChannels(numChannels),
+    _numFrames(numFrames),
+    _sourceSize(0),
+    _sourceTime(0),
+    _levels(1)
+{
+    _levels[0].resize(_numBlocks(0) * _numChannels);
+}
+
+
+void Overview::addFrames(const float* frames, uint64_t first, uint64_t numFrames) {
+    for (uint64_t offset = 0; offset < numFrames; offset += BLOCK_FRAMES) {
+        uint64_t count = std::min(BLOCK_FRAMES, numFrames - offset);
+        Entry* entries = &_levels[0][(first + offset) / BLOCK_FRAMES * _numChannels];
+
+        for (int c = 0; c < _numChannels; c++) {
+            const float* src = frames + offset * _numChannels + c;
+            float lo = src[0], hi = src[0];
+            double squares = 0.;
+
+            for (uint64_t f = 0; f < count; f++) {
+                float sample = src[f * _numChannels];
+
+                lo = std::min(lo, sample);
+                hi = std::max(hi, sample);
+                squares += (double) sample * sample;
+            }
+
+            entries[c].min = lo;
+            entries[c].max = hi;
+            entries[c].meanSquare = (float) (squares / count);
+        }
+    }
+}
+
+
+void Overview::finish() {
+    _levels.resize(1);
+
+    for (int level = 0; _numBlocks(level) > 1; level++) {
+        uint64_t numBlocks = _numBlocks(level + 1);
+        std::vector<Entry> above(numBlocks * _numChannels);
+
+        for (uint64_t block = 0; block < numBlocks; block++) {
+            uint64_t below = std::min(FANOUT, _numBlocks(level) - block * FANOUT);
+
+            for (int c = 0; c < _numChannels; c++) {
+                const Entry* src = &_levels[level][block * FANOUT * _numChannels + c];
+                Entry& dst = above[block * _numChannels + c];
+                double squares = 0.;
+
+                dst.min = src[0].min;
+                dst.max = src[0].max;
+
+                for (uint64_t i = 0; i < below; i++) {
+                    const Entry& entry = src[i * _numChannels];
+
+                    dst.min = std::min(dst.min, entry.min);
+                    dst.max = std::max(dst.max, entry.max);
+                    squares += (double) entry.meanSquare * _blockFrames(level, block * FANOUT + i);
+                }
+
+                dst.meanSquare = (float) (squares / _blockFrames(level + 1, block));
+            }
+        }
+
+        _levels.push_back(std::move(above));
+    }
+}
+
+
+// Whole entries on each side are taken at the finest level they fit, the
+// rest of the range moves up a level.
+Overview::Summary Overview::summarize(int channel, uint64_t first, uint64_t numFrames) const throw (std::out_of_range) {
+    if (channel < 0 || channel >= _numChannels) {
+        throw std::out_of_range("Channel " + std::to_string(channel) + " of an overview of " +
+                                std::to_string(_numChannels) + " channels!");
+    }
+
+    Summary summary = { 0.f, 0.f, 0.f };
+    uint64_t last = std::min(_numFrames, first + std::min(numFrames, _numFrames));
+    uint64_t a = first / BLOCK_FRAMES;
+    uint64_t b = (last + BLOCK_FRAMES - 1) / BLOCK_FRAMES;
+    double squares = 0.;
+    uint64_t frames = 0;
+
+    // Nothing to widen: an empty range, or one past the end.
+    if (first >= last) {
+        return summary;
+    }
+
+    auto add = [&](int level, uint64_t block) {
+        const Entry& entry = _levels[level][block * _numChannels + channel];
+
+        summary.min = frames == 0 ? entry.min : std::min(summary.min, entry.min);
+        summary.max = frames == 0 ? entry.max : std::max(summary.max, entry.max);
+        squares += (double) entry.meanSquare * _blockFrames(level, block);
+        frames += _blockFrames(level, block);
+    };
+
+    for (int level = 0; a < b && level < (int) _levels.size(); level++) {
+        if (level + 1 == (int) _levels.size()) {
+            for (; a < b; a++) {
+                add(level, a);
+            }
+            break;
+        }
+
+        for (; a < b && a % FANOUT != 0; a++) {
+            add(level, a);
+        }
+
+        for (; a < b && b % FANOUT != 0; b--) {
+            add(level, b - 1);
+        }
+
+        a /= FANOUT;
+        b /= FANOUT;
+    }
+
+    if (frames > 0) {
+        summary.rms = (float) std::sqrt(squares / frames);
+    }
+
+    return summary;
+}
+
+
+std::vector<Overview::Summary> Overview::profile(int channel, uint64_t first, uint64_t numFrames, uint64_t numPoints) const {
+    std::vector<Summary> points(numPoints);
+
+    for (uint64_t p = 0; p < numPoints; p++) {
+        uint64_t from = first + (uint64_t) ((double) numFrames * p / numPoints);
+        uint64_t to = first + (uint64_t) ((double) numFrames * (p + 1) / numPoints);
+
+        points[p] = summarize(channel, from, std::max<uint64_t>(to - from, 1));
+    }
+
+    return points;
+}
+
+
+std::string Overview::getPath(const std::string& wavPath) {
+    return wavPath + ".overview";
+}
+
+
+bool Overview::describes(const std::string& wavPath) const {
+    uint64_t size;
+    int64_t time;
+
+    return _stat(wavPath, size, time) && size == _sourceSize && time == _sourceTime;
+}
+
+
+bool Overview::save(const std::string& wavPath) {
+    std::string path = getPath(wavPath);
+    uint32_t blockFrames = BLOCK_FRAMES;
+    uint16_t reserved = 0;
+
+    _sourceSize = 0;
+    _sourceTime = 0;
+    _stat(wavPath, _sourceSize, _sourceTime);
+
+    std::ofstream ofs(path, std::ios::out|std::ios::binary|std::ios::trunc);
+
+    if (!ofs) {
+        return false;
+    }
+
+    ofs.write(MAGIC, sizeof (MAGIC));
+    ofs.write((const char*) &_numChannels, sizeof (_numChannels));
+    ofs.write((const char*) &reserved, sizeof (reserved));
+    ofs.write((const char*) &blockFrames, sizeof (blockFrames));
+    ofs.write((const char*) &_numFrames, sizeof (_numFrames));
+    ofs.write((const char*) &_sourceSize, sizeof (_sourceSize));
+    ofs.write((const char*) &_sourceTime, sizeof (_sourceTime));
+    ofs.write((const char*) _levels.at(0).data(), _levels[0].size() * sizeof (Entry));
+
+    ofs.close();
+
+    // A partial sidecar would only be turned down by load().
+    if (!ofs) {
+        std::remove(path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+Overview Overview::load(const std::string& wavPath) throw (BadOverviewException) {
+    std::string path = getPath(wavPath);
+    std::ifstream ifs(path, std::ios::in|std::ios::binary);
+    char magic[4] = { 0 };
+    uint16_t numChannels = 0, reserved;
+    uint32_t blockFrames = 0;
+    uint64_t numFrames = 0;
+
+    ifs.read(magic, sizeof (magic));
+    ifs.read((char*) &numChannels, sizeof (numChannels));
+    ifs.read((char*) &reserved, sizeof (reserved));
+    ifs.read((char*) &blockFrames, sizeof (blockFrames));
+    ifs.read((char*) &numFrames, sizeof (numFrames));
+
+    if (!ifs || memcmp(magic, MAGIC, sizeof (MAGIC)) != 0 || blockFrames != BLOCK_FRAMES) {
+        throw BadOverviewException(std::string("File '") + path + std::string("' isn't an overview!"));
+    }
+
+    Overview overview(numChannels, numFrames);
+
+    ifs.read((char*) &overview._sourceSize, sizeof (overview._sourceSize));
+    ifs.read((char*) &overview._sourceTime, sizeof (overview._sourceTime));
+    ifs.read((char*) overview._levels[0].data(), overview._levels[0].size() * sizeof (Entry));
+
+    if (!ifs) {
+        throw BadOverviewException(std::string("File '") + path + std::string("' is cut short!"));
+    }
+
+    overview.finish();
+
+    return overview;
+}
+
+
+uint64_t Overview::_numBlocks(int level) const {
+    uint64_t numBlocks = (_numFrames + BLOCK_FRAMES - 1) / BLOCK_FRAMES;
+
+    for (int l = 0; l < level; l++) {
+        numBlocks = (numBlocks + FANOUT - 1) / FANOUT;
+    }
+
+    return numBlocks;
+}
+
+
+// Frames under an entry; only the last one of a level can be short.
+uint64_t Overview::_blockFrames(int level, uint64_t block) const {
+    uint64_t span = BLOCK_FRAMES;
+
+    for (int l = 0; l < level; l++) {
+        span *= FANOUT;
+    }
+
+    return std::min(span, _numFrames - block * span);
+}
+
+
+bool Overview::_stat(const std::string& path, uint64_t& size, int64_t& time) {
+    struct stat st;
+
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+
+    size = (uint64_t) st.st_size;
+    time = (int64_t) st.st_mtime;
+
+    return true;
+}
@@ -0,0 +1,95 @@
+#ifndef OVERVIEW_H
+#define OVERVIEW_H
+
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+
+class BadOverviewException : public std::runtime_error {
+    public:
+        BadOverviewException(std::string errorMessage):
+            std::runtime_error(errorMessage)
+        {}
+};
+
+
+// Level profile of a file without its samples: per channel min, max and RMS
+// of the normalized samples over blocks of BLOCK_FRAMES frames, then over
+// groups of FANOUT entries of the level below up to a single entry. A range
+// at any resolution is summed up from at most 2 * (FANOUT - 1) entries per
+// level, O(log n) in the length of the file.
+//
+// The sidecar file keeps the block level and the size and modification time
+// of the WAV it was made from; the coarser levels are rebuilt on loading.
+class Overview {
+    public:
+        static const uint64_t BLOCK_FRAMES = 1024;
+        static const uint64_t FANOUT = 4;
+
+        struct Summary {
+            float   min;
+            float   max;
+            float   rms;
+        };
+
+        Overview();
+        Overview(uint16_t numChannels, uint64_t numFrames);
+
+        // Fills the blocks of frames [first, first + numFrames) from
+        // interleaved normalized samples. first is a multiple of
+        // BLOCK_FRAMES, and so is numFrames unless the range ends the file.
+        // Calls on different blocks may run on different threads.
+        void        addFrames(const float* frames, uint64_t first, uint64_t numFrames);
+
+        // Builds the coarser levels once every block is in.
+        void        finish();
+
+        uint16_t    getNumChannels() const { return _numChannels; }
+        uint64_t    getNumFrames() const { return _numFrames; }
+        int         getNumLevels() const { return (int) _levels.size(); }
+
+        // Frames [first, first + numFrames) of a channel, widened to whole
+        // blocks and cut short at the end; all zero when that leaves nothing.
+        Summary     summarize(int channel, uint64_t first, uint64_t numFrames) const throw (std::out_of_range);
+
+        // The same range split evenly into numPoints summaries, e.g. one per
+        // pixel of a waveform view. Throws std::out_of_range for a bad channel.
+        std::vector<Summary> profile(int channel, uint64_t first, uint64_t numFrames, uint64_t numPoints) const;
+
+        // Sidecar of wavPath, and whether this overview still matches it.
+        static std::string  getPath(const std::string& wavPath);
+        bool        describes(const std::string& wavPath) const;
+
+        // Stamps the overview with the current size and modification time of
+        // wavPath and writes its sidecar. False if the sidecar couldn't be
+        // written, in which case none is left behind.
+        bool        save(const std::string& wavPath);
+        static Overview load(const std::string& wavPath) throw (BadOverviewException);
+
+    private:
+        struct Entry {
+            float   min;
+            float   max;
+            float   meanSquare;
+        };
+
+        uint16_t    _numChannels;
+        uint64_t    _numFrames;
+        uint64_t    _sourceSize;
+        int64_t     _sourceTime;
+
+        // Level l has an entry per channel for every BLOCK_FRAMES * FANOUT^l
+        // frames, channel by channel within a block.
+        std::vector<std::vector<Entry>> _levels;
+
+        uint64_t    _numBlocks(int level) const;
+        uint64_t    _blockFrames(int level, uint64_t block) const;
+
+        static bool _stat(const std::string& path, uint64_t& size, int64_t& time);
+};
+
+
+#endif // OVERVIEW_H
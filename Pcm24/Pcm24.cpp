@@ -0,0 +1,302 @@
+#include "Pcm24.h"
+#include "MixKernels/MixKernels.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PCM24_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define PCM24_AVX2
+#else
+#define PCM24_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+
+const int32_t Pcm24::MIN_VALUE;
+const int32_t Pcm24::MAX_VALUE;
+
+static const float SCALE = 8388608.f;
+static const float INV_SCALE = 1.f / 8388608.f;
+static const float INV_UNIT = 1.f / 16777216.f;
+
+
+static inline uint32_t xorshift(uint32_t& x) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+
+TpdfDither::TpdfDither(uint32_t seed) {
+    // xorshift must not start from zero
+    for (int i = 0; i < NUM_LANES; i++) {
+        _state[i] = (seed + i) * 2654435761u;
+        if (_state[i] == 0) {
+            _state[i] = 1;
+        }
+    }
+}
+
+
+float TpdfDither::next(int lane) {
+    float u1 = (xorshift(_state[lane]) >> 8) * INV_UNIT;
+    float u2 = (xorshift(_state[lane]) >> 8) * INV_UNIT;
+    return u1 - u2;
+}
+
+
+static void unpackInt32Scalar(const Int24* src, int32_t* dst, uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        dst[i] = (int) src[i];
+    }
+}
+
+
+static void unpackFlt32Scalar(const Int24* src, float* dst, uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        dst[i] = (int) src[i] * INV_SCALE;
+    }
+}
+
+
+static void packInt32Scalar(const int32_t* src, Int24* dst, uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        dst[i] = std::min(std::max(src[i], Pcm24::MIN_VALUE), Pcm24::MAX_VALUE);
+    }
+}
+
+
+static void packFlt32Scalar(const float* src, Int24* dst, uint64_t n, TpdfDither* dither, uint64_t first) {
+    for (uint64_t i = 0; i < n; i++) {
+        float value = src[i] * SCALE;
+        if (dither != nullptr) {
+            value += dither->next((int) ((first + i) % TpdfDither::NUM_LANES));
+        }
+        dst[i] = (int) lrintf(std::min(std::max(value, (float) Pcm24::MIN_VALUE), (float) Pcm24::MAX_VALUE));
+    }
+}
+
+
+static void packInt16Scalar(const float* src, int16_t* dst, uint64_t n, TpdfDither* dither, uint64_t first) {
+    for (uint64_t i = 0; i < n; i++) {
+        float value = src[i] * 32768.f;
+        if (dither != nullptr) {
+            value += dither->next((int) ((first + i) % TpdfDither::NUM_LANES));
+        }
+        dst[i] = (int16_t) lrintf(std::min(std::max(value, -32768.f), 32767.f));
+    }
+}
+
+
+#ifdef PCM24_X86
+
+// Eight samples per step. The two halves of the 24 packed bytes are loaded so
+// that each 128-bit lane holds four samples, then spread into the top three
+// bytes of each int32 and shifted down to sign extend.
+
+PCM24_AVX2
+static inline __m256i unpack8(const Int24* src) {
+    const __m256i spread = _mm256_setr_epi8(
+        -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+        -1, 4, 5, 6, -1, 7, 8, 9, -1, 10, 11, 12, -1, 13, 14, 15);
+
+    const char* p = (const char*) src;
+    __m128i lo = _mm_loadu_si128((const __m128i*) p);
+    __m128i hi = _mm_loadu_si128((const __m128i*) (p + 8));
+    __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+    return _mm256_srai_epi32(_mm256_shuffle_epi8(v, spread), 8);
+}
+
+
+// Expects values already within the 24-bit range.
+PCM24_AVX2
+static inline void pack8(__m256i v, Int24* dst) {
+    const __m256i gather = _mm256_setr_epi8(
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    char* p = (char*) dst;
+    v = _mm256_shuffle_epi8(v, gather);
+    __m128i hi = _mm256_extracti128_si256(v, 1);
+    int32_t last = _mm_cvtsi128_si32(_mm_srli_si128(hi, 8));
+
+    _mm_storeu_si128((__m128i*) p, _mm256_castsi256_si128(v));
+    _mm_storel_epi64((__m128i*) (p + 12), hi);
+    memcpy(p + 20, &last, 4);
+}
+
+
+PCM24_AVX2
+static void unpackInt32Avx2(const Int24* src, int32_t* dst, uint64_t n) {
+    uint64_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_si256((__m256i*) (dst + i), unpack8(src + i));
+    }
+
+    unpackInt32Scalar(src + i, dst + i, n - i);
+}
+
+
+PCM24_AVX2
+static void unpackFlt32Avx2(const Int24* src, float* dst, uint64_t n) {
+    const __m256 scale = _mm256_set1_ps(INV_SCALE);
+    uint64_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(unpack8(src + i)), scale));
+    }
+
+    unpackFlt32Scalar(src + i, dst + i, n - i);
+}
+
+
+PCM24_AVX2
+static void packInt32Avx2(const int32_t* src, Int24* dst, uint64_t n) {
+    const __m256i lo = _mm256_set1_epi32(Pcm24::MIN_VALUE);
+    const __m256i hi = _mm256_set1_epi32(Pcm24::MAX_VALUE);
+    uint64_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (src + i));
+        pack8(_mm256_min_epi32(_mm256_max_epi32(v, lo), hi), dst + i);
+    }
+
+    packInt32Scalar(src + i, dst + i, n - i);
+}
+
+
+PCM24_AVX2
+static inline __m256 ditherUnit(__m256i& x) {
+    x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+    x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(x, 8)), _mm256_set1_ps(INV_UNIT));
+}
+
+
+PCM24_AVX2
+static void packFlt32Avx2(const float* src, Int24* dst, uint64_t n, uint32_t* ditherState) {
+    const __m256 scale = _mm256_set1_ps(SCALE);
+    const __m256 lo = _mm256_set1_ps((float) Pcm24::MIN_VALUE);
+    const __m256 hi = _mm256_set1_ps((float) Pcm24::MAX_VALUE);
+    __m256i state = ditherState != nullptr ? _mm256_loadu_si256((const __m256i*) ditherState)
+                                           : _mm256_setzero_si256();
+    uint64_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_mul_ps(_mm256_loadu_ps(src + i), scale);
+
+        if (ditherState != nullptr) {
+            __m256 u1 = ditherUnit(state);
+            __m256 u2 = ditherUnit(state);
+            v = _mm256_add_ps(v, _mm256_sub_ps(u1, u2));
+        }
+
+        pack8(_mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(v, lo), hi)), dst + i);
+    }
+
+    if (ditherState != nullptr) {
+        _mm256_storeu_si256((__m256i*) ditherState, state);
+    }
+}
+
+
+PCM24_AVX2
+static void packInt16Avx2(const float* src, int16_t* dst, uint64_t n, uint32_t* ditherState) {
+    const __m256 scale = _mm256_set1_ps(32768.f);
+    const __m256 lo = _mm256_set1_ps(-32768.f);
+    const __m256 hi = _mm256_set1_ps(32767.f);
+    __m256i state = ditherState != nullptr ? _mm256_loadu_si256((const __m256i*) ditherState)
+                                           : _mm256_setzero_si256();
+    uint64_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_mul_ps(_mm256_loadu_ps(src + i), scale);
+
+        if (ditherState != nullptr) {
+            __m256 u1 = ditherUnit(state);
+            __m256 u2 = ditherUnit(state);
+            v = _mm256_add_ps(v, _mm256_sub_ps(u1, u2));
+        }
+
+        __m256i q = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(v, lo), hi));
+        __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1));
+        _mm_storeu_si128((__m128i*) (dst + i), packed);
+    }
+
+    if (ditherState != nullptr) {
+        _mm256_storeu_si256((__m256i*) ditherState, state);
+    }
+}
+
+#endif // PCM24_X86
+
+
+static bool useAvx2() {
+    return MixKernels::getIsa() == MixKernels::AVX2_ISA;
+}
+
+
+void Pcm24::unpack(const Int24* src, int32_t* dst, uint64_t n) {
+#ifdef PCM24_X86
+    if (useAvx2()) {
+        unpackInt32Avx2(src, dst, n);
+        return;
+    }
+#endif
+    unpackInt32Scalar(src, dst, n);
+}
+
+
+void Pcm24::unpack(const Int24* src, float* dst, uint64_t n) {
+#ifdef PCM24_X86
+    if (useAvx2()) {
+        unpackFlt32Avx2(src, dst, n);
+        return;
+    }
+#endif
+    unpackFlt32Scalar(src, dst, n);
+}
+
+
+void Pcm24::pack(const int32_t* src, Int24* dst, uint64_t n) {
+#ifdef PCM24_X86
+    if (useAvx2()) {
+        packInt32Avx2(src, dst, n);
+        return;
+    }
+#endif
+    packInt32Scalar(src, dst, n);
+}
+
+
+void Pcm24::pack(const float* src, Int24* dst, uint64_t n, TpdfDither* dither) {
+    uint64_t i = 0;
+
+#ifdef PCM24_X86
+    if (useAvx2()) {
+        i = n - n % 8;
+        packFlt32Avx2(src, dst, i, dither != nullptr ? dither->_state : nullptr);
+    }
+#endif
+    packFlt32Scalar(src + i, dst + i, n - i, dither, i);
+}
+
+
+void Pcm24::pack(const float* src, int16_t* dst, uint64_t n, TpdfDither* dither) {
+    uint64_t i = 0;
+
+#ifdef PCM24_X86
+    if (useAvx2()) {
+        i = n - n % 8;
+        packInt16Avx2(src, dst, i, dither != nullptr ? dither->_state : nullptr);
+    }
+#endif
+    packInt16Scalar(src + i, dst + i, n - i, dither, i);
+}
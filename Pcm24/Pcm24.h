@@ -0,0 +1,48 @@
+#ifndef PCM24_H
+#define PCM24_H
+
+
+#include <cstdint>
+#include "Int24/Int24.h"
+
+
+// Triangular (TPDF) dither of +-1 LSB for requantizing to 24 bits. Eight
+// independent xorshift generators are used round-robin, so a seed gives the
+// same noise whichever code path Pcm24 picks.
+class TpdfDither {
+    public:
+        static const int NUM_LANES = 8;
+
+        TpdfDither(uint32_t seed = 1);
+
+        float   next(int lane);
+
+    private:
+        friend class Pcm24;
+
+        uint32_t    _state[NUM_LANES];
+};
+
+
+// Bulk conversions between packed 24-bit PCM and int32 or float lanes, so the
+// arithmetic runs on wide types and Int24 is only the storage format.
+// Float samples are normalized to [-1, 1). Packing saturates to the 24-bit
+// range and rounds to nearest. Uses AVX2 when MixKernels has selected it.
+class Pcm24 {
+    public:
+        static const int32_t MIN_VALUE = -INT24_MAX - 1;
+        static const int32_t MAX_VALUE = INT24_MAX;
+
+        static void unpack(const Int24* src, int32_t* dst, uint64_t n);
+        static void unpack(const Int24* src, float* dst, uint64_t n);
+
+        static void pack(const int32_t* src, Int24* dst, uint64_t n);
+        static void pack(const float* src, Int24* dst, uint64_t n, TpdfDither* dither = nullptr);
+
+        // The same float quantization to 16 bits, for WavFile's float
+        // processing and format conversions.
+        static void pack(const float* src, int16_t* dst, uint64_t n, TpdfDither* dither = nullptr);
+};
+
+
+#endif // PCM24_H
@@ -0,0 +1,285 @@
+#include "Resampler.h"
+#include "MixKernels/MixKernels.h"
+#include <cmath>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RESAMPLER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define RESAMPLER_AVX2
+#else
+#define RESAMPLER_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+
+const uint64_t ResampledReader::BLOCK_FRAMES;
+
+
+// Taps per phase are a multiple of 16 for the SIMD loops below.
+static const int QUALITY_TAPS[] = { 16, 32, 64 };
+
+// Passband edge as a fraction of the lower Nyquist frequency, and the Kaiser
+// beta, roughly 60, 80 and 100 dB of stopband attenuation.
+static const double QUALITY_ROLLOFF[] = { 0.85, 0.91, 0.95 };
+static const double QUALITY_BETA[] = { 6., 8., 10. };
+
+
+static uint64_t gcd(uint64_t a, uint64_t b) {
+    while (b != 0) {
+        uint64_t r = a % b;
+        a = b;
+        b = r;
+    }
+
+    return a;
+}
+
+
+// Modified Bessel function of the first kind, order 0.
+static double besselI0(double x) {
+    double sum = 1., term = 1.;
+
+    for (int k = 1; k < 64 && term > sum * 1e-12; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+
+static double sinc(double x) {
+    return x == 0 ? 1. : std::sin(M_PI * x) / (M_PI * x);
+}
+
+
+static float dotScalar(const float* a, const float* b, int n) {
+    float sum = 0.f;
+
+    for (int i = 0; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+
+    return sum;
+}
+
+
+#ifdef RESAMPLER_X86
+
+static float dotSse(const float* a, const float* b, int n) {
+    __m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+
+    for (int i = 0; i < n; i += 8) {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+
+    __m128 sum = _mm_add_ps(sum0, sum1);
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+
+    return _mm_cvtss_f32(sum);
+}
+
+
+RESAMPLER_AVX2
+static float dotAvx2(const float* a, const float* b, int n) {
+    __m256 sum0 = _mm256_setzero_ps(), sum1 = _mm256_setzero_ps();
+
+    for (int i = 0; i < n; i += 16) {
+        sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+    }
+
+    __m256 sum8 = _mm256_add_ps(sum0, sum1);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum8), _mm256_extractf128_ps(sum8, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+
+    return _mm_cvtss_f32(sum);
+}
+
+#endif // RESAMPLER_X86
+
+
+typedef float (*DotProduct)(const float*, const float*, int);
+
+static DotProduct dotProduct() {
+#ifdef RESAMPLER_X86
+    switch (MixKernels::getIsa()) {
+        case MixKernels::AVX2_ISA:
+            return dotAvx2;
+
+        case MixKernels::SSE2_ISA:
+            return dotSse;
+
+        case MixKernels::SCALAR_ISA:
+            break;
+    }
+#endif
+
+    return dotScalar;
+}
+
+
+Resampler::Resampler(uint32_t inRate, uint32_t outRate, Quality quality):
+    _inRate(inRate),
+    _outRate(outRate),
+    _up(outRate / gcd(inRate, outRate)),
+    _down(inRate / gcd(inRate, outRate)),
+    _taps(QUALITY_TAPS[quality])
+{
+    // Downsampling narrows the passband, so the filter has to be longer
+    // in input samples to keep its shape.
+    if (_down > _up) {
+        _taps = (int) ((_taps * _down + 16 * _up - 1) / (16 * _up)) * 16;
+    }
+
+    // The prototype filter runs at up times the input rate, centred so that
+    // its phases interpolate at whole and fractional input positions.
+    uint64_t length = _up * _taps;
+    double centre = length / 2.;
+    double cutoff = QUALITY_ROLLOFF[quality] * std::min(1., (double) _up / _down);
+    double beta = QUALITY_BETA[quality];
+    double norm = besselI0(beta);
+
+    _phases.resize(length);
+
+    for (uint64_t phase = 0; phase < _up; phase++) {
+        float* row = &_phases[phase * _taps];
+        double sum = 0.;
+
+        for (int t = 0; t < _taps; t++) {
+            double n = phase + (double) _up * (_taps - 1 - t);
+            double r = (n - centre) / centre;
+            double h = cutoff * sinc(cutoff * (n - centre) / _up) * besselI0(beta * std::sqrt(std::max(0., 1. - r * r))) / norm;
+
+            row[t] = (float) h;
+            sum += h;
+        }
+
+        // Unity gain at DC in every phase.
+        for (int t = 0; t < _taps; t++) {
+            row[t] = (float) (row[t] / sum);
+        }
+    }
+
+    reset();
+}
+
+
+uint64_t Resampler::getOutputFrames(uint64_t numInputFrames) const {
+    return (numInputFrames * _up + _down - 1) / _down;
+}
+
+
+uint64_t Resampler::getMaxOutput(uint64_t numFrames) const {
+    return (numFrames + _taps) * _up / _down + 2;
+}
+
+
+uint64_t Resampler::process(const float* src, uint64_t numFrames, float* dst) {
+    _history.insert(_history.end(), src, src + numFrames);
+    _numIn += numFrames;
+
+    return _run(dst, getOutputFrames(_numIn));
+}
+
+
+// Zeros after the end complete the last windows.
+uint64_t Resampler::flush(float* dst) {
+    _history.insert(_history.end(), _taps / 2, 0.f);
+
+    return _run(dst, getOutputFrames(_numIn));
+}
+
+
+// The window of output k covers input [floor(k * down / up) - taps / 2 + 1,
+// floor(k * down / up) + taps / 2]; indices before the start are zeros.
+void Resampler::reset() {
+    _history.assign(_taps / 2 - 1, 0.f);
+    _historyFirst = 0;
+    _base = 0;
+    _phase = 0;
+    _numIn = 0;
+    _numOut = 0;
+}
+
+
+uint64_t Resampler::_run(float* dst, uint64_t limit) {
+    DotProduct dot = dotProduct();
+    uint64_t baseStep = _down / _up;
+    uint64_t phaseStep = _down % _up;
+    uint64_t n = 0;
+
+    while (_numOut < limit && _base - _historyFirst + _taps <= _history.size()) {
+        dst[n++] = dot(&_phases[_phase * _taps], &_history[_base - _historyFirst], _taps);
+        _numOut++;
+
+        _base += baseStep;
+        _phase += phaseStep;
+        if (_phase >= _up) {
+            _phase -= _up;
+            _base++;
+        }
+    }
+
+    // Keep the input from the next window on.
+    uint64_t consumed = std::min<uint64_t>(_base - _historyFirst, _history.size());
+    _history.erase(_history.begin(), _history.begin() + consumed);
+    _historyFirst += consumed;
+
+    return n;
+}
+
+
+ResampledReader::ResampledReader(const Resampler& resampler, uint64_t numInputFrames, const Fetch& fetch):
+    _resampler(resampler),
+    _numInput(numInputFrames),
+    _numFrames(resampler.getOutputFrames(numInputFrames)),
+    _fetch(fetch),
+    _fetched(0),
+    _in(BLOCK_FRAMES),
+    _out(resampler.getMaxOutput(BLOCK_FRAMES)),
+    _outFirst(0),
+    _outLast(0),
+    _flushed(false)
+{
+    _resampler.reset();
+}
+
+
+uint64_t ResampledReader::read(float* dst, uint64_t numFrames) {
+    uint64_t done = 0;
+
+    while (done < numFrames) {
+        if (_outFirst < _outLast) {
+            uint64_t count = std::min(numFrames - done, _outLast - _outFirst);
+
+            std::copy(&_out[_outFirst], &_out[_outFirst] + count, dst + done);
+            _outFirst += count;
+            done += count;
+            continue;
+        }
+
+        _outFirst = 0;
+
+        if (_fetched < _numInput) {
+            uint64_t count = std::min(BLOCK_FRAMES, _numInput - _fetched);
+
+            _fetch(_in.data(), _fetched, count);
+            _fetched += count;
+            _outLast = _resampler.process(_in.data(), count, _out.data());
+        } else if (!_flushed) {
+            _flushed = true;
+            _outLast = _resampler.flush(_out.data());
+        } else {
+            _outLast = 0;
+            break;
+        }
+    }
+
+    return done;
+}
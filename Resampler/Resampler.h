@@ -0,0 +1,100 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+
+#include <cstdint>
+#include <vector>
+#include <functional>
+
+
+// Polyphase FIR sample rate converter for one channel of normalized floats,
+// fed a block at a time. outRate / inRate is reduced to up / down; output
+// sample k is the input at time k * down / up, interpolated by a Kaiser
+// windowed sinc split into up phases of getTaps() coefficients each, so
+// every output sample is one dot product (AVX2 or SSE when MixKernels uses
+// them). The filter delay is taken out: n input samples make
+// getOutputFrames(n) output samples, lined up with the input.
+//
+// Ratios with small terms (44.1 <-> 48 <-> 96 kHz) keep the phase table
+// small; the quality picks taps against speed.
+class Resampler {
+    public:
+        enum Quality {
+            FAST_QUALITY,           // 16 taps per phase, more when downsampling
+            STANDARD_QUALITY,       // 32
+            HIGH_QUALITY            // 64
+        };
+
+        Resampler(uint32_t inRate, uint32_t outRate, Quality quality = STANDARD_QUALITY);
+
+        uint32_t    getInRate() const { return _inRate; }
+        uint32_t    getOutRate() const { return _outRate; }
+        int         getTaps() const { return _taps; }
+
+        uint64_t    getOutputFrames(uint64_t numInputFrames) const;
+
+        // Room process() may need in dst for numFrames input samples.
+        uint64_t    getMaxOutput(uint64_t numFrames) const;
+
+        // Takes the next numFrames input samples and writes the output they
+        // complete to dst; returns how many.
+        uint64_t    process(const float* src, uint64_t numFrames, float* dst);
+
+        // After the last input: the rest of the output, at most getTaps().
+        uint64_t    flush(float* dst);
+
+        // Back to the start of a new stream.
+        void        reset();
+
+    private:
+        uint32_t    _inRate;
+        uint32_t    _outRate;
+        uint64_t    _up;
+        uint64_t    _down;
+        int         _taps;
+
+        std::vector<float>  _phases;    // _up rows of _taps, in input order
+
+        std::vector<float>  _history;   // input from the next window on
+        uint64_t    _historyFirst;      // input index of _history[0], offset by _taps / 2 - 1
+        uint64_t    _base;              // floor(k * _down / _up) of the next output k
+        uint64_t    _phase;             // k * _down % _up
+        uint64_t    _numIn;
+        uint64_t    _numOut;
+
+        uint64_t    _run(float* dst, uint64_t limit);
+};
+
+
+// One channel at another rate, read in order: pulls input from fetch(dst,
+// first, numFrames) as needed and hands out resampled frames.
+class ResampledReader {
+    public:
+        typedef std::function<void(float*, uint64_t, uint64_t)> Fetch;
+
+        ResampledReader(const Resampler& resampler, uint64_t numInputFrames, const Fetch& fetch);
+
+        // Output frames in all.
+        uint64_t    getNumFrames() const { return _numFrames; }
+
+        // The next numFrames frames into dst, fewer only at the end.
+        uint64_t    read(float* dst, uint64_t numFrames);
+
+    private:
+        static const uint64_t BLOCK_FRAMES = 16384;
+
+        Resampler           _resampler;
+        uint64_t            _numInput;
+        uint64_t            _numFrames;
+        Fetch               _fetch;
+
+        uint64_t            _fetched;
+        std::vector<float>  _in;
+        std::vector<float>  _out;
+        uint64_t            _outFirst;
+        uint64_t            _outLast;
+        bool                _flushed;
+};
+
+
+#endif // RESAMPLER_H
@@ -0,0 +1,281 @@
+#include "RiffLayout.h"
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <utility>
+
+
+const uint64_t RiffLayout::UNKNOWN_SIZE;
+const uint64_t RiffLayout::RIFF_SIZE_LIMIT;
+
+
+RiffLayout::RiffLayout():
+    _rf64(false),
+    _dataOffset(0),
+    _dataSize(0)
+{
+    memcpy(_riffId, "RIFF", 4);
+}
+
+
+template<typename T>
+static T readLE(const char* p) {
+    T value;
+    memcpy(&value, p, sizeof (value));
+    return value;
+}
+
+
+void RiffLayout::parse(std::istream& is, const std::string& filePath) throw (BadRiffException) {
+    char riff[12];
+
+    is.seekg(0, std::ios::end);
+    uint64_t fileSize = (uint64_t) is.tellg();
+    is.seekg(0);
+
+    if (!is.read(riff, sizeof (riff)) || memcmp(riff + 8, "WAVE", 4) != 0 ||
+        (memcmp(riff, "RIFF", 4) != 0 && memcmp(riff, "RF64", 4) != 0 && memcmp(riff, "BW64", 4) != 0)) {
+        throw BadRiffException(std::string("File '") + filePath +
+                               std::string("' isn't a RIFF/WAVE file!"));
+    }
+
+    memcpy(_riffId, riff, 4);
+    _rf64 = memcmp(riff, "RIFF", 4) != 0;
+
+    uint64_t riffSize = readLE<uint32_t>(riff + 4);
+    uint64_t pos = sizeof (riff);
+
+    // RF64/BW64 keep the real 64-bit sizes in a ds64 chunk right after WAVE;
+    // any 32-bit size field of 0xFFFFFFFF is then looked up there.
+    uint64_t ds64DataSize = 0;
+    std::vector<std::pair<std::string, uint64_t>> ds64Table;
+
+    if (_rf64) {
+        char ds64[DS64_SIZE + 8];
+
+        if (!is.read(ds64, sizeof (ds64)) || memcmp(ds64, "ds64", 4) != 0) {
+            throw BadRiffException(std::string("File '") + filePath +
+                                   std::string("' has no ds64 chunk!"));
+        }
+
+        uint32_t ds64Size = readLE<uint32_t>(ds64 + 4);
+        uint32_t tableLength = readLE<uint32_t>(ds64 + 32);
+
+        riffSize = readLE<uint64_t>(ds64 + 8);
+        ds64DataSize = readLE<uint64_t>(ds64 + 16);
+
+        for (uint32_t i = 0; i < tableLength && 28 + 12 * (i + 1) <= ds64Size; i++) {
+            char entry[12];
+            if (!is.read(entry, sizeof (entry))) {
+                break;
+            }
+            ds64Table.push_back(std::make_pair(std::string(entry, 4), readLE<uint64_t>(entry + 4)));
+        }
+
+        pos += 8 + ds64Size + (ds64Size & 1);
+    }
+
+    // Writers that never patch the header leave the RIFF size at 0 or ~0.
+    uint64_t end = std::min<uint64_t>(fileSize, riffSize + 8);
+    if (riffSize == 0 || riffSize == RIFF_SIZE_LIMIT) {
+        end = fileSize;
+    }
+
+    bool haveData = false;
+
+    _format.clear();
+    _leadingChunks.clear();
+    _trailingChunks.clear();
+
+    while (pos + 8 <= end) {
+        char chunkHeader[8];
+        Chunk chunk;
+
+        is.seekg(std::streampos(pos));
+        if (!is.read(chunkHeader, sizeof (chunkHeader))) {
+            break;
+        }
+
+        memcpy(chunk.id, chunkHeader, 4);
+        uint64_t size = readLE<uint32_t>(chunkHeader + 4);
+        bool isData = memcmp(chunk.id, "data", 4) == 0;
+
+        if (_rf64 && size == RIFF_SIZE_LIMIT) {
+            if (isData) {
+                size = ds64DataSize;
+            }
+
+            for (const auto& entry : ds64Table) {
+                if (entry.first.compare(0, 4, chunk.id, 4) == 0) {
+                    size = entry.second;
+                }
+            }
+        }
+
+        chunk.offset = pos + 8;
+        chunk.size = std::min<uint64_t>(size, end - chunk.offset);
+
+        if (memcmp(chunk.id, "fmt ", 4) == 0) {
+            _format.resize(chunk.size);
+            is.read(_format.data(), chunk.size);
+            _leadingChunks.push_back(chunk);     // keeps its place, body comes from writeHead()
+        } else if (isData) {
+            _dataOffset = chunk.offset;
+            _dataSize = (size == 0 || size == RIFF_SIZE_LIMIT) ? end - chunk.offset : chunk.size;
+            haveData = true;
+        } else if (haveData) {
+            _trailingChunks.push_back(chunk);
+        } else {
+            _leadingChunks.push_back(chunk);
+        }
+
+        pos = chunk.offset + chunk.size + (chunk.size & 1);
+    }
+
+    if (_format.size() < 16 || !haveData) {
+        throw BadRiffException(std::string("File '") + filePath +
+                               std::string("' has no fmt or data chunk!"));
+    }
+
+    _sourcePath = filePath;
+}
+
+
+RiffLayout::Placement RiffLayout::writeHead(std::ostream& os, const std::vector<char>& format,
+                                            uint64_t dataSize) const {
+    Placement placement;
+    uint32_t size = 0;
+
+    placement.factPos = 0;
+    placement.ds64Pos = 0;
+
+    os.write("RIFF", 4);
+    os.write((const char*) &size, sizeof (size));
+    os.write("WAVE", 4);
+
+    // Leave a megabyte of slack for the other chunks before deciding RIFF will do.
+    if (_rf64 || dataSize == UNKNOWN_SIZE || dataSize > RIFF_SIZE_LIMIT - (1 << 20)) {
+        char junk[DS64_SIZE] = {};
+        size = DS64_SIZE;
+
+        placement.ds64Pos = (uint64_t) os.tellp();
+        os.write("JUNK", 4);
+        os.write((const char*) &size, sizeof (size));
+        os.write(junk, sizeof (junk));
+    }
+
+    if (_leadingChunks.empty()) {
+        _writeFormat(os, format);
+    }
+
+    _copyChunks(os, _leadingChunks, &format, &placement.factPos);
+
+    size = 0;
+    os.write("data", 4);
+    placement.dataSizePos = (uint64_t) os.tellp();
+    os.write((const char*) &size, sizeof (size));
+
+    return placement;
+}
+
+
+void RiffLayout::writeTail(std::ostream& os, const Placement& placement,
+                           uint64_t dataSize, uint64_t numFrames) const {
+    if (dataSize & 1) {
+        os.put(0);
+    }
+
+    _copyChunks(os, _trailingChunks, nullptr, nullptr);
+
+    uint64_t fileSize = (uint64_t) os.tellp();
+    uint64_t riffSize = fileSize - 8;
+    bool rf64 = riffSize > RIFF_SIZE_LIMIT || dataSize > RIFF_SIZE_LIMIT;
+
+    uint32_t riffSize32 = rf64 ? RIFF_SIZE_LIMIT : (uint32_t) riffSize;
+    uint32_t dataSize32 = rf64 ? RIFF_SIZE_LIMIT : (uint32_t) dataSize;
+    uint32_t numFrames32 = rf64 ? RIFF_SIZE_LIMIT : (uint32_t) numFrames;
+
+    if (rf64 && placement.ds64Pos != 0) {
+        uint32_t ds64Size = DS64_SIZE;
+        uint32_t tableLength = 0;
+
+        os.seekp(0);
+        os.write(memcmp(_riffId, "RIFF", 4) != 0 ? _riffId : "RF64", 4);
+
+        os.seekp(std::streampos(placement.ds64Pos));
+        os.write("ds64", 4);
+        os.write((const char*) &ds64Size, sizeof (ds64Size));
+        os.write((const char*) &riffSize, sizeof (riffSize));
+        os.write((const char*) &dataSize, sizeof (dataSize));
+        os.write((const char*) &numFrames, sizeof (numFrames));
+        os.write((const char*) &tableLength, sizeof (tableLength));
+    }
+
+    // Without a reserved ds64 an oversized file falls back to the
+    // "size unknown" markers, which parse() reads as "up to end of file".
+    os.seekp(4);
+    os.write((const char*) &riffSize32, sizeof (riffSize32));
+
+    os.seekp(std::streampos(placement.dataSizePos));
+    os.write((const char*) &dataSize32, sizeof (dataSize32));
+
+    // fact holds the sample frame count, which no longer matches once data changed
+    if (placement.factPos != 0) {
+        os.seekp(std::streampos(placement.factPos));
+        os.write((const char*) &numFrames32, sizeof (numFrames32));
+    }
+
+    os.seekp(std::streampos(fileSize));
+}
+
+
+void RiffLayout::_writeFormat(std::ostream& os, const std::vector<char>& format) const {
+    uint32_t size = (uint32_t) format.size();
+
+    os.write("fmt ", 4);
+    os.write((const char*) &size, sizeof (size));
+    os.write(format.data(), format.size());
+    if (format.size() & 1) {
+        os.put(0);
+    }
+}
+
+
+void RiffLayout::_copyChunks(std::ostream& os, const std::vector<Chunk>& chunks,
+                             const std::vector<char>* format, uint64_t* factPos) const {
+    if (chunks.empty()) {
+        return;
+    }
+
+    std::ifstream ifs(_sourcePath, std::ios::in | std::ios::binary);
+    std::vector<char> buf(65536);
+
+    for (const Chunk& chunk : chunks) {
+        uint32_t size = (uint32_t) std::min<uint64_t>(chunk.size, RIFF_SIZE_LIMIT);
+
+        if (format != nullptr && memcmp(chunk.id, "fmt ", 4) == 0) {
+            _writeFormat(os, *format);
+            continue;
+        }
+
+        os.write(chunk.id, 4);
+        os.write((const char*) &size, sizeof (size));
+
+        if (factPos != nullptr && memcmp(chunk.id, "fact", 4) == 0 && chunk.size >= 4) {
+            *factPos = (uint64_t) os.tellp();
+        }
+
+        ifs.seekg(std::streampos(chunk.offset));
+
+        for (uint64_t left = chunk.size; left > 0; ) {
+            std::streamsize n = (std::streamsize) std::min<uint64_t>(left, buf.size());
+            ifs.read(buf.data(), n);
+            os.write(buf.data(), n);
+            left -= n;
+        }
+
+        if (chunk.size & 1) {
+            os.put(0);
+        }
+    }
+}
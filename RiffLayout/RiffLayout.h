@@ -0,0 +1,86 @@
+#ifndef RIFFLAYOUT_H
+#define RIFFLAYOUT_H
+
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+
+
+class BadRiffException : public std::runtime_error {
+    public:
+        BadRiffException(std::string errorMessage):
+            std::runtime_error(errorMessage)
+        {}
+};
+
+
+// Chunk map of a RIFF/WAVE or RF64/BW64 file. Parsing walks the chunk
+// headers only: the fmt body is kept, the data chunk and every other chunk
+// are remembered as byte ranges of the source file and copied through when
+// writing. Output switches to RF64 once it no longer fits RIFF's 32-bit sizes.
+class RiffLayout {
+    public:
+        struct Chunk {
+            char        id[4];
+            uint64_t    offset;     // of the chunk body in the source file
+            uint64_t    size;
+        };
+
+        // Output positions that can only be filled in once the data is written.
+        struct Placement {
+            uint64_t    dataSizePos;
+            uint64_t    factPos;
+            uint64_t    ds64Pos;
+        };
+
+        static const uint64_t UNKNOWN_SIZE = UINT64_MAX;
+        static const uint64_t RIFF_SIZE_LIMIT = 0xFFFFFFFF;
+
+        static const uint16_t WAVE_FORMAT_PCM = 0x0001;
+        static const uint16_t WAVE_FORMAT_IEEE_FLOAT = 0x0003;
+        static const uint16_t WAVE_FORMAT_EXTENSIBLE = 0xFFFE;
+
+        RiffLayout();
+
+        void parse(std::istream& is, const std::string& filePath) throw (BadRiffException);
+
+        bool                        isParsed() const { return !_sourcePath.empty(); }
+        bool                        isRf64() const { return _rf64; }
+        const std::string&          getSourcePath() const { return _sourcePath; }
+        const std::vector<char>&    getFormat() const { return _format; }
+        uint64_t                    getDataOffset() const { return _dataOffset; }
+        uint64_t                    getDataSize() const { return _dataSize; }
+        const std::vector<Chunk>&   getLeadingChunks() const { return _leadingChunks; }     // fmt included
+        const std::vector<Chunk>&   getTrailingChunks() const { return _trailingChunks; }
+
+        // Writes everything up to the first data byte. Sizes are placeholders
+        // until writeTail() patches them. Room for a ds64 chunk is reserved
+        // (as JUNK) when dataSize may not fit in 32 bits or isn't known yet.
+        Placement   writeHead(std::ostream& os, const std::vector<char>& format,
+                              uint64_t dataSize = UNKNOWN_SIZE) const;
+        void        writeTail(std::ostream& os, const Placement& placement,
+                              uint64_t dataSize, uint64_t numFrames) const;
+
+    private:
+        static const uint32_t DS64_SIZE = 28;
+
+        char                _riffId[4];
+        bool                _rf64;
+        std::string         _sourcePath;
+        std::vector<char>   _format;
+        uint64_t            _dataOffset;
+        uint64_t            _dataSize;
+        std::vector<Chunk>  _leadingChunks;
+        std::vector<Chunk>  _trailingChunks;
+
+        void _writeFormat(std::ostream& os, const std::vector<char>& format) const;
+        void _copyChunks(std::ostream& os, const std::vector<Chunk>& chunks,
+                         const std::vector<char>* format, uint64_t* factPos) const;
+};
+
+
+#endif // RIFFLAYOUT_H
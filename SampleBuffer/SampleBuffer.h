@@ -0,0 +1,156 @@
+#ifndef SAMPLEBUFFER_H
+#define SAMPLEBUFFER_H
+
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <utility>
+#include "SampleView/SampleView.h"
+#include "BufferPool/BufferPool.h"
+
+
+// All channels of a file in one 64-byte aligned allocation, either
+// interleaved (frame after frame) or planar (channel after channel, each
+// starting on a 64-byte boundary). Memory comes from BufferPool::shared()
+// when one is set, and goes back to the pool it came from.
+template<typename T>
+class SampleBuffer {
+    public:
+        enum Layout {
+            INTERLEAVED,
+            PLANAR
+        };
+
+        static const std::size_t ALIGNMENT = 64;
+
+        SampleBuffer():
+            _raw(nullptr),
+            _pool(nullptr),
+            _data(nullptr),
+            _numChannels(0),
+            _numFrames(0),
+            _stride(0),
+            _layout(INTERLEAVED)
+        {}
+
+        SampleBuffer(const SampleBuffer& other):
+            SampleBuffer()
+        {
+            *this = other;
+        }
+
+        SampleBuffer(SampleBuffer&& other):
+            SampleBuffer()
+        {
+            *this = std::move(other);
+        }
+
+        ~SampleBuffer() {
+            clear();
+        }
+
+        SampleBuffer& operator =(const SampleBuffer& other) {
+            if (this != &other) {
+                allocate(other._numChannels, other._numFrames, other._layout);
+                memcpy((void*) _data, other._data, _capacity() * sizeof (T));
+            }
+            return *this;
+        }
+
+        SampleBuffer& operator =(SampleBuffer&& other) {
+            if (this != &other) {
+                clear();
+                _raw = other._raw;
+                _pool = other._pool;
+                _data = other._data;
+                _numChannels = other._numChannels;
+                _numFrames = other._numFrames;
+                _stride = other._stride;
+                _layout = other._layout;
+                other._raw = nullptr;
+                other._pool = nullptr;
+                other._data = nullptr;
+                other._numChannels = 0;
+                other._numFrames = 0;
+                other._stride = 0;
+            }
+            return *this;
+        }
+
+        // Contents are left uninitialized.
+        void allocate(uint16_t numChannels, uint64_t numFrames, Layout layout) {
+            clear();
+
+            _numChannels = numChannels;
+            _numFrames = numFrames;
+            _layout = layout;
+
+            // 64 elements of any T span a multiple of 64 bytes, Int24 included
+            _stride = layout == PLANAR ? (numFrames + 63) / 64 * 64 : numChannels;
+
+            std::size_t bytes = _capacity() * sizeof (T);
+            if (bytes == 0) {
+                return;
+            }
+
+            _pool = BufferPool::shared();
+
+            if (_pool != nullptr) {
+                _raw = static_cast<char*>(_pool->allocate(bytes));
+                _data = reinterpret_cast<T*>(_raw);
+                return;
+            }
+
+            _raw = static_cast<char*>(::operator new(bytes + ALIGNMENT));
+            _data = reinterpret_cast<T*>(_raw + ALIGNMENT - reinterpret_cast<uintptr_t>(_raw) % ALIGNMENT);
+        }
+
+        void clear() {
+            if (_pool != nullptr) {
+                _pool->release(_raw);
+            } else {
+                ::operator delete(_raw);
+            }
+            _raw = nullptr;
+            _pool = nullptr;
+            _data = nullptr;
+            _numChannels = 0;
+            _numFrames = 0;
+            _stride = 0;
+        }
+
+        T*          data() { return _data; }
+        const T*    data() const { return _data; }
+        uint16_t    numChannels() const { return _numChannels; }
+        uint64_t    numFrames() const { return _numFrames; }
+        Layout      layout() const { return _layout; }
+        bool        empty() const { return _data == nullptr; }
+
+        ChannelView<T> channel(uint16_t c) {
+            return _layout == PLANAR ? ChannelView<T>(_data + c * _stride, 1, _numFrames)
+                                     : ChannelView<T>(_data + c, _numChannels, _numFrames);
+        }
+
+        ChannelView<const T> channel(uint16_t c) const {
+            return _layout == PLANAR ? ChannelView<const T>(_data + c * _stride, 1, _numFrames)
+                                     : ChannelView<const T>(_data + c, _numChannels, _numFrames);
+        }
+
+    private:
+        char*       _raw;
+        BufferPool* _pool;          // _raw came from this pool, if any
+        T*          _data;
+        uint16_t    _numChannels;
+        uint64_t    _numFrames;
+        uint64_t    _stride;
+        Layout      _layout;
+
+        uint64_t _capacity() const {
+            return _layout == PLANAR ? _stride * _numChannels : _numFrames * _numChannels;
+        }
+};
+
+
+#endif // SAMPLEBUFFER_H
@@ -0,0 +1,87 @@
+#ifndef SAMPLEVIEW_H
+#define SAMPLEVIEW_H
+
+
+#include <cstdint>
+#include <cstddef>
+
+
+// Non-owning, read-only view of interleaved PCM frames, e.g. the data chunk
+// of a memory mapped file. Frame f, channel c lives at data[f * channels + c];
+// data has to be aligned for T.
+template<typename T>
+class InterleavedView {
+    public:
+        InterleavedView():
+            _data(nullptr),
+            _numFrames(0),
+            _numChannels(0)
+        {}
+
+        InterleavedView(const T* data, uint64_t numFrames, uint16_t numChannels):
+            _data(data),
+            _numFrames(numFrames),
+            _numChannels(numChannels)
+        {}
+
+        const T*    data() const { return _data; }
+        uint64_t    numFrames() const { return _numFrames; }
+        uint16_t    numChannels() const { return _numChannels; }
+        bool        empty() const { return _numFrames == 0; }
+
+        const T*    frame(uint64_t f) const { return _data + f * _numChannels; }
+
+        const T& operator ()(uint64_t f, uint16_t c) const {
+            return _data[f * _numChannels + c];
+        }
+
+    private:
+        const T*    _data;
+        uint64_t    _numFrames;
+        uint16_t    _numChannels;
+};
+
+
+// Non-owning view of one channel: sample i lives at data[i * stride]. The
+// stride is 1 for planar storage and the channel count for interleaved.
+template<typename T>
+class ChannelView {
+    public:
+        ChannelView():
+            _data(nullptr),
+            _stride(0),
+            _numFrames(0)
+        {}
+
+        ChannelView(T* data, std::size_t stride, uint64_t numFrames):
+            _data(data),
+            _stride(stride),
+            _numFrames(numFrames)
+        {}
+
+        // A view of T converts to a read-only view of const T.
+        template<typename U>
+        ChannelView(const ChannelView<U>& other):
+            _data(other.data()),
+            _stride(other.stride()),
+            _numFrames(other.numFrames())
+        {}
+
+        T*          data() const { return _data; }
+        std::size_t stride() const { return _stride; }
+        uint64_t    numFrames() const { return _numFrames; }
+        bool        empty() const { return _numFrames == 0; }
+        bool        isContiguous() const { return _stride == 1; }
+
+        T& operator [](uint64_t i) const {
+            return _data[i * _stride];
+        }
+
+    private:
+        T*          _data;
+        std::size_t _stride;
+        uint64_t    _numFrames;
+};
+
+
+#endif // SAMPLEVIEW_H
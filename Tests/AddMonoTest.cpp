@@ -0,0 +1,153 @@
+// addMonoFrom() on 8-bit files: integer samples, float processing and the
+// streaming pipeline must give the same bytes.
+//
+//   srcs=$(find . -mindepth 2 -name '*.cpp' -not -path './Benchmark/*' -not -path './BatchRunner/*' -not -path './Tests/*')
+//   g++ -std=c++11 -O2 -I. -pthread Tests/AddMonoTest.cpp $srcs -o addmonotest
+//   ./addmonotest
+//
+// Writes its files next to the test and removes them afterwards. Prints the
+// cases that fail; the exit status is the number of them.
+
+#include "WavFile/WavFile.h"
+#include "WavStream/WavStream.h"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+
+
+static const char* PROGRAM_PATH = "addmonotest_program.wav";
+static const char* MONO_PATH = "addmonotest_mono.wav";
+static const char* OUT_PATH = "addmonotest_out.wav";
+
+
+static void writeInt8(const std::string& path, uint16_t numChannels, const std::vector<int8_t>& samples) {
+    WavFile::Header header;
+
+    header.audioFormat = RiffLayout::WAVE_FORMAT_PCM;
+    header.numChannels = numChannels;
+    header.sampleRate = 44100;
+    header.byteRate = 44100 * numChannels;
+    header.blockAlign = numChannels;
+    header.bitsPerSample = 8;
+
+    WavWriter writer(path, header, samples.size() / numChannels);
+    writer.writeBlock(samples);
+    writer.close();
+}
+
+
+static std::vector<uint8_t> readBytes(const std::string& path) {
+    WavReader reader(path);
+    std::vector<int8_t> samples;
+
+    reader.readBlock(samples, reader.getNumFrames());
+
+    return std::vector<uint8_t>(samples.begin(), samples.end());
+}
+
+
+static int compare(const std::string& what, const std::vector<uint8_t>& got, const std::vector<uint8_t>& expected) {
+    if (got.size() != expected.size()) {
+        std::cout << what << ": " << got.size() << " samples, expected " << expected.size() << std::endl;
+        return 1;
+    }
+
+    for (std::size_t i = 0; i < got.size(); i++) {
+        if (got[i] != expected[i]) {
+            std::cout << what << ": " << (int) got[i] << " at " << i << ", expected " << (int) expected[i] << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+// Every program byte against every mono byte, for numChannels channels.
+static int checkAllBytes(uint16_t numChannels) {
+    std::vector<int8_t> program, mono;
+
+    for (int d = 0; d < 256; d++) {
+        for (int s = 0; s < 256; s++) {
+            mono.push_back((int8_t) s);
+
+            for (uint16_t c = 0; c < numChannels; c++) {
+                program.push_back((int8_t) (c % 2 ? 255 - d : d));
+            }
+        }
+    }
+
+    writeInt8(PROGRAM_PATH, numChannels, program);
+    writeInt8(MONO_PATH, 1, mono);
+
+    std::string name = std::to_string(numChannels) + " channels";
+    int failures = 0;
+
+    WavFile floating(PROGRAM_PATH), floatingMono(MONO_PATH);
+    floating.setFloatProcessing(true, false);
+    floatingMono.setFloatProcessing(true, false);
+    floating.loadData();
+    floatingMono.loadData();
+    floating.addMonoFrom(floatingMono);
+    floating.save(OUT_PATH);
+    std::vector<uint8_t> expected = readBytes(OUT_PATH);
+
+    for (int layout = WavFile::VECTOR_STORAGE; layout <= WavFile::LAZY_STORAGE; layout++) {
+        WavFile file(PROGRAM_PATH), monoFile(MONO_PATH);
+        file.setStorageLayout((WavFile::StorageLayout) layout);
+        file.loadData();
+        monoFile.loadData();
+        file.addMonoFrom(monoFile);
+        file.save(OUT_PATH);
+        failures += compare(name + ", layout " + std::to_string(layout), readBytes(OUT_PATH), expected);
+    }
+
+    StreamPipeline(PROGRAM_PATH, 1000).addMonoFrom(MONO_PATH).save(OUT_PATH);
+    failures += compare(name + ", streamed", readBytes(OUT_PATH), expected);
+
+    return failures;
+}
+
+
+// A silent mono track leaves the program as it is.
+static int checkSilence() {
+    std::vector<int8_t> program, mono(4096, (int8_t) 128);
+
+    for (int i = 0; i < 4096 * 2; i++) {
+        program.push_back((int8_t) (i * 37 % 256));
+    }
+
+    writeInt8(PROGRAM_PATH, 2, program);
+    writeInt8(MONO_PATH, 1, mono);
+
+    WavFile file(PROGRAM_PATH), monoFile(MONO_PATH);
+    file.loadData();
+    monoFile.loadData();
+    file.addMonoFrom(monoFile);
+    file.save(OUT_PATH);
+
+    return compare("silence", readBytes(OUT_PATH), std::vector<uint8_t>(program.begin(), program.end()));
+}
+
+
+int main() {
+    int failures = 0;
+
+    for (uint16_t numChannels : { 1, 2, 3, 6 }) {
+        failures += checkAllBytes(numChannels);
+    }
+
+    failures += checkSilence();
+
+    std::remove(PROGRAM_PATH);
+    std::remove(MONO_PATH);
+    std::remove(OUT_PATH);
+
+    if (failures == 0) {
+        std::cout << "ok" << std::endl;
+    }
+
+    return failures;
+}
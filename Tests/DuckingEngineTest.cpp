@@ -0,0 +1,166 @@
+// DuckingEngine against the loop overVoice() had before it: that loop held
+// the attack through a quiet stretch and, once the hold ran out, walked back
+// over it and released from its start. Here it runs on loud/quiet voice
+// flags, and a frame it went back over keeps the envelope of the later pass,
+// which is what the engine works out going forward only.
+//
+//   g++ -std=c++11 -O2 -I. Tests/DuckingEngineTest.cpp DuckingEngine/DuckingEngine.cpp -o duckingenginetest
+//   ./duckingenginetest
+//
+// Prints the cases that fail; the exit status is the number of them.
+
+#include "DuckingEngine/DuckingEngine.h"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+
+static const uint32_t SAMPLE_RATE = 48000;
+static const uint64_t PREROLL = 9600;
+
+
+struct Settings {
+    double  attack;
+    double  release;
+    double  silence;
+    double  ratio;
+};
+
+
+// Loud and quiet runs of random lengths up to maxLoud and maxQuiet frames.
+static std::vector<char> voiceFlags(uint64_t numFrames, uint64_t maxLoud, uint64_t maxQuiet, uint32_t seed) {
+    std::vector<char> flags;
+    bool loud = false;
+
+    while (flags.size() < numFrames) {
+        seed = seed * 1664525 + 1013904223;
+        uint64_t length = 1 + (seed >> 8) % (loud ? maxLoud : maxQuiet);
+
+        flags.insert(flags.end(), std::min<uint64_t>(length, numFrames - flags.size()), loud);
+        loud = !loud;
+    }
+
+    return flags;
+}
+
+
+// The old loop, envelope in dB per frame of the track. The voice is padded
+// with PREROLL quiet frames and read attack * rate frames ahead. The loop
+// runs on past the end of the track for as long as the voice lasts: the
+// engine looks that far ahead, where the old loop stopped in mid-hold.
+static std::vector<double> legacyEnvelope(const std::vector<char>& voice, uint64_t numFrames, const Settings& s) {
+    uint64_t silenceFrames = (uint64_t) (s.silence * SAMPLE_RATE);
+    double attackStep = s.ratio / (s.attack * SAMPLE_RATE);
+    double releaseStep = s.ratio / (s.release * SAMPLE_RATE);
+    std::vector<double> envelopes(numFrames, 0.);
+    uint64_t f = 0, v = (uint64_t) (s.attack * SAMPLE_RATE), held = 0;
+    double envelope = 0.;
+
+    auto attack = [&] {
+        envelope = envelope < s.ratio ? envelope + attackStep : s.ratio;
+    };
+
+    for (; v < voice.size() + PREROLL; f++, v++) {
+        if (v >= PREROLL && voice[v - PREROLL]) {
+            held = 0;
+            attack();
+        } else if (held < silenceFrames && envelope != 0) {
+            attack();
+            held++;
+        } else {
+            if (held == silenceFrames) {
+                f -= silenceFrames;
+                v -= silenceFrames;
+                held++;
+            }
+
+            envelope = envelope > 0 ? envelope - releaseStep : 0.;
+        }
+
+        if (f < numFrames) {
+            envelopes[f] = envelope;
+        }
+    }
+
+    return envelopes;
+}
+
+
+// The engine driven the way overVoice() drives it; frames after isDone() are
+// left alone, an envelope of 0. The engine adds up the attack of a hold that
+// runs out in one go, so the two may round to either side of the ratio or of
+// 0 at the end of a release: they are allowed one attack or release step apart.
+static int checkEngine(const std::string& name, const std::vector<char>& voice, uint64_t numFrames,
+                       const Settings& s) {
+    std::vector<double> expected = legacyEnvelope(voice, numFrames, s);
+    double tolerance = std::max(s.ratio / (s.attack * SAMPLE_RATE), s.ratio / (s.release * SAMPLE_RATE)) + 1e-9;
+    DuckingEngine engine(SAMPLE_RATE, s.attack, s.release, s.silence, s.ratio, PREROLL);
+    uint64_t q = 0;
+
+    for (uint64_t f = 0; f < numFrames; f++) {
+        while (!engine.isReady()) {
+            if (q == voice.size()) {
+                engine.endVoice();
+                break;
+            }
+
+            engine.pushVoice(voice[q++] != 0);
+        }
+
+        double envelope = engine.isDone() ? 0. : engine.next();
+        double gain = engine.isDone() && envelope == 0. ? 1. : engine.getGain();
+
+        if (std::fabs(envelope - expected[f]) > tolerance) {
+            std::cout << name << ": " << envelope << " dB at frame " << f << ", expected "
+                      << expected[f] << std::endl;
+            return 1;
+        }
+
+        if (std::fabs(gain - std::pow(10., -envelope / 20.)) > 1e-6) {
+            std::cout << name << ": gain " << gain << " at frame " << f << " for " << envelope
+                      << " dB" << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+int main() {
+    const Settings settings[] = {
+        { 0.05, 0.3, 0.2, 15. },        // overVoice()'s usual setting
+        { 0.05, 0.3, 0.2, 6. },
+        { 0.01, 1.3, 0.4, 20. },
+        { 0.3, 0.1, 0.05, 15. },        // the voice read further ahead than the preroll
+        { 0.05, 0.3, 0.100001, 15. },   // a hold that isn't a whole number of frames
+        { 0.05, 0.3, 0., 15. }
+    };
+    const uint64_t numFrames = 2000000;
+    int failures = 0;
+
+    for (const Settings& s : settings) {
+        std::string name = "attack " + std::to_string(s.attack) + ", release " + std::to_string(s.release) +
+                           ", silence " + std::to_string(s.silence) + ", ratio " + std::to_string(s.ratio);
+
+        // Bursts long enough to reach the ratio before a hold starts, and
+        // short ones that don't; quiet gaps on both sides of the hold time.
+        failures += checkEngine(name + ", long bursts", voiceFlags(numFrames + PREROLL, 40000, 40000, 1),
+                                numFrames, s);
+        failures += checkEngine(name + ", short bursts", voiceFlags(numFrames + PREROLL, 3000, 20000, 2),
+                                numFrames, s);
+
+        // A voice that ends before the track, mid-hold or mid-release.
+        failures += checkEngine(name + ", short voice", voiceFlags(numFrames / 3, 20000, 15000, 3),
+                                numFrames, s);
+    }
+
+    if (failures == 0) {
+        std::cout << "ok" << std::endl;
+    }
+
+    return failures;
+}
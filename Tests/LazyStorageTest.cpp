@@ -0,0 +1,341 @@
+// LAZY_STORAGE against VECTOR_STORAGE: ranges and visits anywhere in the
+// file with a cache of two blocks, and a mix saved elsewhere and over the
+// source. Then BlockCache alone: eviction, dirty blocks, and a decoder that
+// throws while other threads wait for its block.
+//
+//   srcs=$(find . -mindepth 2 -name '*.cpp' -not -path './Benchmark/*' -not -path './BatchRunner/*' -not -path './Tests/*')
+//   g++ -std=c++11 -O2 -I. -pthread Tests/LazyStorageTest.cpp $srcs -o lazystoragetest
+//   ./lazystoragetest
+//
+// Writes its files next to the test and removes them afterwards. Prints the
+// cases that fail; the exit status is the number of them.
+
+#include "WavFile/WavFile.h"
+#include "WavStream/WavStream.h"
+#include "BlockCache/BlockCache.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+
+static const char* FIRST_PATH = "lazystoragetest-first.wav";
+static const char* SECOND_PATH = "lazystoragetest-second.wav";
+static const char* VECTOR_PATH = "lazystoragetest-vector.wav";
+static const char* LAZY_PATH = "lazystoragetest-lazy.wav";
+static const uint16_t NUM_CHANNELS = 2;
+
+// Nine full blocks and a short one.
+static const uint64_t NUM_FRAMES = WavFile::CACHE_BLOCK_FRAMES * 9 + 1234;
+
+
+template<typename T> struct Access;
+
+template<> struct Access<int16_t> {
+    static WavFile::Data_i16 range(WavFile& file, uint64_t first, uint64_t numFrames) {
+        return file.getInt16Range(first, numFrames);
+    }
+
+    static void visit(const WavFile& file, int channel, uint64_t first, uint64_t numFrames,
+                      const WavFile::Visitor_i16& body) {
+        file.visitInt16Range(channel, first, numFrames, body);
+    }
+};
+
+template<> struct Access<Int24> {
+    static WavFile::Data_i24 range(WavFile& file, uint64_t first, uint64_t numFrames) {
+        return file.getInt24Range(first, numFrames);
+    }
+
+    static void visit(const WavFile& file, int channel, uint64_t first, uint64_t numFrames,
+                      const WavFile::Visitor_i24& body) {
+        file.visitInt24Range(channel, first, numFrames, body);
+    }
+};
+
+
+static void writeWav(const char* path, uint16_t bitsPerSample, uint64_t numFrames, uint32_t seed) {
+    WavFile::Header header;
+    uint16_t frameSize = NUM_CHANNELS * bitsPerSample / 8;
+    std::vector<char> bytes(numFrames * frameSize);
+
+    header.audioFormat = RiffLayout::WAVE_FORMAT_PCM;
+    header.numChannels = NUM_CHANNELS;
+    header.sampleRate = 48000;
+    header.byteRate = 48000 * frameSize;
+    header.blockAlign = frameSize;
+    header.bitsPerSample = bitsPerSample;
+
+    for (std::size_t i = 0; i < bytes.size(); i++) {
+        seed = seed * 1664525 + 1013904223;
+        bytes[i] = (char) (seed >> 24);
+    }
+
+    WavWriter writer(path, header, numFrames);
+    writer.writeFrames(bytes.data(), numFrames);
+    writer.close();
+}
+
+
+static std::string readFile(const char* path) {
+    std::ifstream ifs(path, std::ios::in|std::ios::binary);
+    std::ostringstream contents;
+
+    contents << ifs.rdbuf();
+    return contents.str();
+}
+
+
+// Random ranges, inside a block, across several and past the end, read
+// and visited lazily with room for two blocks only.
+template<typename T>
+static int checkRanges(uint16_t bitsPerSample) {
+    std::string name = std::to_string(bitsPerSample) + "-bit";
+    int failures = 0;
+    uint32_t seed = 11;
+
+    writeWav(FIRST_PATH, bitsPerSample, NUM_FRAMES, bitsPerSample);
+
+    WavFile loaded(FIRST_PATH);
+    loaded.loadData();
+
+    WavFile lazy(FIRST_PATH);
+    lazy.setStorageLayout(WavFile::LAZY_STORAGE);
+    lazy.setCacheSize(0);
+    lazy.loadData();
+
+    for (int i = 0; i < 300 && failures < 10; i++) {
+        seed = seed * 1664525 + 1013904223;
+        uint64_t first = (seed >> 4) % (NUM_FRAMES + 1000);
+        seed = seed * 1664525 + 1013904223;
+        uint64_t count = i % 2 == 0 ? (seed >> 4) % 5000 : (seed >> 4) % (4 * WavFile::CACHE_BLOCK_FRAMES);
+        int channel = i % NUM_CHANNELS;
+        std::string what = name + " [" + std::to_string(first) + ", +" + std::to_string(count) + ")";
+
+        std::vector<std::vector<T>> expected = Access<T>::range(loaded, first, count);
+
+        if (Access<T>::range(lazy, first, count) != expected) {
+            std::cout << what << ": lazy range differs" << std::endl;
+            failures++;
+            continue;
+        }
+
+        std::vector<T> visited;
+        uint64_t next = first;
+        bool inOrder = true;
+
+        Access<T>::visit(lazy, channel, first, count, [&](ChannelView<const T> view, uint64_t from, uint64_t to) {
+            inOrder = inOrder && from == next && view.numFrames() == to - from;
+            next = to;
+
+            for (uint64_t f = 0; f < view.numFrames(); f++) {
+                visited.push_back(view[f]);
+            }
+        });
+
+        if (!inOrder || (first < NUM_FRAMES && visited != expected[channel])) {
+            std::cout << what << ": lazy visit of channel " << channel << " differs" << std::endl;
+            failures++;
+        }
+    }
+
+    if (lazy.getCache()->getNumBlocks() > 2 || lazy.getCache()->getMisses() == 0) {
+        std::cout << name << ": " << lazy.getCache()->getNumBlocks() << " blocks cached, "
+                  << lazy.getCache()->getMisses() << " misses" << std::endl;
+        failures++;
+    }
+
+    return failures;
+}
+
+
+// A mix worked out lazily saves to the same bytes as one in memory, both to
+// another path and over the source, where evicted blocks come from.
+static int checkMix() {
+    int failures = 0;
+
+    writeWav(FIRST_PATH, 16, NUM_FRAMES, 1);
+    writeWav(SECOND_PATH, 16, NUM_FRAMES / 2, 2);
+
+    {
+        WavFile first(FIRST_PATH), second(SECOND_PATH);
+        first.loadData();
+        second.loadData();
+        first.mixWith(second, 100000, 0.7f, 0.9f);
+        first.save(VECTOR_PATH);
+    }
+
+    {
+        WavFile first(FIRST_PATH), second(SECOND_PATH);
+        first.setStorageLayout(WavFile::LAZY_STORAGE);
+        first.setCacheSize(0);
+        first.loadData();
+        second.loadData();
+        first.mixWith(second, 100000, 0.7f, 0.9f);
+        first.save(LAZY_PATH);
+
+        if (readFile(LAZY_PATH) != readFile(VECTOR_PATH)) {
+            std::cout << "mix: saved lazily, differs" << std::endl;
+            failures++;
+        }
+
+        first.save();
+    }
+
+    if (readFile(FIRST_PATH) != readFile(VECTOR_PATH)) {
+        std::cout << "mix: saved lazily over the source, differs" << std::endl;
+        failures++;
+    }
+
+    return failures;
+}
+
+
+static std::function<void(char*)> fillWith(char value, std::atomic<int>* calls = nullptr) {
+    return [=](char* data) {
+        if (calls != nullptr) {
+            (*calls)++;
+        }
+        memset(data, value, 16);
+    };
+}
+
+
+// Least recently used goes first, dirty blocks stay over the capacity.
+static int checkEviction() {
+    BlockCache cache(16, 2);
+    int failures = 0;
+
+    for (uint64_t index : { 0, 1, 0, 2 }) {
+        cache.acquire(index, fillWith((char) index));
+        cache.release(index, false);
+    }
+
+    if (cache.getNumBlocks() != 2 || cache.getHits() != 1 || cache.getMisses() != 3) {
+        std::cout << "eviction: " << cache.getNumBlocks() << " blocks, " << cache.getHits() << " hits, "
+                  << cache.getMisses() << " misses, expected 2, 1 and 3" << std::endl;
+        failures++;
+    }
+
+    std::atomic<int> calls(0);
+    char* block = cache.acquire(0, fillWith(9, &calls));
+    bool kept = calls == 0 && block[15] == 0;
+    cache.release(0, true);
+    cache.acquire(1, fillWith(9, &calls));
+    cache.release(1, false);
+    cache.acquire(3, fillWith(9, &calls));
+    cache.release(3, false);
+
+    if (!kept || !cache.isDirty(0) || cache.getNumBlocks() != 2 || calls != 2) {
+        std::cout << "eviction: block 0 " << (kept ? "" : "not kept, ")
+                  << (cache.isDirty(0) ? "dirty" : "clean") << ", " << cache.getNumBlocks()
+                  << " blocks, " << calls << " decodes" << std::endl;
+        failures++;
+    }
+
+    block = cache.acquire(0, fillWith(9, &calls));
+
+    if (block[15] != 0 || calls != 2) {
+        std::cout << "eviction: the dirty block was evicted" << std::endl;
+        failures++;
+    }
+
+    cache.release(0, false);
+
+    return failures;
+}
+
+
+// The first decoder throws while others wait for the block: the exception
+// reaches its caller only, one waiter decodes again and the rest get that.
+static int checkFailedDecode() {
+    const int NUM_WAITERS = 3;
+    BlockCache cache(16, 4);
+    std::atomic<bool> decoding(false), fail(false);
+    std::atomic<int> calls(0), filled(0);
+    bool thrown = false;
+    int failures = 0;
+
+    std::thread failing([&] {
+        try {
+            cache.acquire(5, [&](char*) {
+                decoding = true;
+                while (!fail) {
+                    std::this_thread::yield();
+                }
+                throw std::runtime_error("decode failed");
+            });
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+    });
+
+    while (!decoding) {
+        std::this_thread::yield();
+    }
+
+    std::vector<std::thread> waiters;
+
+    for (int i = 0; i < NUM_WAITERS; i++) {
+        waiters.push_back(std::thread([&] {
+            char* block = cache.acquire(5, fillWith(7, &calls));
+            filled += block[0] == 7 && block[15] == 7;
+            cache.release(5, false);
+        }));
+    }
+
+    // Long enough for the waiters to be waiting, though they pass either way.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    fail = true;
+
+    failing.join();
+    for (std::thread& waiter : waiters) {
+        waiter.join();
+    }
+
+    if (!thrown || calls != 1 || filled != NUM_WAITERS) {
+        std::cout << "failed decode: " << (thrown ? "thrown" : "not thrown") << ", decoded again "
+                  << calls << " times, " << filled << " of " << NUM_WAITERS << " waiters got the block"
+                  << std::endl;
+        failures++;
+    }
+
+    if (cache.getNumBlocks() != 1 || cache.getMisses() != 2 || cache.getHits() != NUM_WAITERS - 1) {
+        std::cout << "failed decode: " << cache.getNumBlocks() << " blocks, " << cache.getHits()
+                  << " hits, " << cache.getMisses() << " misses, expected 1, "
+                  << NUM_WAITERS - 1 << " and 2" << std::endl;
+        failures++;
+    }
+
+    return failures;
+}
+
+
+int main() {
+    int failures = 0;
+
+    failures += checkRanges<int16_t>(16);
+    failures += checkRanges<Int24>(24);
+    failures += checkMix();
+    failures += checkEviction();
+    failures += checkFailedDecode();
+
+    std::remove(FIRST_PATH);
+    std::remove(SECOND_PATH);
+    std::remove(VECTOR_PATH);
+    std::remove(LAZY_PATH);
+
+    if (failures == 0) {
+        std::cout << "ok" << std::endl;
+    }
+
+    return failures;
+}
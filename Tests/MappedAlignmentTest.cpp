@@ -0,0 +1,124 @@
+// Float samples after an odd-sized LIST chunk: RIFF pads it to 2 bytes only,
+// so the data chunk starts at 2 mod 4. The mapped view must still be aligned
+// and every storage layout must load the samples as written.
+//
+//   srcs=$(find . -mindepth 2 -name '*.cpp' -not -path './Benchmark/*' -not -path './BatchRunner/*' -not -path './Tests/*')
+//   g++ -std=c++11 -O2 -I. -pthread -fsanitize=alignment Tests/MappedAlignmentTest.cpp $srcs -o mappedalignmenttest
+//   ./mappedalignmenttest
+//
+// Writes its file next to the test and removes it afterwards. Prints the
+// cases that fail; the exit status is the number of them.
+
+#include "WavFile/WavFile.h"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+
+static const char* PATH = "mappedalignmenttest.wav";
+static const uint16_t NUM_CHANNELS = 2;
+static const uint64_t NUM_FRAMES = 200000;
+
+
+static void put32(std::ofstream& ofs, uint32_t value) { ofs.write((const char*) &value, 4); }
+static void put16(std::ofstream& ofs, uint16_t value) { ofs.write((const char*) &value, 2); }
+
+
+// RIFF, fmt, a 5-byte LIST chunk and its pad byte, then the data chunk at
+// 12 + 24 + 14 + 8 = 58 bytes.
+static uint64_t writeFile(const std::vector<float>& samples) {
+    const char list[6] = { 'I', 'N', 'F', 'O', 'x', 0 };
+    uint32_t dataSize = (uint32_t) (samples.size() * sizeof (float));
+    std::ofstream ofs(PATH, std::ios::out|std::ios::binary|std::ios::trunc);
+
+    ofs.write("RIFF", 4);
+    put32(ofs, 4 + 24 + 14 + 8 + dataSize);
+    ofs.write("WAVE", 4);
+
+    ofs.write("fmt ", 4);
+    put32(ofs, 16);
+    put16(ofs, 3);
+    put16(ofs, NUM_CHANNELS);
+    put32(ofs, 48000);
+    put32(ofs, 48000 * NUM_CHANNELS * 4);
+    put16(ofs, NUM_CHANNELS * 4);
+    put16(ofs, 32);
+
+    ofs.write("LIST", 4);
+    put32(ofs, 5);
+    ofs.write(list, sizeof (list));
+
+    ofs.write("data", 4);
+    put32(ofs, dataSize);
+    ofs.write((const char*) samples.data(), dataSize);
+
+    return 58;
+}
+
+
+int main() {
+    int failures = 0;
+    std::vector<float> samples(NUM_FRAMES * NUM_CHANNELS);
+
+    for (std::size_t i = 0; i < samples.size(); i++) {
+        samples[i] = (float) ((int) (i * 7919 % 65536) - 32768) / 32768.f;
+    }
+
+    uint64_t dataOffset = writeFile(samples);
+
+    {
+        WavFile file(PATH);
+
+        if (file.getDataOffset() != dataOffset || dataOffset % alignof (float) == 0) {
+            std::cout << "data chunk at " << file.getDataOffset() << ", expected " << dataOffset << std::endl;
+            failures++;
+        }
+
+        file.mapData();
+        InterleavedView<float> view = file.getMappedFlt32Data();
+
+        if ((uintptr_t) view.data() % alignof (float) != 0) {
+            std::cout << "mapped view misaligned" << std::endl;
+            failures++;
+        }
+
+        if (view.numFrames() != NUM_FRAMES || memcmp(view.data(), samples.data(), samples.size() * sizeof (float)) != 0) {
+            std::cout << "mapped view differs" << std::endl;
+            failures++;
+        }
+    }
+
+    for (int layout = WavFile::VECTOR_STORAGE; layout <= WavFile::LAZY_STORAGE; layout++) {
+        WavFile file(PATH);
+        file.setStorageLayout((WavFile::StorageLayout) layout);
+        file.loadData();
+
+        WavFile::Data_f32 data = file.getFlt32Data();
+        bool same = data.size() == NUM_CHANNELS;
+
+        for (uint16_t c = 0; same && c < NUM_CHANNELS; c++) {
+            same = data[c].size() == NUM_FRAMES;
+
+            for (uint64_t f = 0; same && f < NUM_FRAMES; f++) {
+                same = data[c][f] == samples[f * NUM_CHANNELS + c];
+            }
+        }
+
+        if (!same) {
+            std::cout << "layout " << layout << " loads other samples" << std::endl;
+            failures++;
+        }
+    }
+
+    std::remove(PATH);
+
+    if (failures == 0) {
+        std::cout << "ok" << std::endl;
+    }
+
+    return failures;
+}
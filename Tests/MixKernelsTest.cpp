@@ -0,0 +1,113 @@
+// Mix kernels on known sample values, every ISA the CPU has.
+//
+//   g++ -std=c++11 -O2 -I. Tests/MixKernelsTest.cpp MixKernels/MixKernels.cpp Pcm24/Pcm24.cpp -o mixkernelstest
+//   ./mixkernelstest
+//
+// Prints the cases that fail; the exit status is the number of them.
+
+#include "MixKernels/MixKernels.h"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+
+static const char* isaName(MixKernels::Isa isa) {
+    switch (isa) {
+        case MixKernels::SCALAR_ISA:    return "scalar";
+        case MixKernels::SSE2_ISA:      return "sse2";
+        case MixKernels::AVX2_ISA:      return "avx2";
+    }
+    return "";
+}
+
+
+// dst and src filled with one byte value each, long enough for the SIMD
+// loops and their scalar tails.
+static int checkInt8(MixKernels::Isa isa, uint8_t dstByte, uint8_t srcByte, float dstGain, float srcGain,
+                     uint8_t expected) {
+    int failures = 0;
+
+    for (uint64_t n : { 1, 7, 8, 16, 33, 70 }) {
+        std::vector<int8_t> dst(n, (int8_t) dstByte), src(n, (int8_t) srcByte);
+
+        MixKernels::mix(dst.data(), src.data(), n, dstGain, srcGain);
+
+        for (uint64_t i = 0; i < n; i++) {
+            if ((uint8_t) dst[i] != expected) {
+                std::cout << isaName(isa) << ": " << (int) dstByte << " * " << dstGain << " + "
+                          << (int) srcByte << " * " << srcGain << " gave " << (int) (uint8_t) dst[i]
+                          << " at " << i << " of " << n << ", expected " << (int) expected << std::endl;
+                failures++;
+                break;
+            }
+        }
+    }
+
+    return failures;
+}
+
+
+// Strided views against the same samples mixed contiguously, over more
+// than one gather block.
+template<typename T>
+static int checkStrided(MixKernels::Isa isa, const char* typeName, float dstGain, float srcGain) {
+    const uint64_t n = 2500;
+    const std::size_t stride = 3;
+    std::vector<T> dst(n), src(n), dstStrided(n * stride), srcStrided(n * stride);
+
+    for (uint64_t i = 0; i < n; i++) {
+        dst[i] = T((int) (i * 7919 % 20001) - 10000);
+        src[i] = T((int) (i * 104729 % 30001) - 15000);
+        dstStrided[i * stride + 1] = dst[i];
+        srcStrided[i * stride + 2] = src[i];
+    }
+
+    MixKernels::mix(dst.data(), src.data(), n, dstGain, srcGain);
+    MixKernels::mix(ChannelView<T>(&dstStrided[1], stride, n), ChannelView<T>(&srcStrided[2], stride, n),
+                    n, dstGain, srcGain);
+
+    for (uint64_t i = 0; i < n; i++) {
+        if ((int) dstStrided[i * stride + 1] != (int) dst[i]) {
+            std::cout << isaName(isa) << ": strided " << typeName << " * " << dstGain << " + " << srcGain
+                      << " gave " << (int) dstStrided[i * stride + 1] << " at " << i
+                      << ", expected " << (int) dst[i] << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+int main() {
+    int failures = 0;
+
+    for (int i = MixKernels::SCALAR_ISA; i <= MixKernels::getBestIsa(); i++) {
+        MixKernels::Isa isa = (MixKernels::Isa) i;
+        MixKernels::setIsa(isa);
+
+        // 8-bit samples are unsigned around 128: +0.3 and +0.2 make +0.5.
+        failures += checkInt8(isa, 166, 153, 1.f, 1.f, 191);
+        failures += checkInt8(isa, 90, 110, 1.f, 1.f, 72);
+        failures += checkInt8(isa, 128, 128, 1.f, 1.f, 128);
+        failures += checkInt8(isa, 250, 240, 1.f, 1.f, 255);
+        failures += checkInt8(isa, 10, 20, 1.f, 1.f, 0);
+
+        failures += checkInt8(isa, 166, 153, 0.5f, 0.25f, 153);
+        failures += checkInt8(isa, 128, 228, 0.5f, 0.5f, 178);
+        failures += checkInt8(isa, 255, 255, 2.f, 2.f, 255);
+        failures += checkInt8(isa, 0, 0, 2.f, 2.f, 0);
+
+        failures += checkStrided<int16_t>(isa, "int16", 1.f, 1.f);
+        failures += checkStrided<int16_t>(isa, "int16", 0.5f, 0.7f);
+        failures += checkStrided<Int24>(isa, "int24", 1.f, 1.f);
+        failures += checkStrided<Int24>(isa, "int24", 0.5f, 0.7f);
+    }
+
+    if (failures == 0) {
+        std::cout << "ok" << std::endl;
+    }
+
+    return failures;
+}
@@ -0,0 +1,270 @@
+// Overview pyramid against the samples it sums up: ranges at every scale and
+// offset, the profile of a view, and the sidecar WavFile writes and reads back.
+//
+//   srcs=$(find . -mindepth 2 -name '*.cpp' -not -path './Benchmark/*' -not -path './BatchRunner/*' -not -path './Tests/*')
+//   g++ -std=c++11 -O2 -I. -pthread Tests/OverviewTest.cpp $srcs -o overviewtest
+//   ./overviewtest
+//
+// Writes its files next to the test and removes them afterwards. Prints the
+// cases that fail; the exit status is the number of them.
+
+#include "Overview/Overview.h"
+#include "WavFile/WavFile.h"
+#include "WavStream/WavStream.h"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+
+
+static const char* WAV_PATH = "overviewtest.wav";
+static const uint16_t NUM_CHANNELS = 2;
+
+// A short block at the end, and levels that don't divide evenly.
+static const uint64_t NUM_FRAMES = Overview::BLOCK_FRAMES * 256 * 3 + 777;
+
+
+// Interleaved int16 samples, louder towards the end so that ranges differ.
+static std::vector<int16_t> makeSamples(uint64_t numFrames, uint32_t seed) {
+    std::vector<int16_t> samples(numFrames * NUM_CHANNELS);
+
+    for (uint64_t i = 0; i < samples.size(); i++) {
+        seed = seed * 1664525 + 1013904223;
+        double level = 0.1 + 0.9 * (double) (i / NUM_CHANNELS) / numFrames;
+        samples[i] = (int16_t) (((int) (seed >> 16) - 32768) * level);
+    }
+
+    return samples;
+}
+
+
+static std::vector<float> normalize(const std::vector<int16_t>& samples) {
+    std::vector<float> floats(samples.size());
+
+    for (std::size_t i = 0; i < samples.size(); i++) {
+        floats[i] = samples[i] * (1.f / 32768);
+    }
+
+    return floats;
+}
+
+
+// What summarize() has to give: the range widened to whole blocks, nothing
+// for a range that is empty or past the end.
+static Overview::Summary bruteForce(const std::vector<float>& frames, uint64_t numFrames, int channel,
+                                    uint64_t first, uint64_t count) {
+    Overview::Summary summary = { 0.f, 0.f, 0.f };
+    uint64_t from = first / Overview::BLOCK_FRAMES * Overview::BLOCK_FRAMES;
+    uint64_t last = std::min(numFrames, first + std::min(count, numFrames));
+    uint64_t to = std::min(numFrames, (last + Overview::BLOCK_FRAMES - 1) / Overview::BLOCK_FRAMES * Overview::BLOCK_FRAMES);
+    double squares = 0.;
+
+    if (first >= last) {
+        return summary;
+    }
+
+    summary.min = summary.max = frames[from * NUM_CHANNELS + channel];
+
+    for (uint64_t f = from; f < to; f++) {
+        float sample = frames[f * NUM_CHANNELS + channel];
+
+        summary.min = std::min(summary.min, sample);
+        summary.max = std::max(summary.max, sample);
+        squares += (double) sample * sample;
+    }
+
+    summary.rms = (float) std::sqrt(squares / (to - from));
+
+    return summary;
+}
+
+
+static bool same(const Overview::Summary& a, const Overview::Summary& b) {
+    return a.min == b.min && a.max == b.max && std::fabs(a.rms - b.rms) <= 1e-5f * std::max(b.rms, 1e-3f);
+}
+
+
+static int compare(const std::string& what, const Overview::Summary& got, const Overview::Summary& expected) {
+    if (same(got, expected)) {
+        return 0;
+    }
+
+    std::cout << what << ": min " << got.min << " max " << got.max << " rms " << got.rms
+              << ", expected min " << expected.min << " max " << expected.max
+              << " rms " << expected.rms << std::endl;
+    return 1;
+}
+
+
+// Ranges that start and end anywhere, from a frame to the whole file, and
+// ranges past the end.
+static int checkRanges(const std::string& name, const Overview& overview, const std::vector<float>& frames) {
+    uint64_t numFrames = overview.getNumFrames();
+    uint32_t seed = 7;
+    int failures = 0;
+
+    for (int i = 0; i < 3000 && failures < 10; i++) {
+        seed = seed * 1664525 + 1013904223;
+        uint64_t first = (seed >> 4) % (numFrames + 100);
+        seed = seed * 1664525 + 1013904223;
+        uint64_t count = i % 3 == 0 ? (seed >> 4) % 5000 : (seed >> 4) % (numFrames + 1);
+        int channel = i % NUM_CHANNELS;
+
+        failures += compare(name + ", channel " + std::to_string(channel) + " [" + std::to_string(first) +
+                            ", +" + std::to_string(count) + ")",
+                            overview.summarize(channel, first, count),
+                            bruteForce(frames, numFrames, channel, first, count));
+    }
+
+    failures += compare(name + ", whole file", overview.summarize(1, 0, UINT64_MAX),
+                        bruteForce(frames, numFrames, 1, 0, UINT64_MAX));
+
+    return failures;
+}
+
+
+// Blocks added out of order and in pieces of several blocks, as the
+// loading threads do.
+static int checkPyramid() {
+    std::vector<float> frames = normalize(makeSamples(NUM_FRAMES, 1));
+    Overview overview(NUM_CHANNELS, NUM_FRAMES);
+    const uint64_t piece = Overview::BLOCK_FRAMES * 5;
+    uint64_t numPieces = (NUM_FRAMES + piece - 1) / piece;
+    int failures = 0;
+
+    for (uint64_t start : { 1, 0 }) {
+        for (uint64_t p = start; p < numPieces; p += 2) {
+            uint64_t first = p * piece;
+            overview.addFrames(&frames[first * NUM_CHANNELS], first, std::min(piece, NUM_FRAMES - first));
+        }
+    }
+
+    overview.finish();
+
+    // 769 blocks, then 193, 49, 13, 4 and 1 entries.
+    if (overview.getNumLevels() != 6) {
+        std::cout << "pyramid: " << overview.getNumLevels() << " levels, expected 6" << std::endl;
+        failures++;
+    }
+
+    failures += checkRanges("pyramid", overview, frames);
+
+    // A profile point is the summary of its share of the range.
+    uint64_t first = 12345, count = NUM_FRAMES - 20000;
+    std::vector<Overview::Summary> points = overview.profile(0, first, count, 333);
+
+    for (uint64_t p = 0; p < points.size(); p++) {
+        uint64_t from = first + count * p / points.size();
+        uint64_t to = first + count * (p + 1) / points.size();
+
+        failures += compare("profile point " + std::to_string(p), points[p],
+                            bruteForce(frames, NUM_FRAMES, 0, from, to - from));
+    }
+
+    try {
+        overview.summarize(NUM_CHANNELS, 0, 1);
+        std::cout << "pyramid: channel " << NUM_CHANNELS << " didn't throw" << std::endl;
+        failures++;
+    } catch (const std::out_of_range&) {
+    }
+
+    // Within the short last block, but past the end or empty.
+    for (uint64_t at : { NUM_FRAMES, NUM_FRAMES + 100, NUM_FRAMES - 100 }) {
+        Overview::Summary empty = overview.summarize(0, at, at < NUM_FRAMES ? 0 : 1000);
+
+        if (empty.min != 0.f || empty.max != 0.f || empty.rms != 0.f) {
+            std::cout << "pyramid: an empty range at " << at << " isn't all zero" << std::endl;
+            failures++;
+        }
+    }
+
+    return failures;
+}
+
+
+static void writeWav(const std::vector<int16_t>& samples) {
+    WavFile::Header header;
+
+    header.audioFormat = RiffLayout::WAVE_FORMAT_PCM;
+    header.numChannels = NUM_CHANNELS;
+    header.sampleRate = 48000;
+    header.byteRate = 48000 * NUM_CHANNELS * 2;
+    header.blockAlign = NUM_CHANNELS * 2;
+    header.bitsPerSample = 16;
+
+    WavWriter writer(WAV_PATH, header, samples.size() / NUM_CHANNELS);
+    writer.writeBlock(samples);
+    writer.close();
+}
+
+
+// loadData() leaves a sidecar that loads back to the same levels and is
+// turned down once the file changes; getOverview() then rebuilds it.
+static int checkSidecar() {
+    std::vector<int16_t> samples = makeSamples(NUM_FRAMES, 2);
+    int failures = 0;
+
+    std::remove(Overview::getPath(WAV_PATH).c_str());
+    writeWav(samples);
+
+    {
+        WavFile file(WAV_PATH);
+        file.setOverviewBuilding(true);
+        file.loadData();
+    }
+
+    try {
+        Overview loaded = Overview::load(WAV_PATH);
+
+        if (!loaded.describes(WAV_PATH)) {
+            std::cout << "sidecar: doesn't describe the file it was made from" << std::endl;
+            failures++;
+        }
+
+        failures += checkRanges("sidecar", loaded, normalize(samples));
+    } catch (const BadOverviewException& e) {
+        std::cout << "sidecar: " << e.what() << std::endl;
+        return failures + 1;
+    }
+
+    // A different length, so the change shows even within the same second.
+    samples = makeSamples(NUM_FRAMES - 5000, 3);
+    writeWav(samples);
+
+    if (Overview::load(WAV_PATH).describes(WAV_PATH)) {
+        std::cout << "sidecar: still describes the rewritten file" << std::endl;
+        failures++;
+    }
+
+    WavFile file(WAV_PATH);
+    std::shared_ptr<const Overview> rebuilt = file.getOverview();
+
+    if (rebuilt->getNumFrames() != NUM_FRAMES - 5000 || !Overview::load(WAV_PATH).describes(WAV_PATH)) {
+        std::cout << "sidecar: not rebuilt for the rewritten file" << std::endl;
+        failures++;
+    }
+
+    failures += checkRanges("rebuilt", *rebuilt, normalize(samples));
+
+    return failures;
+}
+
+
+int main() {
+    int failures = 0;
+
+    failures += checkPyramid();
+    failures += checkSidecar();
+
+    std::remove(Overview::getPath(WAV_PATH).c_str());
+    std::remove(WAV_PATH);
+
+    if (failures == 0) {
+        std::cout << "ok" << std::endl;
+    }
+
+    return failures;
+}
@@ -0,0 +1,211 @@
+// Resampler on sines: output length, chunking, frequency and level in the
+// passband, rejection above the new Nyquist frequency, and ResampledReader
+// against the Resampler it wraps.
+//
+//   g++ -std=c++11 -O2 -I. Tests/ResamplerTest.cpp Resampler/Resampler.cpp MixKernels/MixKernels.cpp Pcm24/Pcm24.cpp -o resamplertest
+//   ./resamplertest
+//
+// Prints the cases that fail; the exit status is the number of them.
+
+#include "Resampler/Resampler.h"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+
+static const double PI = 3.14159265358979323846;
+
+static const uint32_t RATES[][2] = {
+    { 44100, 48000 }, { 48000, 44100 }, { 48000, 96000 }, { 96000, 48000 }, { 44100, 96000 }, { 96000, 44100 }
+};
+
+
+static const char* qualityName(Resampler::Quality quality) {
+    switch (quality) {
+        case Resampler::FAST_QUALITY:       return "fast";
+        case Resampler::STANDARD_QUALITY:   return "standard";
+        case Resampler::HIGH_QUALITY:       return "high";
+    }
+    return "";
+}
+
+
+static std::string caseName(uint32_t inRate, uint32_t outRate, Resampler::Quality quality) {
+    return std::to_string(inRate) + " -> " + std::to_string(outRate) + ", " + qualityName(quality);
+}
+
+
+static std::vector<float> sine(double frequency, uint32_t rate, uint64_t numFrames) {
+    std::vector<float> samples(numFrames);
+
+    for (uint64_t i = 0; i < numFrames; i++) {
+        samples[i] = (float) (0.5 * std::sin(2 * PI * frequency * i / rate));
+    }
+
+    return samples;
+}
+
+
+// All of src through one resampler, chunk frames at a time, and the flush.
+static std::vector<float> resample(Resampler resampler, const std::vector<float>& src, uint64_t chunk) {
+    std::vector<float> dst;
+    std::vector<float> out(resampler.getMaxOutput(chunk));
+
+    for (uint64_t first = 0; first < src.size(); first += chunk) {
+        uint64_t count = std::min<uint64_t>(chunk, src.size() - first);
+        uint64_t n = resampler.process(&src[first], count, out.data());
+        dst.insert(dst.end(), out.begin(), out.begin() + n);
+    }
+
+    out.resize(std::max<std::size_t>(out.size(), resampler.getTaps() + 1));
+    uint64_t n = resampler.flush(out.data());
+    dst.insert(dst.end(), out.begin(), out.begin() + n);
+
+    return dst;
+}
+
+
+// getOutputFrames() frames, the same whatever the chunk size.
+static int checkLength(uint32_t inRate, uint32_t outRate, Resampler::Quality quality) {
+    Resampler resampler(inRate, outRate, quality);
+    int failures = 0;
+
+    for (uint64_t numFrames : { 1, 2, 63, 1000, 44101 }) {
+        std::vector<float> src = sine(1000., inRate, numFrames);
+        std::vector<float> whole = resample(resampler, src, numFrames);
+        uint64_t expected = (numFrames * outRate + inRate - 1) / inRate;
+
+        if (resampler.getOutputFrames(numFrames) != expected || whole.size() != expected) {
+            std::cout << caseName(inRate, outRate, quality) << ": " << numFrames << " frames made "
+                      << whole.size() << ", expected " << expected << std::endl;
+            failures++;
+            continue;
+        }
+
+        for (uint64_t chunk : { 1, 7, 4096 }) {
+            if (resample(resampler, src, chunk) != whole) {
+                std::cout << caseName(inRate, outRate, quality) << ": " << numFrames
+                          << " frames in chunks of " << chunk << " differ" << std::endl;
+                failures++;
+            }
+        }
+    }
+
+    return failures;
+}
+
+
+// A 1 kHz sine comes out as the same sine at the new rate, in time with the
+// input, away from the edges.
+static int checkSine(uint32_t inRate, uint32_t outRate, Resampler::Quality quality, double tolerance) {
+    const double frequency = 1000.;
+    std::vector<float> dst = resample(Resampler(inRate, outRate, quality), sine(frequency, inRate, inRate / 2), 4096);
+    double worst = 0.;
+
+    for (uint64_t k = outRate / 100; k + outRate / 100 < dst.size(); k++) {
+        double expected = 0.5 * std::sin(2 * PI * frequency * k / outRate);
+        worst = std::max(worst, std::fabs(dst[k] - expected));
+    }
+
+    if (worst > tolerance) {
+        std::cout << caseName(inRate, outRate, quality) << ": 1 kHz sine off by " << worst
+                  << ", expected at most " << tolerance << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+// Downsampling: a sine between the two Nyquist frequencies is filtered out
+// rather than folded back into the band.
+static int checkRejection(uint32_t inRate, uint32_t outRate, Resampler::Quality quality, double tolerance) {
+    double frequency = 0.5 * (outRate / 2. + inRate / 2.);
+    std::vector<float> dst = resample(Resampler(inRate, outRate, quality), sine(frequency, inRate, inRate / 2), 4096);
+    double squares = 0.;
+    uint64_t count = 0;
+
+    for (uint64_t k = outRate / 100; k + outRate / 100 < dst.size(); k++, count++) {
+        squares += (double) dst[k] * dst[k];
+    }
+
+    double rms = std::sqrt(squares / count);
+
+    if (rms > tolerance) {
+        std::cout << caseName(inRate, outRate, quality) << ": " << frequency << " Hz left at RMS "
+                  << rms << ", expected at most " << tolerance << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+// ResampledReader hands out what the resampler makes, in whatever pieces.
+static int checkReader(uint32_t inRate, uint32_t outRate) {
+    Resampler resampler(inRate, outRate);
+    std::vector<float> src = sine(440., inRate, 50000);
+    std::vector<float> expected = resample(resampler, src, src.size());
+    uint64_t fetched = 0;
+    bool inOrder = true;
+
+    ResampledReader reader(resampler, src.size(), [&](float* dst, uint64_t first, uint64_t numFrames) {
+        inOrder &= first == fetched;
+        fetched = first + numFrames;
+
+        for (uint64_t i = 0; i < numFrames; i++) {
+            dst[i] = first + i < src.size() ? src[first + i] : 0.f;
+        }
+    });
+
+    std::vector<float> got, piece(5000);
+
+    for (uint64_t n = 1; ; n = n * 3 % 4999 + 1) {
+        uint64_t count = reader.read(piece.data(), n);
+        got.insert(got.end(), piece.begin(), piece.begin() + count);
+
+        if (count < n) {
+            break;
+        }
+    }
+
+    if (!inOrder || reader.getNumFrames() != expected.size() || got != expected) {
+        std::cout << inRate << " -> " << outRate << ": ResampledReader gave " << got.size()
+                  << " frames, " << (inOrder ? "" : "fetched out of order, ")
+                  << "expected the resampler's " << expected.size() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+int main() {
+    const double SINE_TOLERANCE[] = { 5e-4, 1e-4, 1e-5 };
+    const double REJECTION_TOLERANCE[] = { 5e-4, 5e-5, 1e-5 };
+    int failures = 0;
+
+    for (const uint32_t* rates : RATES) {
+        for (int q = Resampler::FAST_QUALITY; q <= Resampler::HIGH_QUALITY; q++) {
+            Resampler::Quality quality = (Resampler::Quality) q;
+
+            failures += checkLength(rates[0], rates[1], quality);
+            failures += checkSine(rates[0], rates[1], quality, SINE_TOLERANCE[q]);
+
+            if (rates[1] < rates[0]) {
+                failures += checkRejection(rates[0], rates[1], quality, REJECTION_TOLERANCE[q]);
+            }
+        }
+
+        failures += checkReader(rates[0], rates[1]);
+    }
+
+    if (failures == 0) {
+        std::cout << "ok" << std::endl;
+    }
+
+    return failures;
+}
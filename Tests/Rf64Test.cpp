@@ -0,0 +1,313 @@
+// RF64 both ways: a data chunk past 4 GiB written through RiffLayout and read
+// back mapped, lazily and by WavReader, and a small RF64 file with a ds64
+// chunk and a trailing chunk loaded, saved and loaded again.
+//
+//   srcs=$(find . -mindepth 2 -name '*.cpp' -not -path './Benchmark/*' -not -path './BatchRunner/*' -not -path './Tests/*')
+//   g++ -std=c++11 -O2 -I. -pthread Tests/Rf64Test.cpp $srcs -o rf64test
+//   ./rf64test
+//
+// Writes its files next to the test and removes them afterwards. The large
+// one is sparse: only its ends are written, so it needs a file system that
+// supports holes. Prints the cases that fail; the exit status is the number
+// of them.
+
+#include "WavFile/WavFile.h"
+#include "WavStream/WavStream.h"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+
+static const char* LARGE_PATH = "rf64test-large.wav";
+static const char* SMALL_PATH = "rf64test-small.wav";
+static const char* SAVED_PATH = "rf64test-saved.wav";
+static const uint16_t NUM_CHANNELS = 2;
+static const uint64_t FRAME_SIZE = NUM_CHANNELS * 2;
+
+// 16-bit stereo, 5 GiB of data; only the first and last EDGE_FRAMES are written.
+static const uint64_t LARGE_FRAMES = (5ull << 30) / FRAME_SIZE;
+static const uint64_t EDGE_FRAMES = 100000;
+static const uint64_t SMALL_FRAMES = 30000;
+
+// An INFO list with the software name in it, 18 bytes.
+static const std::string LIST_BODY("INFOISFT\x06\0\0\0rf64t\0", 18);
+
+
+static void put16(std::ostream& os, uint16_t value) { os.write((const char*) &value, 2); }
+static void put32(std::ostream& os, uint32_t value) { os.write((const char*) &value, 4); }
+static void put64(std::ostream& os, uint64_t value) { os.write((const char*) &value, 8); }
+
+
+static std::vector<char> formatChunk() {
+    std::ostringstream fmt;
+
+    put16(fmt, RiffLayout::WAVE_FORMAT_PCM);
+    put16(fmt, NUM_CHANNELS);
+    put32(fmt, 48000);
+    put32(fmt, 48000 * FRAME_SIZE);
+    put16(fmt, FRAME_SIZE);
+    put16(fmt, 16);
+
+    std::string bytes = fmt.str();
+    return std::vector<char>(bytes.begin(), bytes.end());
+}
+
+
+// Sample c of frame f, different on every frame and channel.
+static int16_t sampleAt(uint64_t f, uint16_t c) {
+    return (int16_t) ((f * 7919 + c * 104729) % 65536 - 32768);
+}
+
+
+static std::vector<int16_t> makeFrames(uint64_t first, uint64_t numFrames) {
+    std::vector<int16_t> samples(numFrames * NUM_CHANNELS);
+
+    for (uint64_t f = 0; f < numFrames; f++) {
+        for (uint16_t c = 0; c < NUM_CHANNELS; c++) {
+            samples[f * NUM_CHANNELS + c] = sampleAt(first + f, c);
+        }
+    }
+
+    return samples;
+}
+
+
+// The way WavWriter does it, with a seek over everything but the ends.
+static uint64_t writeLarge() {
+    std::ofstream ofs(LARGE_PATH, std::ios::out|std::ios::binary|std::ios::trunc);
+    RiffLayout layout;
+    RiffLayout::Placement placement = layout.writeHead(ofs, formatChunk());
+    uint64_t dataOffset = (uint64_t) ofs.tellp();
+    std::vector<int16_t> edge = makeFrames(0, EDGE_FRAMES);
+
+    ofs.seekp(std::streampos(dataOffset));
+    ofs.write((const char*) edge.data(), edge.size() * 2);
+
+    edge = makeFrames(LARGE_FRAMES - EDGE_FRAMES, EDGE_FRAMES);
+    ofs.seekp(std::streampos(dataOffset + (LARGE_FRAMES - EDGE_FRAMES) * FRAME_SIZE));
+    ofs.write((const char*) edge.data(), edge.size() * 2);
+
+    layout.writeTail(ofs, placement, LARGE_FRAMES * FRAME_SIZE, LARGE_FRAMES);
+    ofs.close();
+
+    return ofs ? dataOffset : 0;
+}
+
+
+// Frames [first, first + count) of a sample accessor against sampleAt().
+template<typename Sample>
+static int checkFrames(const std::string& what, uint64_t first, uint64_t count, Sample sample) {
+    for (uint64_t f = first; f < first + count; f++) {
+        for (uint16_t c = 0; c < NUM_CHANNELS; c++) {
+            if (sample(f, c) != sampleAt(f, c)) {
+                std::cout << what << ": frame " << f << " channel " << c << " is " << sample(f, c)
+                          << ", expected " << sampleAt(f, c) << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+static int checkLarge() {
+    int failures = 0;
+
+    uint64_t dataOffset = writeLarge();
+
+    if (dataOffset == 0) {
+        std::cout << "large: can't write " << LARGE_PATH << std::endl;
+        return 1;
+    }
+
+    {
+        std::ifstream ifs(LARGE_PATH, std::ios::in|std::ios::binary);
+        char head[16];
+        ifs.read(head, sizeof (head));
+
+        if (memcmp(head, "RF64", 4) != 0 || memcmp(head + 4, "\xFF\xFF\xFF\xFF", 4) != 0 ||
+            memcmp(head + 12, "ds64", 4) != 0) {
+            std::cout << "large: no RF64 header with a ds64 chunk" << std::endl;
+            return failures + 1;
+        }
+    }
+
+    WavFile file(LARGE_PATH);
+
+    if (!file.getLayout().isRf64() || file.getDataOffset() != dataOffset ||
+        file.getDataSize() != LARGE_FRAMES * FRAME_SIZE || file.getNumFrames() != LARGE_FRAMES) {
+        std::cout << "large: " << file.getNumFrames() << " frames in " << file.getDataSize()
+                  << " bytes at " << file.getDataOffset() << ", expected " << LARGE_FRAMES
+                  << " frames at " << dataOffset << std::endl;
+        return failures + 1;
+    }
+
+    file.mapData();
+    InterleavedView<int16_t> mapped = file.getMappedInt16Data();
+    auto mappedSample = [&](uint64_t f, uint16_t c) { return mapped(f, c); };
+
+    failures += checkFrames("large, mapped start", 0, EDGE_FRAMES, mappedSample);
+    failures += checkFrames("large, mapped end", LARGE_FRAMES - EDGE_FRAMES, EDGE_FRAMES, mappedSample);
+
+    // Only the blocks at the end are decoded.
+    WavFile lazy(LARGE_PATH);
+    lazy.setStorageLayout(WavFile::LAZY_STORAGE);
+    lazy.loadData();
+
+    uint64_t first = LARGE_FRAMES - EDGE_FRAMES / 2;
+    WavFile::Data_i16 range = lazy.getInt16Range(first, EDGE_FRAMES);
+
+    if (range.size() != NUM_CHANNELS || range[0].size() != EDGE_FRAMES / 2) {
+        std::cout << "large, lazy: the range at the end isn't cut short" << std::endl;
+        failures++;
+    } else {
+        failures += checkFrames("large, lazy end", first, EDGE_FRAMES / 2,
+                                [&](uint64_t f, uint16_t c) { return range[c][f - first]; });
+    }
+
+    WavReader reader(LARGE_PATH);
+    std::vector<int16_t> block;
+    reader.readBlock(block, EDGE_FRAMES);
+
+    if (reader.getNumFrames() != LARGE_FRAMES) {
+        std::cout << "large, reader: " << reader.getNumFrames() << " frames, expected "
+                  << LARGE_FRAMES << std::endl;
+        failures++;
+    }
+
+    failures += checkFrames("large, reader start", 0, EDGE_FRAMES,
+                            [&](uint64_t f, uint16_t c) { return block[f * NUM_CHANNELS + c]; });
+
+    return failures;
+}
+
+
+// RF64 with the 32-bit sizes left at ~0 and the real ones in ds64, and a
+// LIST chunk after the data.
+static void writeSmall() {
+    std::ofstream ofs(SMALL_PATH, std::ios::out|std::ios::binary|std::ios::trunc);
+    std::vector<char> format = formatChunk();
+    std::vector<int16_t> samples = makeFrames(0, SMALL_FRAMES);
+    uint64_t dataSize = SMALL_FRAMES * FRAME_SIZE;
+    uint64_t riffSize = 4 + 36 + 8 + format.size() + 8 + dataSize + 8 + LIST_BODY.size();
+
+    ofs.write("RF64", 4);
+    put32(ofs, 0xFFFFFFFF);
+    ofs.write("WAVE", 4);
+
+    ofs.write("ds64", 4);
+    put32(ofs, 28);
+    put64(ofs, riffSize);
+    put64(ofs, dataSize);
+    put64(ofs, SMALL_FRAMES);
+    put32(ofs, 0);
+
+    ofs.write("fmt ", 4);
+    put32(ofs, format.size());
+    ofs.write(format.data(), format.size());
+
+    ofs.write("data", 4);
+    put32(ofs, 0xFFFFFFFF);
+    ofs.write((const char*) samples.data(), dataSize);
+
+    ofs.write("LIST", 4);
+    put32(ofs, LIST_BODY.size());
+    ofs.write(LIST_BODY.data(), LIST_BODY.size());
+}
+
+
+static std::string readChunk(const std::string& path, const RiffLayout::Chunk& chunk) {
+    std::ifstream ifs(path, std::ios::in|std::ios::binary);
+    std::string body(chunk.size, '\0');
+
+    ifs.seekg(std::streampos(chunk.offset));
+    ifs.read(&body[0], body.size());
+
+    return body;
+}
+
+
+// The samples of a loaded file, and the LIST chunk carried along after them.
+static int checkSmallFile(const std::string& what, const std::string& path) {
+    WavFile file(path);
+    file.loadData();
+
+    if (file.getNumFrames() != SMALL_FRAMES || file.getDataSize() != SMALL_FRAMES * FRAME_SIZE) {
+        std::cout << what << ": " << file.getNumFrames() << " frames, expected " << SMALL_FRAMES << std::endl;
+        return 1;
+    }
+
+    const std::vector<RiffLayout::Chunk>& trailing = file.getLayout().getTrailingChunks();
+
+    if (trailing.size() != 1 || memcmp(trailing[0].id, "LIST", 4) != 0 ||
+        readChunk(path, trailing[0]) != LIST_BODY) {
+        std::cout << what << ": the LIST chunk after the data is lost" << std::endl;
+        return 1;
+    }
+
+    WavFile::Data_i16 data = file.getInt16Data();
+
+    return checkFrames(what, 0, SMALL_FRAMES, [&](uint64_t f, uint16_t c) { return data[c][f]; });
+}
+
+
+// Saved again, a file this small fits RIFF and comes back as one.
+static int checkSmall() {
+    int failures = 0;
+
+    writeSmall();
+
+    {
+        WavFile file(SMALL_PATH);
+
+        if (!file.getLayout().isRf64()) {
+            std::cout << "small: not read as RF64" << std::endl;
+            failures++;
+        }
+    }
+
+    failures += checkSmallFile("small", SMALL_PATH);
+
+    {
+        WavFile file(SMALL_PATH);
+        file.loadData();
+        file.save(SAVED_PATH);
+    }
+
+    {
+        WavFile saved(SAVED_PATH);
+
+        if (saved.getLayout().isRf64()) {
+            std::cout << "small, saved: still RF64" << std::endl;
+            failures++;
+        }
+    }
+
+    failures += checkSmallFile("small, saved", SAVED_PATH);
+
+    return failures;
+}
+
+
+int main() {
+    int failures = 0;
+
+    failures += checkSmall();
+    failures += checkLarge();
+
+    std::remove(LARGE_PATH);
+    std::remove(SMALL_PATH);
+    std::remove(SAVED_PATH);
+
+    if (failures == 0) {
+        std::cout << "ok" << std::endl;
+    }
+
+    return failures;
+}
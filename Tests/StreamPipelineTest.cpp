@@ -0,0 +1,277 @@
+// StreamPipeline against the same operations on loaded WavFiles: mixWith()
+// at the same and at another sample rate, addMonoFrom() and overVoice() for
+// every sample format they take, a chain of all three, small odd blocks,
+// and saving over the input. The samples written must be the same bytes.
+//
+//   srcs=$(find . -mindepth 2 -name '*.cpp' -not -path './Benchmark/*' -not -path './BatchRunner/*' -not -path './Tests/*')
+//   g++ -std=c++11 -O2 -I. -pthread Tests/StreamPipelineTest.cpp $srcs -o streampipelinetest
+//   ./streampipelinetest
+//
+// Writes its files next to the test and removes them afterwards. Prints the
+// cases that fail; the exit status is the number of them.
+
+#include "WavFile/WavFile.h"
+#include "WavStream/WavStream.h"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+
+static const char* PROGRAM_PATH = "streampipelinetest-program.wav";
+static const char* OTHER_PATH = "streampipelinetest-other.wav";
+static const char* MONO_PATH = "streampipelinetest-mono.wav";
+static const char* VOICE_PATH = "streampipelinetest-voice.wav";
+static const char* LOADED_PATH = "streampipelinetest-loaded.wav";
+static const char* STREAMED_PATH = "streampipelinetest-streamed.wav";
+
+static const uint32_t SAMPLE_RATE = 48000;
+static const uint64_t NUM_FRAMES = 300000;
+static const uint64_t BLOCK_FRAMES[] = { StreamPipeline::DEFAULT_BLOCK_FRAMES, 777 };
+static const double PI = 3.14159265358979323846;
+
+
+// A loud sine with some noise, so that mixes clip. The voice gets quiet
+// stretches for overVoice() to release in.
+static void writeWav(const char* path, uint16_t bitsPerSample, uint16_t numChannels, uint32_t sampleRate,
+                     uint64_t numFrames, double frequency, bool bursts = false) {
+    WavFile::Header header;
+    uint16_t sampleSize = bitsPerSample / 8;
+    std::vector<char> bytes(numFrames * numChannels * sampleSize);
+    uint32_t seed = (uint32_t) frequency;
+    char* p = bytes.data();
+
+    header.audioFormat = bitsPerSample == 32 ? RiffLayout::WAVE_FORMAT_IEEE_FLOAT : RiffLayout::WAVE_FORMAT_PCM;
+    header.numChannels = numChannels;
+    header.sampleRate = sampleRate;
+    header.byteRate = sampleRate * numChannels * sampleSize;
+    header.blockAlign = numChannels * sampleSize;
+    header.bitsPerSample = bitsPerSample;
+
+    for (uint64_t f = 0; f < numFrames; f++) {
+        for (uint16_t c = 0; c < numChannels; c++) {
+            seed = seed * 1664525 + 1013904223;
+            double noise = ((int) (seed >> 16) - 32768) / 327680.;
+            double value = 0.8 * std::sin(2 * PI * frequency * (c + 1) * f / sampleRate) + noise;
+
+            if (bursts && (f / 30000) % 2 == 1) {
+                value = 0.;
+            }
+
+            if (bitsPerSample == 8) {
+                *p = (char) (uint8_t) (128 + (int) (value * 127));
+            } else if (bitsPerSample == 16) {
+                int16_t sample = (int16_t) (value * 32767);
+                memcpy(p, &sample, 2);
+            } else if (bitsPerSample == 24) {
+                int32_t sample = (int32_t) (value * 8388607);
+                memcpy(p, &sample, 3);
+            } else {
+                float sample = (float) value;
+                memcpy(p, &sample, 4);
+            }
+
+            p += sampleSize;
+        }
+    }
+
+    WavWriter writer(path, header, numFrames);
+    writer.writeFrames(bytes.data(), numFrames);
+    writer.close();
+}
+
+
+static std::vector<char> readSamples(const char* path) {
+    WavReader reader(path);
+    std::vector<char> bytes(reader.getNumFrames() * reader.getHeader().blockAlign);
+
+    reader.readFrames(bytes.data(), reader.getNumFrames());
+
+    return bytes;
+}
+
+
+// Loaded and worked on by loaded(), saved, then the same through a pipeline.
+static int compare(const std::string& what, const std::function<void(WavFile&)>& loaded,
+                   const std::function<void(StreamPipeline&)>& streamed) {
+    int failures = 0;
+
+    {
+        WavFile file(PROGRAM_PATH);
+        file.loadData();
+        loaded(file);
+        file.save(LOADED_PATH);
+    }
+
+    std::vector<char> expected = readSamples(LOADED_PATH);
+
+    if (expected == readSamples(PROGRAM_PATH)) {
+        std::cout << what << ": the loaded file didn't change" << std::endl;
+        failures++;
+    }
+
+    for (uint64_t blockFrames : BLOCK_FRAMES) {
+        StreamPipeline pipeline(PROGRAM_PATH, blockFrames);
+        streamed(pipeline);
+        pipeline.save(STREAMED_PATH);
+
+        std::vector<char> got = readSamples(STREAMED_PATH);
+
+        if (got != expected) {
+            std::size_t at = std::mismatch(got.begin(), got.begin() + std::min(got.size(), expected.size()),
+                                           expected.begin()).first - got.begin();
+
+            std::cout << what << ", blocks of " << blockFrames << ": " << got.size() << " bytes, expected "
+                      << expected.size() << ", first difference at byte " << at << std::endl;
+            failures++;
+        }
+    }
+
+    return failures;
+}
+
+
+static WavFile loadFile(const char* path) {
+    WavFile file(path);
+    file.loadData();
+    return file;
+}
+
+
+static int checkMix(uint16_t bitsPerSample) {
+    std::string name = std::to_string(bitsPerSample) + "-bit mix";
+    int failures = 0;
+
+    writeWav(PROGRAM_PATH, bitsPerSample, 2, SAMPLE_RATE, NUM_FRAMES, 440);
+    writeWav(OTHER_PATH, bitsPerSample, 2, SAMPLE_RATE, NUM_FRAMES / 2, 660);
+
+    failures += compare(name,
+                        [](WavFile& file) { WavFile other = loadFile(OTHER_PATH); file.mixWith(other); },
+                        [](StreamPipeline& pipeline) { pipeline.mixWith(OTHER_PATH); });
+    failures += compare(name + ", delayed, with gains",
+                        [](WavFile& file) { WavFile other = loadFile(OTHER_PATH); file.mixWith(other, 12345, 0.6f, 0.8f); },
+                        [](StreamPipeline& pipeline) { pipeline.mixWith(OTHER_PATH, 12345, 0.6f, 0.8f); });
+
+    // Runs past the end of the program.
+    failures += compare(name + ", delayed to the end",
+                        [](WavFile& file) { WavFile other = loadFile(OTHER_PATH); file.mixWith(other, NUM_FRAMES - 1000); },
+                        [](StreamPipeline& pipeline) { pipeline.mixWith(OTHER_PATH, NUM_FRAMES - 1000); });
+
+    writeWav(OTHER_PATH, bitsPerSample, 2, 44100, NUM_FRAMES / 2, 660);
+
+    failures += compare(name + ", resampled from 44.1 kHz",
+                        [](WavFile& file) { WavFile other = loadFile(OTHER_PATH); file.mixWith(other, 777, 0.9f, 0.5f); },
+                        [](StreamPipeline& pipeline) { pipeline.mixWith(OTHER_PATH, 777, 0.9f, 0.5f); });
+
+    return failures;
+}
+
+
+static int checkAddMono(uint16_t bitsPerSample) {
+    std::string name = std::to_string(bitsPerSample) + "-bit addMonoFrom";
+
+    writeWav(PROGRAM_PATH, bitsPerSample, 2, SAMPLE_RATE, NUM_FRAMES, 440);
+    writeWav(MONO_PATH, bitsPerSample, 1, SAMPLE_RATE, NUM_FRAMES, 550);
+
+    return compare(name,
+                   [](WavFile& file) { WavFile mono = loadFile(MONO_PATH); file.addMonoFrom(mono); },
+                   [](StreamPipeline& pipeline) { pipeline.addMonoFrom(MONO_PATH); });
+}
+
+
+static int checkOverVoice(uint16_t bitsPerSample, uint16_t numChannels, uint32_t voiceRate) {
+    std::string name = std::to_string(bitsPerSample) + "-bit overVoice, " + std::to_string(numChannels) +
+                       " channels, voice at " + std::to_string(voiceRate);
+
+    writeWav(PROGRAM_PATH, bitsPerSample, numChannels, SAMPLE_RATE, NUM_FRAMES, 440);
+    writeWav(VOICE_PATH, bitsPerSample, numChannels, voiceRate, NUM_FRAMES * 2 / 3, 300, true);
+
+    return compare(name,
+                   [](WavFile& file) { WavFile voice = loadFile(VOICE_PATH); file.overVoice(voice, 0.05, 0.3, 0.2, -30, 12); },
+                   [](StreamPipeline& pipeline) { pipeline.overVoice(VOICE_PATH, 0.05, 0.3, 0.2, -30, 12); });
+}
+
+
+// All three in one pass, the ducking stage in the middle holding frames back.
+static int checkChain(uint16_t bitsPerSample) {
+    std::string name = std::to_string(bitsPerSample) + "-bit chain";
+
+    writeWav(PROGRAM_PATH, bitsPerSample, 2, SAMPLE_RATE, NUM_FRAMES, 440);
+    writeWav(OTHER_PATH, bitsPerSample, 2, 44100, NUM_FRAMES / 2, 660);
+    writeWav(MONO_PATH, bitsPerSample, 1, SAMPLE_RATE, NUM_FRAMES, 550);
+    writeWav(VOICE_PATH, bitsPerSample, 2, SAMPLE_RATE, NUM_FRAMES / 2, 300, true);
+
+    return compare(name,
+                   [](WavFile& file) {
+                       WavFile other = loadFile(OTHER_PATH), voice = loadFile(VOICE_PATH), mono = loadFile(MONO_PATH);
+                       file.mixWith(other, 5000, 0.5f, 0.7f);
+                       file.overVoice(voice, 0.05, 0.3, 0.2, -30, 12);
+                       file.addMonoFrom(mono);
+                   },
+                   [](StreamPipeline& pipeline) {
+                       pipeline.mixWith(OTHER_PATH, 5000, 0.5f, 0.7f)
+                               .overVoice(VOICE_PATH, 0.05, 0.3, 0.2, -30, 12)
+                               .addMonoFrom(MONO_PATH);
+                   });
+}
+
+
+// save() without a path writes over the input it is still reading.
+static int checkInPlace() {
+    writeWav(PROGRAM_PATH, 16, 2, SAMPLE_RATE, NUM_FRAMES, 440);
+    writeWav(OTHER_PATH, 16, 2, SAMPLE_RATE, NUM_FRAMES / 2, 660);
+
+    {
+        WavFile file(PROGRAM_PATH), other(OTHER_PATH);
+        file.loadData();
+        other.loadData();
+        file.mixWith(other, 999);
+        file.save(LOADED_PATH);
+    }
+
+    StreamPipeline(PROGRAM_PATH, 777).mixWith(OTHER_PATH, 999).save("");
+
+    if (readSamples(PROGRAM_PATH) != readSamples(LOADED_PATH)) {
+        std::cout << "in place: differs from the loaded mix" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+int main() {
+    int failures = 0;
+
+    for (uint16_t bitsPerSample : { 8, 16, 24, 32 }) {
+        failures += checkMix(bitsPerSample);
+        failures += checkAddMono(bitsPerSample);
+    }
+
+    for (uint16_t bitsPerSample : { 16, 24, 32 }) {
+        failures += checkChain(bitsPerSample);
+
+        for (uint16_t numChannels : { 1, 2 }) {
+            for (uint32_t voiceRate : { SAMPLE_RATE, 44100u }) {
+                failures += checkOverVoice(bitsPerSample, numChannels, voiceRate);
+            }
+        }
+    }
+
+    failures += checkInPlace();
+
+    for (const char* path : { PROGRAM_PATH, OTHER_PATH, MONO_PATH, VOICE_PATH, LOADED_PATH, STREAMED_PATH }) {
+        std::remove(path);
+    }
+
+    if (failures == 0) {
+        std::cout << "ok" << std::endl;
+    }
+
+    return failures;
+}
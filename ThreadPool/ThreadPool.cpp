@@ -0,0 +1,211 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+
+// Set while a thread runs bodies, so nested loops stay on that thread.
+static thread_local bool insidePool = false;
+
+static std::mutex sharedMutex;
+static std::unique_ptr<ThreadPool> sharedPool;
+
+
+ThreadPool::ThreadPool(unsigned numThreads):
+    _generation(0),
+    _busy(0),
+    _stop(false),
+    _body(nullptr)
+{
+    if (numThreads == 0) {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (unsigned i = 0; i < numThreads; i++) {
+        _runs.emplace_back(new Run());
+        _runs.back()->begin = 0;
+        _runs.back()->end = 0;
+    }
+
+    for (unsigned i = 0; i + 1 < numThreads; i++) {
+        _threads.emplace_back(&ThreadPool::_worker, this, i);
+    }
+}
+
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+
+    for (std::thread& thread : _threads) {
+        thread.join();
+    }
+}
+
+
+void ThreadPool::parallelFor(uint64_t count, const std::function<void(uint64_t)>& body) {
+    if (count == 0) {
+        return;
+    }
+
+    if (insidePool || _threads.empty() || count == 1) {
+        for (uint64_t i = 0; i < count; i++) {
+            body(i);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> job(_jobMutex);
+    uint64_t numRuns = _runs.size();
+
+    for (uint64_t k = 0; k < numRuns; k++) {
+        std::lock_guard<std::mutex> lock(_runs[k]->mutex);
+        _runs[k]->begin = count * k / numRuns;
+        _runs[k]->end = count * (k + 1) / numRuns;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _body = &body;
+        _error = nullptr;
+        _generation++;
+    }
+    _wake.notify_all();
+
+    insidePool = true;
+    _participate((unsigned) numRuns - 1, body);
+    insidePool = false;
+
+    // Once the caller finds nothing left to take, only bodies already
+    // running on workers are outstanding.
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _idle.wait(lock, [this] { return _busy == 0; });
+        _body = nullptr;
+        error = _error;
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+
+void ThreadPool::parallelRanges(uint64_t numItems, uint64_t minRange,
+                                const std::function<void(uint64_t, uint64_t)>& body) {
+    uint64_t numRanges = std::min<uint64_t>(std::max<uint64_t>(1, numItems / std::max<uint64_t>(1, minRange)),
+                                            getNumThreads() * 4);
+
+    if (numItems == 0) {
+        return;
+    }
+
+    parallelFor(numRanges, [&](uint64_t r) {
+        body(numItems * r / numRanges, numItems * (r + 1) / numRanges);
+    });
+}
+
+
+ThreadPool& ThreadPool::shared() {
+    std::lock_guard<std::mutex> lock(sharedMutex);
+
+    if (!sharedPool) {
+        sharedPool.reset(new ThreadPool());
+    }
+    return *sharedPool;
+}
+
+
+void ThreadPool::setSharedThreads(unsigned numThreads) {
+    std::lock_guard<std::mutex> lock(sharedMutex);
+    sharedPool.reset(new ThreadPool(numThreads));
+}
+
+
+void ThreadPool::_worker(unsigned index) {
+    uint64_t seen = 0;
+
+    insidePool = true;
+
+    for (;;) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _wake.wait(lock, [&] { return _stop || _generation != seen; });
+
+        if (_stop) {
+            return;
+        }
+
+        // A late wake-up for a loop that has already finished finds no body.
+        const std::function<void(uint64_t)>* body = _body;
+        seen = _generation;
+        if (body == nullptr) {
+            continue;
+        }
+
+        _busy++;
+        lock.unlock();
+
+        _participate(index, *body);
+
+        lock.lock();
+        if (--_busy == 0) {
+            _idle.notify_all();
+        }
+    }
+}
+
+
+void ThreadPool::_participate(unsigned index, const std::function<void(uint64_t)>& body) {
+    uint64_t item;
+
+    while (_take(index, item)) {
+        try {
+            body(item);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_error) {
+                _error = std::current_exception();
+            }
+        }
+    }
+}
+
+
+bool ThreadPool::_take(unsigned index, uint64_t& item) {
+    Run& own = *_runs[index];
+
+    {
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (own.begin < own.end) {
+            item = own.begin++;
+            return true;
+        }
+    }
+
+    // Steal the back half of the first run that still has work.
+    for (std::size_t k = 1; k < _runs.size(); k++) {
+        Run& victim = *_runs[(index + k) % _runs.size()];
+        uint64_t first, last;
+
+        {
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.begin >= victim.end) {
+                continue;
+            }
+
+            last = victim.end;
+            first = victim.end - (victim.end - victim.begin + 1) / 2;
+            victim.end = first;
+        }
+
+        std::lock_guard<std::mutex> lock(own.mutex);
+        own.begin = first + 1;
+        own.end = last;
+        item = first;
+        return true;
+    }
+
+    return false;
+}
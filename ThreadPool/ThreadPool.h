@@ -0,0 +1,73 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+
+// Fixed set of worker threads for data-parallel loops. parallelFor() deals
+// the indices out in contiguous runs, one per thread (the calling thread
+// included); a thread that runs dry steals half of what is left in another
+// thread's run. Which thread runs an index is not deterministic, so bodies
+// must write disjoint data; the result then doesn't depend on scheduling.
+//
+// A parallelFor() issued from inside a body runs serially on that thread.
+class ThreadPool {
+    public:
+        // 0 means one thread per hardware thread, counting the caller.
+        explicit ThreadPool(unsigned numThreads = 0);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator =(const ThreadPool&) = delete;
+
+        unsigned    getNumThreads() const { return (unsigned) _threads.size() + 1; }
+
+        // Runs body(i) for every i in [0, count) and returns once all are
+        // done. The first exception thrown by a body is rethrown here.
+        void    parallelFor(uint64_t count, const std::function<void(uint64_t)>& body);
+
+        // Splits [0, numItems) into ranges of at least minRange items, a few
+        // per thread, and runs body(first, last) on each.
+        void    parallelRanges(uint64_t numItems, uint64_t minRange,
+                               const std::function<void(uint64_t, uint64_t)>& body);
+
+        // Pool used by WavFile and the streaming stages.
+        static ThreadPool&  shared();
+        static void         setSharedThreads(unsigned numThreads);
+
+    private:
+        struct Run {
+            std::mutex  mutex;
+            uint64_t    begin;
+            uint64_t    end;
+        };
+
+        std::vector<std::thread>            _threads;
+        std::vector<std::unique_ptr<Run>>   _runs;      // one per thread, the caller's last
+
+        std::mutex                  _jobMutex;          // one parallelFor() at a time
+        std::mutex                  _mutex;
+        std::condition_variable     _wake;
+        std::condition_variable     _idle;
+        uint64_t                    _generation;
+        unsigned                    _busy;
+        bool                        _stop;
+
+        const std::function<void(uint64_t)>*    _body;
+        std::exception_ptr                      _error;
+
+        void    _worker(unsigned index);
+        void    _participate(unsigned index, const std::function<void(uint64_t)>& body);
+        bool    _take(unsigned index, uint64_t& item);
+};
+
+
+#endif // THREADPOOL_H
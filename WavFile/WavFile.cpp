@@ -1,619 +1,2014 @@
 #include "WavFile.h"
+#include "MixKernels/MixKernels.h"
+#include "DuckingEngine/DuckingEngine.h"
+#include "ThreadPool/ThreadPool.h"
+#include "MixBus/MixBus.h"
+#include "AsyncWriter/AsyncWriter.h"
+#include "Pcm24/Pcm24.h"
+#include "FrameKernels/FrameKernels.h"
 #include <iostream>
 #include <algorithm>
 #include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <type_traits>
 
 
-WavFile::WavFile(const std::string& filePath) throw (FileNotExistException):
-    _filePath(filePath)
+const uint64_t WavFile::OVERVOICE_PREROLL;
+const uint64_t WavFile::CACHE_BLOCK_FRAMES;
+const uint64_t WavFile::DEFAULT_CACHE_SIZE;
+const uint64_t WavFile::MIN_RANGE_FRAMES;
+
+
+template<> WavFile::Data_i8& WavFile::_vectors<int8_t>() { return _int8_data; }
+template<> WavFile::Data_i16& WavFile::_vectors<int16_t>() { return _int16_data; }
+template<> WavFile::Data_i24& WavFile::_vectors<Int24>() { return _int24_data; }
+template<> WavFile::Data_f32& WavFile::_vectors<float>() { return _flt32_data; }
+
+template<> SampleBuffer<int8_t>& WavFile::_buffer<int8_t>() { return _int8_buffer; }
+template<> SampleBuffer<int16_t>& WavFile::_buffer<int16_t>() { return _int16_buffer; }
+template<> SampleBuffer<Int24>& WavFile::_buffer<Int24>() { return _int24_buffer; }
+template<> SampleBuffer<float>& WavFile::_buffer<float>() { return _flt32_buffer; }
+
+
+// Normalized to [-1, 1). 8-bit WAV samples are unsigned, centred on 128;
+// the loaded bytes are the ones in the file.
+static inline float toFloat(int8_t sample) { return ((uint8_t) sample - 128) * (1.f / 128); }
+static inline float toFloat(int16_t sample) { return sample * (1.f / 32768); }
+static inline float toFloat(const Int24& sample) { return (int) sample * (1.f / 8388608); }
+static inline float toFloat(float sample) { return sample; }
+
+
+static inline int requantize(float sample, float scale, uint64_t i, TpdfDither* dither) {
+    float value = sample * scale;
+
+    if (dither != nullptr) {
+        value += dither->next((int) (i % TpdfDither::NUM_LANES));
+    }
+
+    return (int) lrintf(std::min(std::max(value, -scale), scale - 1));
+}
+
+
+static void quantize(const float* src, int8_t* dst, uint64_t n, TpdfDither* dither) {
+    for (uint64_t i = 0; i < n; i++) {
+        dst[i] = (int8_t) (uint8_t) (requantize(src[i], 128.f, i, dither) + 128);
+    }
+}
+
+
+static void quantize(const float* src, int16_t* dst, uint64_t n, TpdfDither* dither) {
+    Pcm24::pack(src, dst, n, dither);
+}
+
+
+static void quantize(const float* src, Int24* dst, uint64_t n, TpdfDither* dither) {
+    Pcm24::pack(src, dst, n, dither);
+}
+
+
+static void quantize(const float* src, float* dst, uint64_t n, TpdfDither*) {
+    memcpy(dst, src, n * sizeof (float));
+}
+
+
+// One sample to or from float processing, rounded to nearest without dither.
+template<typename S>
+static inline void convertSample(S sample, float& out) {
+    out = toFloat(sample);
+}
+
+
+template<typename D>
+static inline void convertSample(float sample, D& out) {
+    quantize(&sample, &out, 1, nullptr);
+}
+
+
+// convertSample() for FrameKernels; a plain copy when the types agree.
+template<typename S, typename D>
+struct SampleConverter {
+    D operator()(const S& sample) const {
+        D out;
+        convertSample(sample, out);
+        return out;
+    }
+};
+
+
+template<typename T>
+struct SampleConverter<T, T> : FrameKernels::Copy<T> {};
+
+
+// A run of interleaved samples, converted.
+template<typename S, typename D>
+static void convertSamples(const S* src, D* dst, uint64_t n) {
+    SampleConverter<S, D> convert;
+
+    for (uint64_t i = 0; i < n; i++) {
+        dst[i] = convert(src[i]);
+    }
+}
+
+
+template<typename T>
+static void convertSamples(const T* src, T* dst, uint64_t n) {
+    memcpy((void*) dst, src, n * sizeof (T));
+}
+
+
+// What overVoice()'s 16-bit level detector sees of a voice sample.
+static inline int16_t toGateSample(int16_t sample) { return sample; }
+static inline int16_t toGateSample(const Int24& sample) { return (int16_t) ((int) sample >> 8); }
+static inline int16_t toGateSample(float sample) {
+    return (int16_t) std::min(std::max(sample * 32768.f, -32768.f), 32767.f);
+}
+
+
+// Stream errors while saving throw the FileNotExistException that opening the
+// file throws; a file that was opened but not written in full is removed.
+static void checkCreated(const std::ofstream& ofs, const std::string& path) {
+    if (!ofs) {
+        throw FileNotExistException(std::string("File '") + path +
+                                    std::string("' can't be created!"));
+    }
+}
+
+
+static void failWriting(std::ofstream& ofs, const std::string& path) {
+    ofs.close();
+    std::remove(path.c_str());
+
+    throw FileNotExistException(std::string("File '") + path +
+                                std::string("' can't be written!"));
+}
+
+
+static void finishWriting(AsyncWriter& writer, std::ofstream& ofs, const std::string& path) {
+    try {
+        writer.finish();
+    } catch (const std::ios_base::failure&) {
+        failWriting(ofs, path);
+    }
+}
+
+
+static void closeWritten(std::ofstream& ofs, const std::string& path) {
+    ofs.close();
+
+    if (!ofs) {
+        failWriting(ofs, path);
+    }
+}
+
+
+WavFile::WavFile(const std::string& filePath) throw (FileNotExistException, BadRiffException):
+    _filePath(filePath),
+    _dataLoaded(false),
+    _floatProcessing(false),
+    _floatDither(true),
+    _blockDetection(false),
+    _detectionMode(LevelDetector::PEAK_DETECTION),
+    _detectionLinking(LevelDetector::LOUDEST_LINKING),
+    _detectionWindow(0.01),
+    _resampleQuality(Resampler::STANDARD_QUALITY),
+    _overviewBuilding(false),
+    _storageLayout(VECTOR_STORAGE),
+    _cacheSize(DEFAULT_CACHE_SIZE)
+{
+    _parseLayout();
+    _readDataType();
+}
+
+
+WavFile::WavFile(const Header& header):
+    _header(header),
+    _dataLoaded(false),
+    _floatProcessing(false),
+    _floatDither(true),
+    _blockDetection(false),
+    _detectionMode(LevelDetector::PEAK_DETECTION),
+    _detectionLinking(LevelDetector::LOUDEST_LINKING),
+    _detectionWindow(0.01),
+    _resampleQuality(Resampler::STANDARD_QUALITY),
+    _overviewBuilding(false),
+    _storageLayout(VECTOR_STORAGE),
+    _dataOffset(sizeof (_header)),
+    _dataSize(_header.subchunk2Size),
+    _cacheSize(DEFAULT_CACHE_SIZE)
 {
-    std::ifstream ifs(_filePath);
+    _readDataType();
+}
+
+
+void WavFile::_readDataType() {
+    switch (_header.bitsPerSample) {
+        case 8:
+            _dataType = INT_8_DATA;
+            break;
+
+        case 16:
+            _dataType = INT_16_DATA;
+            break;
+
+        case 24:
+            _dataType = INT_24_DATA;
+            break;
+
+        case 32:
+            _dataType = FLT_32_DATA;
+            break;
+
+        default:
+            // what about some exception?
+            break;
+    }
+}
+
+
+void WavFile::loadData() {
+    // Decode from a temporary mapping unless the caller keeps one around.
+    // Lazy storage decodes from the mapping later on.
+    bool keepMapping = isMapped() || _storageLayout == LAZY_STORAGE;
+
+    if (!isMapped()) {
+        mapData();
+    }
+
+    bool lazy = _storageLayout == LAZY_STORAGE;
+    StageTimer timer(_stats, WavStats::DECODE_STAGE, lazy ? 0 : getNumFrames());
+
+    _stats.addRead(lazy ? 0 : _dataSize);
+
+    bool convert = getProcessingType() != _dataType;
+
+    switch (_dataType) {
+        case INT_8_DATA:
+            convert ? _deinterleave<int8_t, float>() : _deinterleave<int8_t, int8_t>();
+            break;
+
+        case INT_16_DATA:
+            convert ? _deinterleave<int16_t, float>() : _deinterleave<int16_t, int16_t>();
+            break;
+
+        case INT_24_DATA:
+            convert ? _deinterleave<Int24, float>() : _deinterleave<Int24, Int24>();
+            break;
+
+        case FLT_32_DATA:
+            _deinterleave<float, float>();
+            break;
+    }
+
+    _dataLoaded = true;
+
+    if (_overviewBuilding) {
+        _overview = _buildOverview();
+    }
+
+    if (!keepMapping) {
+        _mappedFile.reset();
+    }
+}
+
+
+void WavFile::mapData() throw (FileNotExistException) {
+    std::shared_ptr<MappedFile> mappedFile;
+
+    try {
+        mappedFile = std::make_shared<MappedFile>(_filePath);
+    } catch (const MapFailedException&) {
+        throw FileNotExistException(std::string("File '") + _filePath +
+                                    std::string("' doesn't exist!"));
+    }
+
+    // Trust the data chunk size only as far as the file actually goes;
+    // streamed files often leave it at 0 or 0xFFFFFFFF.
+    uint64_t available = mappedFile->size() > _dataOffset ? mappedFile->size() - _dataOffset : 0;
+
+    if (_dataSize == 0 || _dataSize > available) {
+        _dataSize = available;
+    }
+
+    // RIFF only pads chunks to 2 bytes, so float samples can start at 2
+    // mod 4, e.g. after an odd-sized LIST chunk; they are read from a copy.
+    mappedFile->align(_dataOffset, _dataType == FLT_32_DATA ? alignof (float) :
+                                   _dataType == INT_16_DATA ? alignof (int16_t) : 1);
+    mappedFile->adviseSequential(_dataOffset, _dataSize);
+    _mappedFile = mappedFile;
+}
+
+
+bool WavFile::isMapped() const {
+    return _mappedFile && _mappedFile->isOpen();
+}
+
+
+void WavFile::_parseLayout() {
+    StageTimer timer(_stats, WavStats::PARSE_STAGE);
+    std::ifstream ifs(_filePath, std::ios::in | std::ios::binary);
 
     if (!ifs) {
         throw FileNotExistException(std::string("File '") + _filePath +
                                     std::string("' doesn't exist!"));
     }
 
-    ifs.read((char*) &_header, sizeof (_header));
-    ifs.close();
+    _layout.parse(ifs, _filePath);
+    ifs.close();
+
+    _dataOffset = _layout.getDataOffset();
+    _dataSize = _layout.getDataSize();
+
+    // Present the file through the canonical 44 byte header whatever it holds;
+    // sizes past 32 bits read as 0xFFFFFFFF, like in an RF64 file.
+    memcpy(_header.chunkId, "RIFF", 4);
+    memcpy(_header.format, "WAVE", 4);
+    memcpy(_header.subchunk1Id, "fmt ", 4);
+    memcpy(_header.subchunk2Id, "data", 4);
+    _header.subchunk1Size = 16;
+    _header.chunkSize = (uint32_t) std::min<uint64_t>(sizeof (Header) - 8 + _dataSize, RiffLayout::RIFF_SIZE_LIMIT);
+    _header.subchunk2Size = (uint32_t) std::min<uint64_t>(_dataSize, RiffLayout::RIFF_SIZE_LIMIT);
+    _readFormat(_layout.getFormat(), _header);
+}
+
+
+void WavFile::_readFormat(const std::vector<char>& format, Header& header) {
+    // audioFormat .. bitsPerSample mirror the first 16 bytes of any fmt body
+    memcpy(&header.audioFormat, format.data(), 16);
+
+    if (header.audioFormat == RiffLayout::WAVE_FORMAT_EXTENSIBLE && format.size() >= 26) {
+        memcpy(&header.audioFormat, format.data() + 24, sizeof (header.audioFormat));
+    }
+}
+
+
+const RiffLayout& WavFile::getLayout() const {
+    return _layout;
+}
+
+
+std::vector<char> WavFile::getFormatChunk() const {
+    const std::vector<char>& parsed = _layout.getFormat();
+
+    if (parsed.size() >= 16) {
+        Header header = _header;
+        _readFormat(parsed, header);
+
+        if (memcmp(&header.audioFormat, &_header.audioFormat, 16) == 0) {
+            return parsed;
+        }
+    }
+
+    std::vector<char> format(16);
+    memcpy(format.data(), &_header.audioFormat, 16);
+
+    return format;
+}
+
+
+WavFile::Header WavFile::getHeader() const {
+    return _header;
+}
+
+
+WavFile::DataType WavFile::getDataType() const {
+    return _dataType;
+}
+
+
+bool WavFile::isFloatProcessing() const {
+    return _floatProcessing;
+}
+
+
+WavFile::DataType WavFile::getProcessingType() const {
+    return _floatProcessing ? FLT_32_DATA : _dataType;
+}
+
+
+uint64_t WavFile::getDataOffset() const {
+    return _dataOffset;
+}
+
+
+uint64_t WavFile::getDataSize() const {
+    return _dataSize;
+}
+
+
+uint64_t WavFile::getNumFrames() const {
+    return _header.blockAlign ? _dataSize / _header.blockAlign : 0;
+}
+
+
+template<typename T>
+InterleavedView<T> WavFile::_mappedView() const {
+    if (!isMapped() || _header.numChannels == 0) {
+        return InterleavedView<T>();
+    }
+
+    uint64_t numFrames = _dataSize / (sizeof (T) * _header.numChannels);
+
+    return InterleavedView<T>((const T*) (_mappedFile->data() + _dataOffset),
+                              numFrames, _header.numChannels);
+}
+
+
+InterleavedView<int8_t> WavFile::getMappedInt8Data() const throw (WrongDataTypeException) {
+    _checkDataType(INT_8_DATA, "INT_8_DATA", true);
+
+    return _mappedView<int8_t>();
+}
+
+
+InterleavedView<int16_t> WavFile::getMappedInt16Data() const throw (WrongDataTypeException) {
+    _checkDataType(INT_16_DATA, "INT_16_DATA", true);
+
+    return _mappedView<int16_t>();
+}
+
+
+InterleavedView<Int24> WavFile::getMappedInt24Data() const throw (WrongDataTypeException) {
+    _checkDataType(INT_24_DATA, "INT_24_DATA", true);
+
+    return _mappedView<Int24>();
+}
+
+
+InterleavedView<float> WavFile::getMappedFlt32Data() const throw (WrongDataTypeException) {
+    _checkDataType(FLT_32_DATA, "FLT_32_DATA", true);
+
+    return _mappedView<float>();
+}
+
+
+WavFile::Data_i8 WavFile::getInt8Data() throw (WrongDataTypeException) {
+    _checkDataType(INT_8_DATA, "INT_8_DATA");
+
+    return _copyRange<int8_t>(0, _numLoadedFrames<int8_t>());
+}
+
+
+WavFile::Data_i16 WavFile::getInt16Data() throw (WrongDataTypeException) {
+    _checkDataType(INT_16_DATA, "INT_16_DATA");
+
+    return _copyRange<int16_t>(0, _numLoadedFrames<int16_t>());
+}
+
+
+WavFile::Data_i24 WavFile::getInt24Data() throw (WrongDataTypeException) {
+    _checkDataType(INT_24_DATA, "INT_24_DATA");
+
+    return _copyRange<Int24>(0, _numLoadedFrames<Int24>());
+}
+
+
+WavFile::Data_f32 WavFile::getFlt32Data() throw (WrongDataTypeException) {
+    _checkDataType(FLT_32_DATA, "FLT_32_DATA");
+
+    return _copyRange<float>(0, _numLoadedFrames<float>());
+}
+
+
+WavFile::Data_i8 WavFile::getInt8Range(uint64_t first, uint64_t numFrames) throw (WrongDataTypeException) {
+    _checkDataType(INT_8_DATA, "INT_8_DATA");
+
+    return _copyRange<int8_t>(first, numFrames);
+}
+
+
+WavFile::Data_i16 WavFile::getInt16Range(uint64_t first, uint64_t numFrames) throw (WrongDataTypeException) {
+    _checkDataType(INT_16_DATA, "INT_16_DATA");
+
+    return _copyRange<int16_t>(first, numFrames);
+}
+
+
+WavFile::Data_i24 WavFile::getInt24Range(uint64_t first, uint64_t numFrames) throw (WrongDataTypeException) {
+    _checkDataType(INT_24_DATA, "INT_24_DATA");
+
+    return _copyRange<Int24>(first, numFrames);
+}
+
+
+WavFile::Data_f32 WavFile::getFlt32Range(uint64_t first, uint64_t numFrames) throw (WrongDataTypeException) {
+    _checkDataType(FLT_32_DATA, "FLT_32_DATA");
+
+    return _copyRange<float>(first, numFrames);
+}
+
+
+ChannelView<const int8_t> WavFile::getInt8Channel(int channel, uint64_t first, uint64_t numFrames) const
+    throw (WrongDataTypeException, WrongStorageLayoutException, std::out_of_range) {
+    _checkDataType(INT_8_DATA, "INT_8_DATA");
+
+    return _channelRange<int8_t>(channel, first, numFrames);
+}
+
+
+ChannelView<const int16_t> WavFile::getInt16Channel(int channel, uint64_t first, uint64_t numFrames) const
+    throw (WrongDataTypeException, WrongStorageLayoutException, std::out_of_range) {
+    _checkDataType(INT_16_DATA, "INT_16_DATA");
+
+    return _channelRange<int16_t>(channel, first, numFrames);
+}
+
+
+ChannelView<const Int24> WavFile::getInt24Channel(int channel, uint64_t first, uint64_t numFrames) const
+    throw (WrongDataTypeException, WrongStorageLayoutException, std::out_of_range) {
+    _checkDataType(INT_24_DATA, "INT_24_DATA");
+
+    return _channelRange<Int24>(channel, first, numFrames);
+}
+
+
+ChannelView<const float> WavFile::getFlt32Channel(int channel, uint64_t first, uint64_t numFrames) const
+    throw (WrongDataTypeException, WrongStorageLayoutException, std::out_of_range) {
+    _checkDataType(FLT_32_DATA, "FLT_32_DATA");
+
+    return _channelRange<float>(channel, first, numFrames);
+}
+
+
+void WavFile::visitInt8Range(int channel, uint64_t first, uint64_t numFrames, const Visitor_i8& body) const {
+    _checkDataType(INT_8_DATA, "INT_8_DATA");
+
+    _visitRange<int8_t>(channel, first, numFrames, body);
+}
+
+
+void WavFile::visitInt16Range(int channel, uint64_t first, uint64_t numFrames, const Visitor_i16& body) const {
+    _checkDataType(INT_16_DATA, "INT_16_DATA");
+
+    _visitRange<int16_t>(channel, first, numFrames, body);
+}
+
+
+void WavFile::visitInt24Range(int channel, uint64_t first, uint64_t numFrames, const Visitor_i24& body) const {
+    _checkDataType(INT_24_DATA, "INT_24_DATA");
+
+    _visitRange<Int24>(channel, first, numFrames, body);
+}
+
+
+void WavFile::visitFlt32Range(int channel, uint64_t first, uint64_t numFrames, const Visitor_f32& body) const {
+    _checkDataType(FLT_32_DATA, "FLT_32_DATA");
+
+    _visitRange<float>(channel, first, numFrames, body);
+}
+
+
+WavFile::Data_i8 WavFile::takeInt8Data() throw (WrongDataTypeException) {
+    _checkDataType(INT_8_DATA, "INT_8_DATA");
+
+    return _takeData<int8_t>();
+}
+
+
+WavFile::Data_i16 WavFile::takeInt16Data() throw (WrongDataTypeException) {
+    _checkDataType(INT_16_DATA, "INT_16_DATA");
+
+    return _takeData<int16_t>();
+}
+
+
+WavFile::Data_i24 WavFile::takeInt24Data() throw (WrongDataTypeException) {
+    _checkDataType(INT_24_DATA, "INT_24_DATA");
+
+    return _takeData<Int24>();
+}
+
+
+WavFile::Data_f32 WavFile::takeFlt32Data() throw (WrongDataTypeException) {
+    _checkDataType(FLT_32_DATA, "FLT_32_DATA");
+
+    return _takeData<float>();
+}
+
+
+void WavFile::_checkDataType(DataType dataType, const char* name, bool mapped) const throw (WrongDataTypeException) {
+    if ((mapped ? _dataType : getProcessingType()) != dataType) {
+        throw WrongDataTypeException(std::string("File '") + _filePath +
+                                     std::string("' doesn't contain ") + name + std::string("!"));
+    }
+}
+
+
+// Only float processing on one side and not the other is refused; integer
+// files of different types are left to the callers, as they always were.
+void WavFile::_checkProcessingType(const WavFile& otherFile) const throw (DifferentBitsPerSampleException) {
+    if (_floatProcessing != otherFile._floatProcessing && getProcessingType() != otherFile.getProcessingType()) {
+        throw DifferentBitsPerSampleException(std::string("Files '") + _filePath +
+                                              std::string("' and '") + otherFile._filePath +
+                                              std::string("' are processed as different sample types!"));
+    }
+}
+
+
+void WavFile::_checkChannel(int channel) const throw (std::out_of_range) {
+    if (channel < 0 || channel >= _header.numChannels) {
+        throw std::out_of_range(std::string("File '") + _filePath +
+                                std::string("' has no channel ") + std::to_string(channel) + std::string("!"));
+    }
+}
+
+
+void WavFile::mixWith(WavFile& otherFile, uint64_t delayFrames, float otherGain, float ownGain)
+    throw (DifferentNumChannelsException, DifferentBitsPerSampleException) {
+    if (_header.numChannels != otherFile._header.numChannels) {
+        throw DifferentNumChannelsException(std::string("Files '") + _filePath +
+                                            std::string("' and '") + otherFile._filePath +
+                                            std::string("' have different numChannels!"));
+    }
+
+    if (_header.bitsPerSample != otherFile._header.bitsPerSample) {
+        throw DifferentBitsPerSampleException(std::string("Files '") + _filePath +
+                                              std::string("' and '") + otherFile._filePath +
+                                              std::string("' have different bitsPerSample!"));
+    }
+
+    _checkProcessingType(otherFile);
+
+    _ensureLoaded();
+    otherFile._ensureLoaded();
+
+    bool resample = otherFile._header.sampleRate != _header.sampleRate;
+
+    switch (getProcessingType()) {
+        case INT_8_DATA:
+            resample ? _mixResampled<int8_t>(otherFile, delayFrames, otherGain, ownGain)
+                     : _mixData<int8_t>(otherFile, delayFrames, otherGain, ownGain);
+            break;
+
+        case INT_16_DATA:
+            resample ? _mixResampled<int16_t>(otherFile, delayFrames, otherGain, ownGain)
+                     : _mixData<int16_t>(otherFile, delayFrames, otherGain, ownGain);
+            break;
+
+        case INT_24_DATA:
+            resample ? _mixResampled<Int24>(otherFile, delayFrames, otherGain, ownGain)
+                     : _mixData<Int24>(otherFile, delayFrames, otherGain, ownGain);
+            break;
+
+        case FLT_32_DATA:
+            resample ? _mixResampled<float>(otherFile, delayFrames, otherGain, ownGain)
+                     : _mixData<float>(otherFile, delayFrames, otherGain, ownGain);
+            break;
+    }
+}
+
+
+WavFile WavFile::mix(WavFile& first, WavFile& second)
+    throw (DifferentNumChannelsException, DifferentBitsPerSampleException) {
+    MixBus bus;
+    bus.addInput(first);
+    bus.addInput(second);
+
+    return bus.render();
+}
+
+
+void WavFile::addMonoFrom(WavFile& otherFile) throw (NotMonoException, DifferentBitsPerSampleException) {
+    if (otherFile._header.numChannels != 1) {
+        throw NotMonoException(std::string("File '") + otherFile._filePath +
+                               std::string("' haven't mono track!"));
+    }
+
+    _checkProcessingType(otherFile);
+
+    _ensureLoaded();
+    otherFile._ensureLoaded();
+
+    switch (getProcessingType()) {
+        case INT_8_DATA:
+            _addMonoData<int8_t>(otherFile);
+            break;
+
+        case INT_16_DATA:
+            _addMonoData<int16_t>(otherFile);
+            break;
+
+        case INT_24_DATA:
+            _addMonoData<Int24>(otherFile);
+            break;
+
+        case FLT_32_DATA:
+            _addMonoData<float>(otherFile);
+            break;
+    }
+}
+
+
+void WavFile::_ensureLoaded() {
+    if (!_dataLoaded && isMapped()) {
+        loadData();
+    }
+}
+
+
+template<typename T>
+ChannelView<T> WavFile::_channel(int i) {
+    if (_storageLayout == VECTOR_STORAGE) {
+        std::vector<T>& channel = _vectors<T>().at(i);
+        return ChannelView<T>(channel.data(), 1, channel.size());
+    }
+
+    return _buffer<T>().channel(i);
+}
+
+
+template<typename T>
+uint64_t WavFile::_numLoadedFrames() {
+    if (_storageLayout == LAZY_STORAGE) {
+        return _cache ? getNumFrames() : 0;
+    }
+
+    if (_storageLayout != VECTOR_STORAGE) {
+        return _buffer<T>().numFrames();
+    }
+
+    std::vector<std::vector<T>>& data = _vectors<T>();
+    uint64_t numFrames = data.empty() ? 0 : data.at(0).size();
+
+    for (std::size_t i = 1; i < data.size(); i++) {
+        numFrames = std::min<uint64_t>(numFrames, data.at(i).size());
+    }
+
+    return numFrames;
+}
+
+
+template<typename T>
+void WavFile::_allocate(uint64_t numFrames) {
+    if (_storageLayout == LAZY_STORAGE) {
+        // Blocks come into being on first use; numFrames follows the header.
+        std::size_t blockSize = _header.numChannels * CACHE_BLOCK_FRAMES * sizeof (T);
+
+        _cache = std::make_shared<BlockCache>(blockSize, std::max<uint64_t>(2, _cacheSize / blockSize));
+        _vectors<T>().clear();
+        _buffer<T>().clear();
+    } else if (_storageLayout == VECTOR_STORAGE) {
+        _vectors<T>().assign(_header.numChannels, std::vector<T>(numFrames));
+        _buffer<T>().clear();
+
+        for (int i = 0; i < _header.numChannels; i++) {
+            _stats.addAllocation(numFrames * sizeof (T));
+        }
+    } else {
+        _stats.addAllocation(numFrames * _header.numChannels * sizeof (T));
+
+        _buffer<T>().allocate(_header.numChannels, numFrames,
+                              _storageLayout == PLANAR_STORAGE ? SampleBuffer<T>::PLANAR
+                                                               : SampleBuffer<T>::INTERLEAVED);
+        _vectors<T>().clear();
+    }
+
+    if (_storageLayout != LAZY_STORAGE) {
+        _cache.reset();
+    }
+}
+
+
+// MixBus reaches the samples of its inputs and output through these and
+// _forPieces().
+template ChannelView<int8_t> WavFile::_channel<int8_t>(int);
+template ChannelView<int16_t> WavFile::_channel<int16_t>(int);
+template ChannelView<Int24> WavFile::_channel<Int24>(int);
+template ChannelView<float> WavFile::_channel<float>(int);
+
+template uint64_t WavFile::_numLoadedFrames<int8_t>();
+template uint64_t WavFile::_numLoadedFrames<int16_t>();
+template uint64_t WavFile::_numLoadedFrames<Int24>();
+template uint64_t WavFile::_numLoadedFrames<float>();
+
+template void WavFile::_allocate<int8_t>(uint64_t);
+template void WavFile::_allocate<int16_t>(uint64_t);
+template void WavFile::_allocate<Int24>(uint64_t);
+template void WavFile::_allocate<float>(uint64_t);
+
+
+// Decodes the mapped file, of sample type S, into new storage of type D.
+template<typename S, typename D>
+void WavFile::_deinterleave() {
+    InterleavedView<S> view = _mappedView<S>();
+    uint64_t numFrames = view.numFrames();
+    int numChannels = _header.numChannels;
+
+    _allocate<D>(numFrames);
+
+    if (_storageLayout == LAZY_STORAGE) {
+        return;
+    }
+
+    // Parallel copies also spread the page faults of the mapping.
+    if (_storageLayout == INTERLEAVED_STORAGE) {
+        D* dst = _buffer<D>().data();
+
+        ThreadPool::shared().parallelRanges(numFrames * numChannels, MIN_RANGE_FRAMES * numChannels,
+                                            [&](uint64_t first, uint64_t last) {
+            convertSamples(view.data() + first, dst + first, last - first);
+        });
+        return;
+    }
+
+    _forFrames<D>(0, numFrames, true, [&](D* const* channels, uint64_t, uint64_t) {
+        ThreadPool::shared().parallelRanges(numFrames, MIN_RANGE_FRAMES, [&](uint64_t first, uint64_t last) {
+            FrameKernels::deinterleave(view.data(), channels, first, last - first, numChannels,
+                                       SampleConverter<S, D>());
+        });
+    });
+}
+
+
+template<typename T>
+void WavFile::_relayout(StorageLayout layout) {
+    WavFile relaid(_header);
+    uint64_t numFrames = _numLoadedFrames<T>();
+
+    relaid._dataSize = numFrames * _header.blockAlign;
+    relaid._cacheSize = _cacheSize;
+    relaid._storageLayout = layout;
+    relaid._allocate<T>(numFrames);
+
+    _forChannelRanges(numFrames, [&](int i, uint64_t first, uint64_t last) {
+        _forPieces<T>(i, first, last - first, false, [&](ChannelView<T> src, uint64_t from, uint64_t to) {
+            relaid._forPieces<T>(i, from, to - from, true, [&](ChannelView<T> dst, uint64_t a, uint64_t b) {
+                for (uint64_t f = 0; f < b - a; f++) {
+                    dst[f] = src[a - from + f];
+                }
+            });
+        });
+    });
+
+    _vectors<T>().swap(relaid._vectors<T>());
+    _buffer<T>() = std::move(relaid._buffer<T>());
+    _cache = relaid._cache;
+}
+
+
+template<typename T>
+std::vector<std::vector<T>> WavFile::_copyRange(uint64_t first, uint64_t numFrames) {
+    uint64_t available = _numLoadedFrames<T>();
+
+    first = std::min(first, available);
+    numFrames = std::min(numFrames, available - first);
+
+    if (_storageLayout == VECTOR_STORAGE && first == 0 && numFrames == available) {
+        return _vectors<T>();
+    }
+
+    std::vector<std::vector<T>> data(_header.numChannels, std::vector<T>(numFrames));
+
+    for (int i = 0; i < _header.numChannels; i++) {
+        _forPieces<T>(i, first, numFrames, false, [&](ChannelView<T> src, uint64_t from, uint64_t to) {
+            T* dst = data.at(i).data() + (from - first);
+
+            for (uint64_t f = 0; f < to - from; f++) {
+                dst[f] = src[f];
+            }
+        });
+    }
+
+    return data;
+}
+
+
+// The views are read-only; the const_casts only reach the non-const
+// accessors, which don't change anything when reading.
+template<typename T>
+ChannelView<const T> WavFile::_channelRange(int channel, uint64_t first, uint64_t numFrames) const {
+    _checkChannel(channel);
+
+    if (_storageLayout == LAZY_STORAGE) {
+        throw WrongStorageLayoutException(std::string("File '") + _filePath +
+                                          std::string("' is stored lazily and has no contiguous channels!"));
+    }
+
+    WavFile& self = const_cast<WavFile&>(*this);
+    uint64_t available = self._numLoadedFrames<T>();
+
+    if (available == 0) {
+        return ChannelView<const T>();
+    }
+
+    first = std::min(first, available);
+    numFrames = std::min(numFrames, available - first);
+
+    ChannelView<T> view = self._channel<T>(channel);
+
+    return ChannelView<const T>(view.data() + first * view.stride(), view.stride(), numFrames);
+}
+
+
+template<typename T>
+void WavFile::_visitRange(int channel, uint64_t first, uint64_t numFrames,
+                          const std::function<void(ChannelView<const T>, uint64_t, uint64_t)>& body) const {
+    _checkChannel(channel);
+
+    WavFile& self = const_cast<WavFile&>(*this);
+    uint64_t available = self._numLoadedFrames<T>();
+
+    first = std::min(first, available);
+    numFrames = std::min(numFrames, available - first);
+
+    self._forPieces<T>(channel, first, numFrames, false, [&](ChannelView<T> view, uint64_t from, uint64_t to) {
+        body(view, from, to);
+    });
+}
+
+
+// Vector storage is handed over as it is; the other layouts are copied out
+// once, then freed.
+template<typename T>
+std::vector<std::vector<T>> WavFile::_takeData() {
+    std::vector<std::vector<T>> data;
+
+    if (_storageLayout == VECTOR_STORAGE) {
+        data.swap(_vectors<T>());
+    } else {
+        data = _copyRange<T>(0, _numLoadedFrames<T>());
+    }
+
+    _dropData();
+
+    return data;
+}
+
+
+// Frames [first, first + numFrames) of the mapped file, channel c going to
+// channels[c][0] onwards.
+template<typename T>
+void WavFile::_readMapped(uint64_t first, uint64_t numFrames, T* const* channels) const {
+    _convertMapped<T, T>(first, numFrames, channels);
+}
+
+
+// Float processing decodes whatever the file holds.
+template<>
+void WavFile::_readMapped<float>(uint64_t first, uint64_t numFrames, float* const* channels) const {
+    switch (_dataType) {
+        case INT_8_DATA:
+            _convertMapped<int8_t, float>(first, numFrames, channels);
+            break;
+
+        case INT_16_DATA:
+            _convertMapped<int16_t, float>(first, numFrames, channels);
+            break;
+
+        case INT_24_DATA:
+            _convertMapped<Int24, float>(first, numFrames, channels);
+            break;
+
+        case FLT_32_DATA:
+            _convertMapped<float, float>(first, numFrames, channels);
+            break;
+    }
+}
+
+
+template<typename S, typename D>
+void WavFile::_convertMapped(uint64_t first, uint64_t numFrames, D* const* channels) const {
+    FrameKernels::deinterleave(_mappedView<S>().frame(first), channels, 0, numFrames, _header.numChannels,
+                               SampleConverter<S, D>());
+}
+
+
+template<typename T>
+void WavFile::_decodeBlock(uint64_t index, T* block) {
+    uint64_t available = isMapped() ? getNumFrames() : 0;
+    uint64_t first = index * CACHE_BLOCK_FRAMES;
+    uint64_t count = first < available ? std::min(CACHE_BLOCK_FRAMES, available - first) : 0;
+    StageTimer timer(_stats, WavStats::DECODE_STAGE, count);
+
+    _stats.addRead(count * _header.blockAlign);
+
+    std::vector<T*> channels(_header.numChannels);
+
+    for (int i = 0; i < _header.numChannels; i++) {
+        channels[i] = block + i * CACHE_BLOCK_FRAMES;
+
+        // past the end of the mapping, or with no mapping at all
+        std::fill(channels[i] + count, channels[i] + CACHE_BLOCK_FRAMES, T(0));
+    }
+
+    if (count > 0) {
+        _readMapped<T>(first, count, channels.data());
+    }
+}
+
+
+template<typename T>
+void WavFile::_forPieces(int channel, uint64_t first, uint64_t numFrames, bool write,
+                         const std::function<void(ChannelView<T>, uint64_t, uint64_t)>& body) {
+    if (numFrames == 0) {
+        return;
+    }
+
+    if (_storageLayout != LAZY_STORAGE) {
+        ChannelView<T> view = _channel<T>(channel);
+        body(ChannelView<T>(&view[first], view.stride(), numFrames), first, first + numFrames);
+        return;
+    }
+
+    uint64_t last = first + numFrames;
+
+    for (uint64_t from = first; from < last; ) {
+        uint64_t index = from / CACHE_BLOCK_FRAMES;
+        uint64_t blockFirst = index * CACHE_BLOCK_FRAMES;
+        uint64_t to = std::min(last, blockFirst + CACHE_BLOCK_FRAMES);
+
+        T* block = (T*) _cache->acquire(index, [&](char* data) {
+            _decodeBlock<T>(index, (T*) data);
+        });
+
+        try {
+            body(ChannelView<T>(block + channel * CACHE_BLOCK_FRAMES + (from - blockFirst), 1, to - from), from, to);
+        } catch (...) {
+            _cache->release(index, write);
+            throw;
+        }
+
+        _cache->release(index, write);
+        from = to;
+    }
+}
+
+
+template void WavFile::_forPieces<int8_t>(int, uint64_t, uint64_t, bool,
+                                          const std::function<void(ChannelView<int8_t>, uint64_t, uint64_t)>&);
+template void WavFile::_forPieces<int16_t>(int, uint64_t, uint64_t, bool,
+                                           const std::function<void(ChannelView<int16_t>, uint64_t, uint64_t)>&);
+template void WavFile::_forPieces<Int24>(int, uint64_t, uint64_t, bool,
+                                         const std::function<void(ChannelView<Int24>, uint64_t, uint64_t)>&);
+template void WavFile::_forPieces<float>(int, uint64_t, uint64_t, bool,
+                                         const std::function<void(ChannelView<float>, uint64_t, uint64_t)>&);
+
+
+template<typename T>
+void WavFile::_forFrames(uint64_t first, uint64_t numFrames, bool write,
+                         const std::function<void(T* const*, uint64_t, uint64_t)>& body) {
+    if (numFrames == 0) {
+        return;
+    }
+
+    std::vector<T*> channels(_header.numChannels);
+
+    if (_storageLayout != LAZY_STORAGE) {
+        for (int i = 0; i < _header.numChannels; i++) {
+            channels[i] = _channel<T>(i).data() + first;
+        }
+
+        body(channels.data(), first, first + numFrames);
+        return;
+    }
+
+    uint64_t last = first + numFrames;
+
+    for (uint64_t from = first; from < last; ) {
+        uint64_t index = from / CACHE_BLOCK_FRAMES;
+        uint64_t blockFirst = index * CACHE_BLOCK_FRAMES;
+        uint64_t to = std::min(last, blockFirst + CACHE_BLOCK_FRAMES);
+
+        T* block = (T*) _cache->acquire(index, [&](char* data) {
+            _decodeBlock<T>(index, (T*) data);
+        });
+
+        for (int i = 0; i < _header.numChannels; i++) {
+            channels[i] = block + i * CACHE_BLOCK_FRAMES + (from - blockFirst);
+        }
+
+        try {
+            body(channels.data(), from, to);
+        } catch (...) {
+            _cache->release(index, write);
+            throw;
+        }
+
+        _cache->release(index, write);
+        from = to;
+    }
+}
+
+
+// Like _relayout(), into a temporary file whose storage is then taken over.
+template<typename S, typename D>
+void WavFile::_convertLoaded() {
+    WavFile converted(_header);
+    uint64_t numFrames = _numLoadedFrames<S>();
+
+    converted._dataSize = numFrames * _header.blockAlign;
+    converted._cacheSize = _cacheSize;
+    converted._storageLayout = _storageLayout;
+    converted._allocate<D>(numFrames);
+
+    _forChannelRanges(numFrames, [&](int i, uint64_t first, uint64_t last) {
+        _forPieces<S>(i, first, last - first, false, [&](ChannelView<S> src, uint64_t from, uint64_t to) {
+            converted._forPieces<D>(i, from, to - from, true, [&](ChannelView<D> dst, uint64_t a, uint64_t b) {
+                for (uint64_t f = 0; f < b - a; f++) {
+                    convertSample(src[a - from + f], dst[f]);
+                }
+            });
+        });
+    });
+
+    _dropData();
+    _vectors<D>().swap(converted._vectors<D>());
+    _buffer<D>() = std::move(converted._buffer<D>());
+    _cache = converted._cache;
+    _dataLoaded = true;
+}
+
+
+void WavFile::setFloatProcessing(bool enabled, bool dither) {
+    _floatDither = dither;
+
+    if (enabled == _floatProcessing) {
+        return;
+    }
+
+    if (_dataLoaded) {
+        switch (_dataType) {
+            case INT_8_DATA:
+                enabled ? _convertLoaded<int8_t, float>() : _convertLoaded<float, int8_t>();
+                break;
+
+            case INT_16_DATA:
+                enabled ? _convertLoaded<int16_t, float>() : _convertLoaded<float, int16_t>();
+                break;
+
+            case INT_24_DATA:
+                enabled ? _convertLoaded<Int24, float>() : _convertLoaded<float, Int24>();
+                break;
+
+            case FLT_32_DATA:
+                break;
+        }
+    }
+
+    _floatProcessing = enabled;
+}
+
+
+void WavFile::setStorageLayout(StorageLayout layout) {
+    if (layout == _storageLayout) {
+        return;
+    }
+
+    if (_dataLoaded) {
+        switch (getProcessingType()) {
+            case INT_8_DATA:
+                _relayout<int8_t>(layout);
+                break;
+
+            case INT_16_DATA:
+                _relayout<int16_t>(layout);
+                break;
+
+            case INT_24_DATA:
+                _relayout<Int24>(layout);
+                break;
+
+            case FLT_32_DATA:
+                _relayout<float>(layout);
+                break;
+        }
+    }
+
+    _storageLayout = layout;
+}
+
+
+WavFile::StorageLayout WavFile::getStorageLayout() const {
+    return _storageLayout;
+}
+
+
+void WavFile::setCacheSize(uint64_t bytes) {
+    _cacheSize = bytes;
+
+    if (_cache) {
+        _cache->setCapacity(std::max<uint64_t>(2, _cacheSize / _cache->getBlockSize()));
+    }
+}
+
+
+const BlockCache* WavFile::getCache() const {
+    return _cache.get();
+}
+
+
+template<typename T>
+void WavFile::_mixData(WavFile& otherFile, uint64_t delayFrames, float otherGain, float ownGain) {
+    uint64_t ownFrames = _numLoadedFrames<T>();
+
+    if (delayFrames >= ownFrames) {
+        return;
+    }
+
+    uint64_t numFrames = std::min(ownFrames - delayFrames, otherFile._numLoadedFrames<T>());
+    StageTimer timer(_stats, WavStats::MIX_STAGE, numFrames);
+
+    if (_storageLayout == INTERLEAVED_STORAGE && otherFile._storageLayout == INTERLEAVED_STORAGE) {
+        T* dst = _buffer<T>().data() + delayFrames * _header.numChannels;
+        const T* src = otherFile._buffer<T>().data();
+
+        ThreadPool::shared().parallelRanges(numFrames * _header.numChannels, MIN_RANGE_FRAMES * _header.numChannels,
+                                            [&](uint64_t first, uint64_t last) {
+            MixKernels::mix(dst + first, src + first, last - first, ownGain, otherGain);
+
+            if (StatsRecorder::ENABLED) {
+                _stats.addClipped(countClipped(ChannelView<T>(dst + first, 1, last - first), last - first));
+            }
+        });
+        return;
+    }
+
+    _forChannelRanges(numFrames, [&](int i, uint64_t first, uint64_t last) {
+        otherFile._forPieces<T>(i, first, last - first, false, [&](ChannelView<T> src, uint64_t from, uint64_t to) {
+            _forPieces<T>(i, delayFrames + from, to - from, true, [&](ChannelView<T> dst, uint64_t dstFrom, uint64_t dstTo) {
+                MixKernels::mix(dst, ChannelView<T>(&src[dstFrom - delayFrames - from], src.stride(), dstTo - dstFrom),
+                                dstTo - dstFrom, ownGain, otherGain);
+
+                if (StatsRecorder::ENABLED) {
+                    _stats.addClipped(countClipped(dst, dstTo - dstFrom));
+                }
+            });
+        });
+    });
+}
+
+
+// Each channel of the other file goes through its own resampler and is
+// mixed in a block at a time as it comes out, rounded to T first the way a
+// file resampled beforehand would be.
+template<typename T>
+void WavFile::_mixResampled(WavFile& otherFile, uint64_t delayFrames, float otherGain, float ownGain) {
+    uint64_t ownFrames = _numLoadedFrames<T>();
+
+    if (delayFrames >= ownFrames) {
+        return;
+    }
+
+    Resampler resampler(otherFile._header.sampleRate, _header.sampleRate, _resampleQuality);
+    uint64_t numFrames = std::min(ownFrames - delayFrames, resampler.getOutputFrames(otherFile._numLoadedFrames<T>()));
+    StageTimer timer(_stats, WavStats::MIX_STAGE, numFrames);
+
+    ThreadPool::shared().parallelFor(_header.numChannels, [&](uint64_t i) {
+        ResampledReader reader = otherFile._resampled<T>((int) i, resampler);
+        std::vector<float> samples(MIN_RANGE_FRAMES);
+        std::vector<T> src(MIN_RANGE_FRAMES);
+
+        for (uint64_t first = 0; first < numFrames; first += MIN_RANGE_FRAMES) {
+            uint64_t count = reader.read(samples.data(), std::min(MIN_RANGE_FRAMES, numFrames - first));
+
+            quantize(samples.data(), src.data(), count, nullptr);
+
+            _forPieces<T>((int) i, delayFrames + first, count, true, [&](ChannelView<T> dst, uint64_t from, uint64_t to) {
+                MixKernels::mix(dst, ChannelView<T>(&src[from - delayFrames - first], 1, to - from),
+                                to - from, ownGain, otherGain);
+
+                if (StatsRecorder::ENABLED) {
+                    _stats.addClipped(countClipped(dst, to - from));
+                }
+            });
+        }
+    });
+}
+
+
+// A channel of the loaded samples as normalized floats at the output rate of
+// resampler, read in order.
+template<typename T>
+ResampledReader WavFile::_resampled(int channel, const Resampler& resampler) {
+    return ResampledReader(resampler, _numLoadedFrames<T>(), [this, channel](float* dst, uint64_t first, uint64_t numFrames) {
+        SampleConverter<T, float> convert;
+
+        _forPieces<T>(channel, first, numFrames, false, [&](ChannelView<T> src, uint64_t from, uint64_t to) {
+            for (uint64_t f = from; f < to; f++) {
+                dst[f - first] = convert(src[f - from]);
+            }
+        });
+    });
+}
+
+
+template ResampledReader WavFile::_resampled<int8_t>(int, const Resampler&);
+template ResampledReader WavFile::_resampled<int16_t>(int, const Resampler&);
+template ResampledReader WavFile::_resampled<Int24>(int, const Resampler&);
+template ResampledReader WavFile::_resampled<float>(int, const Resampler&);
+
+
+// The mono sample goes into every channel, scaled down by the channel count.
+template<typename T>
+void WavFile::_addMonoData(WavFile& otherFile) {
+    uint64_t numFrames = std::min(_numLoadedFrames<T>(), otherFile._numLoadedFrames<T>());
+    StageTimer timer(_stats, WavStats::MIX_STAGE, numFrames);
+
+    _forChannelRanges(numFrames, [&](int i, uint64_t first, uint64_t last) {
+        otherFile._forPieces<T>(0, first, last - first, false, [&](ChannelView<T> mono, uint64_t from, uint64_t to) {
+            _forPieces<T>(i, from, to - from, true, [&](ChannelView<T> dst, uint64_t dstFrom, uint64_t dstTo) {
+                FrameKernels::addShare(dst, ChannelView<T>(&mono[dstFrom - from], mono.stride(), dstTo - dstFrom),
+                                       dstTo - dstFrom, _header.numChannels);
+            });
+        });
+    });
+}
 
-    switch (_header.bitsPerSample) {
-        case 8:
-            _dataType = INT_8_DATA;
-            break;
 
-        case 16:
-            _dataType = INT_16_DATA;
-            break;
+void WavFile::save(const std::string& path) {
+    const std::string& target = path.empty() ? _filePath : path;
 
-        case 24:
-            _dataType = INT_24_DATA;
-            break;
+    // Chunks are copied out of _filePath, so never truncate it while writing.
+    bool inPlace = target == _filePath;
+    std::string outPath = inPlace ? target + ".part" : target;
 
-        case 32:
-            _dataType = FLT_32_DATA;
-            break;
+    // Lazy storage still reads the blocks it hasn't decoded from the mapping.
+    bool lazy = _dataLoaded && _storageLayout == LAZY_STORAGE;
 
-        default:
-            // what about some exception?
-            break;
+    if (isMapped() && inPlace && !lazy) {
+        _ensureLoaded();
+        _mappedFile.reset();
     }
-}
 
+    if (inPlace) {
+        _overview.reset();
+    }
 
-WavFile::WavFile(const Header& header):
-    _header(header)
-{
-    switch (_header.bitsPerSample) {
-        case 8:
-            _dataType = INT_8_DATA;
-            break;
-
-        case 16:
-            _dataType = INT_16_DATA;
-            break;
+    if (!_dataLoaded && isMapped()) {
+        _saveMapped(outPath);
+    } else if (getProcessingType() != _dataType) {
+        // The one place float processing rounds to the file's format.
+        _saveConverted<float>(outPath, _dataType, _floatDither);
+    } else {
+        switch (_dataType) {
+            case INT_8_DATA:
+                _saveData<int8_t>(outPath);
+                break;
+
+            case INT_16_DATA:
+                _saveData<int16_t>(outPath);
+                break;
+
+            case INT_24_DATA:
+                _saveData<Int24>(outPath);
+                break;
+
+            case FLT_32_DATA:
+                _saveData<float>(outPath);
+                break;
+        }
+    }
 
-        case 24:
-            _dataType = INT_24_DATA;
-            break;
+    if (inPlace) {
+        if (lazy) {
+            _mappedFile.reset();
+            _cache.reset();
+        }
 
-        case 32:
-            _dataType = FLT_32_DATA;
-            break;
+        std::remove(target.c_str());
+        std::rename(outPath.c_str(), target.c_str());
+        _parseLayout();
 
-        default:
-            // what about some exception?
-            break;
+        // Everything changed is on disk now; start over from the new file.
+        if (lazy) {
+            loadData();
+        } else if (_overviewBuilding) {
+            _overview = _buildOverview();
         }
+    } else if (_overviewBuilding) {
+        WavFile(target)._buildOverview();
+    }
 }
 
 
-void WavFile::loadData() {
-    switch (_dataType) {
-        case INT_8_DATA:
-            _loadInt8Data();
-            break;
+void WavFile::_saveMapped(const std::string& path) {
+    StageTimer timer(_stats, WavStats::WRITE_STAGE, getNumFrames());
+    std::ofstream ofs(path, std::ios::out|std::ios::binary|std::ios::trunc);
 
-        case INT_16_DATA:
-            _loadInt16Data();
-            break;
+    checkCreated(ofs, path);
+    _stats.addWritten(_dataSize);
 
-        case INT_24_DATA:
-            _loadInt24Data();
-            break;
+    RiffLayout::Placement placement = _layout.writeHead(ofs, getFormatChunk(), _dataSize);
+    ofs.write(_mappedFile->data() + _dataOffset, _dataSize);
+    _layout.writeTail(ofs, placement, _dataSize, _dataSize / std::max<uint16_t>(_header.blockAlign, 1));
 
-        case FLT_32_DATA:
-//            _loadFlt32Data();
-            break;
-    }
+    closeWritten(ofs, path);
 }
 
 
-WavFile::Header WavFile::getHeader() const {
-    return _header;
-}
+template<typename T>
+void WavFile::_saveData(const std::string& path) {
+    std::ofstream ofs(path, std::ios::out|std::ios::binary|std::ios::trunc);
 
+    checkCreated(ofs, path);
 
-WavFile::Data_i8 WavFile::getInt8Data() throw (WrongDataTypeException) {
-    if (_dataType != INT_8_DATA) {
-        throw WrongDataTypeException(std::string("File '") + _filePath +
-                                     std::string("' doesn't contain INT_8_DATA!"));
+    uint64_t numFrames = _numLoadedFrames<T>();
+    uint64_t dataSize = numFrames * _header.numChannels * sizeof (T);
+    RiffLayout::Placement placement;
+
+    _stats.addWritten(dataSize);
+
+    {
+        StageTimer timer(_stats, WavStats::WRITE_STAGE);
+        placement = _layout.writeHead(ofs, getFormatChunk(), dataSize);
     }
 
-    return _int8_data;
-}
+    if (_storageLayout == INTERLEAVED_STORAGE) {
+        StageTimer timer(_stats, WavStats::WRITE_STAGE, numFrames);
+        ofs.write((const char*) _buffer<T>().data(), dataSize);
+    } else {
+        // Interleave a block at a time into one buffer while the writer
+        // thread puts the previous block on disk. Lazy blocks that haven't
+        // changed are copied from the mapping as they are.
+        const uint64_t blockFrames = CACHE_BLOCK_FRAMES;
+        uint64_t frameSize = _header.numChannels * sizeof (T);
+        AsyncWriter writer(ofs, blockFrames * frameSize);
+
+        for (uint64_t first = 0; first < numFrames; first += blockFrames) {
+            uint64_t count = std::min(blockFrames, numFrames - first);
+            T* block;
+
+            {
+                // Waits for the writer thread to hand back its other buffer.
+                StageTimer timer(_stats, WavStats::WRITE_STAGE, count);
+                block = (T*) writer.getBuffer();
+            }
 
+            StageTimer timer(_stats, WavStats::ENCODE_STAGE, count);
 
-WavFile::Data_i16 WavFile::getInt16Data() throw (WrongDataTypeException) {
-    if (_dataType != INT_8_DATA) {
-        throw WrongDataTypeException(std::string("File '") + _filePath +
-                                     std::string("' doesn't contain INT_16_DATA!"));
-    }
+            if (_isClean(first / blockFrames)) {
+                memcpy((void*) block, _mappedView<T>().frame(first), count * frameSize);
+                writer.submit(count * frameSize);
+                continue;
+            }
 
-    return _int16_data;
-}
+            _forFrames<T>(first, count, false, [&](T* const* channels, uint64_t from, uint64_t to) {
+                T* dst = block + (from - first) * _header.numChannels;
 
+                ThreadPool::shared().parallelRanges(to - from, MIN_RANGE_FRAMES, [&](uint64_t a, uint64_t b) {
+                    FrameKernels::interleave(channels, dst, a, b - a, _header.numChannels, FrameKernels::Copy<T>());
+                });
+            });
 
-WavFile::Data_i24 WavFile::getInt24Data() throw (WrongDataTypeException) {
-    if (_dataType != INT_24_DATA) {
-        throw WrongDataTypeException(std::string("File '") + _filePath +
-                                     std::string("' doesn't contain INT_24_DATA!"));
+            writer.submit(count * frameSize);
+        }
+
+        StageTimer timer(_stats, WavStats::WRITE_STAGE);
+        finishWriting(writer, ofs, path);
     }
 
-    return _int24_data;
+    StageTimer timer(_stats, WavStats::WRITE_STAGE);
+    _layout.writeTail(ofs, placement, dataSize, numFrames);
+
+    closeWritten(ofs, path);
 }
 
 
-WavFile::Data_f32 WavFile::getFlt32Data() throw (WrongDataTypeException) {
-    if (_dataType != FLT_32_DATA) {
-        throw WrongDataTypeException(std::string("File '") + _filePath +
-                                     std::string("' doesn't contain FLT_32_DATA!"));
+void WavFile::saveAs(const std::string& path, DataType dataType, bool dither) {
+    // Reads from the file itself when nothing is loaded or mapped.
+    bool keepMapping = _dataLoaded || isMapped();
+
+    if (!keepMapping) {
+        mapData();
     }
 
-    return _flt32_data;
-}
+    DataType sourceType = _dataLoaded ? getProcessingType() : _dataType;
 
+    if (dataType == _dataType && sourceType == _dataType) {
+        save(path);
 
-void WavFile::mixWith(WavFile& otherFile) throw (DifferentNumChannelsException,
-                                                       DifferentBitsPerSampleException) {
-    if (_header.numChannels != otherFile._header.numChannels) {
-        throw DifferentNumChannelsException(std::string("Files '") + _filePath +
-                                            std::string("' and '") + otherFile._filePath +
-                                            std::string("' have different numChannels!"));
+        if (!keepMapping) {
+            _mappedFile.reset();
+        }
+        return;
     }
 
-    if (_header.bitsPerSample != otherFile._header.bitsPerSample) {
-        throw DifferentBitsPerSampleException(std::string("Files '") + _filePath +
-                                              std::string("' and '") + otherFile._filePath +
-                                              std::string("' have different bitsPerSample!"));
-    }
+    const std::string& target = path.empty() ? _filePath : path;
+    bool inPlace = target == _filePath;
+    std::string outPath = inPlace ? target + ".part" : target;
 
-    switch (_dataType) {
+    switch (sourceType) {
         case INT_8_DATA:
-            _mixInt8Data(otherFile);
+            _saveConverted<int8_t>(outPath, dataType, dither);
             break;
 
         case INT_16_DATA:
-            _mixInt16Data(otherFile);
+            _saveConverted<int16_t>(outPath, dataType, dither);
             break;
 
         case INT_24_DATA:
-            _mixInt24Data(otherFile);
+            _saveConverted<Int24>(outPath, dataType, dither);
             break;
 
         case FLT_32_DATA:
-            _mixFlt32Data(otherFile);
+            _saveConverted<float>(outPath, dataType, dither);
             break;
     }
-}
 
+    if (!keepMapping || inPlace) {
+        _mappedFile.reset();
+    }
 
-void WavFile::addMonoFrom(WavFile& otherFile) throw (NotMonoException) {
-    if (otherFile._header.numChannels != 1) {
-        throw NotMonoException(std::string("File '") + otherFile._filePath +
-                               std::string("' haven't mono track!"));
+    if (inPlace) {
+        std::remove(target.c_str());
+        std::rename(outPath.c_str(), target.c_str());
+        _parseLayout();
+        _readDataType();
+        _dropData();
     }
+}
 
-    switch (_dataType) {
-        case INT_8_DATA:
-            _addMonoInt8Data(otherFile);
-            break;
 
-        case INT_16_DATA:
-            _addMonoInt16Data(otherFile);
-            break;
+void WavFile::_dropData() {
+    _int8_data.clear();
+    _int16_data.clear();
+    _int24_data.clear();
+    _flt32_data.clear();
+    _int8_buffer.clear();
+    _int16_buffer.clear();
+    _int24_buffer.clear();
+    _flt32_buffer.clear();
+    _cache.reset();
+    _dataLoaded = false;
+}
 
-        case INT_24_DATA:
-            _addMonoInt24Data(otherFile);
-            break;
 
-        case FLT_32_DATA:
-            _addMonoFlt32Data(otherFile);
-            break;
-    }
+// True for a block of lazy storage that still matches the mapped file.
+bool WavFile::_isClean(uint64_t blockIndex) const {
+    return _storageLayout == LAZY_STORAGE && _cache && isMapped() && !_cache->isDirty(blockIndex);
 }
 
 
-void WavFile::_loadInt8Data() {
-    std::ifstream ifs(_filePath, std::ios::in | std::ios::binary);
+template<typename S>
+void WavFile::_readMappedBlock(float* block, uint64_t first, uint64_t numFrames) {
+    uint64_t numChannels = _header.numChannels;
+    const S* src = _mappedView<S>().frame(first);
 
-    if (!ifs) {
-        throw FileNotExistException(std::string("File '") + _filePath +
-                                    std::string("' doesn't exist!"));
-    }
+    ThreadPool::shared().parallelRanges(numFrames * numChannels, MIN_RANGE_FRAMES * numChannels,
+                                        [&](uint64_t from, uint64_t to) {
+        convertSamples(src + from, block + from, to - from);
+    });
+}
 
-    char* headBuf = new char[44];
 
-    ifs.read((char*)headBuf, sizeof(Header));
+// Frames [first, first + numFrames) as interleaved normalized floats.
+template<typename T>
+void WavFile::_readFloatBlock(float* block, uint64_t first, uint64_t numFrames) {
+    uint64_t numChannels = _header.numChannels;
 
-    delete[] headBuf;
+    if (!_dataLoaded || _isClean(first / CACHE_BLOCK_FRAMES)) {
+        // The mapping holds the file's own format, whatever T is.
+        switch (_dataType) {
+            case INT_8_DATA:
+                _readMappedBlock<int8_t>(block, first, numFrames);
+                break;
 
-    for (int i = 0; i < _header.numChannels; i++) {
-        _int8_data.push_back(std::vector<int8_t>());
-    }
+            case INT_16_DATA:
+                _readMappedBlock<int16_t>(block, first, numFrames);
+                break;
 
-    int8_t* buf;
+            case INT_24_DATA:
+                _readMappedBlock<Int24>(block, first, numFrames);
+                break;
 
-    try {
-        buf = new int8_t[_header.numChannels];
-    } catch (std::bad_alloc e) {
-        std::cerr << e.what() << std::endl;
-        ifs.close();
+            case FLT_32_DATA:
+                _readMappedBlock<float>(block, first, numFrames);
+                break;
+        }
         return;
     }
 
-    do {
-        ifs.read((char*) buf, sizeof (buf));
+    if (_storageLayout == INTERLEAVED_STORAGE) {
+        const T* src = _buffer<T>().data() + first * numChannels;
 
-        for (int i = 0; i < _header.numChannels; i++) {
-            _int8_data.at(i).push_back(buf[i]);
-        }
-    } while (!ifs.eof());
+        ThreadPool::shared().parallelRanges(numFrames * numChannels, MIN_RANGE_FRAMES * numChannels,
+                                            [&](uint64_t from, uint64_t to) {
+            convertSamples(src + from, block + from, to - from);
+        });
+        return;
+    }
 
-    delete[] buf;
+    _forFrames<T>(first, numFrames, false, [&](T* const* channels, uint64_t from, uint64_t to) {
+        float* dst = block + (from - first) * numChannels;
 
-    ifs.close();
+        ThreadPool::shared().parallelRanges(to - from, MIN_RANGE_FRAMES, [&](uint64_t a, uint64_t b) {
+            FrameKernels::interleave(channels, dst, a, b - a, numChannels, SampleConverter<T, float>());
+        });
+    });
 }
 
 
-void WavFile::_loadInt16Data() {
-    std::ifstream ifs(_filePath, std::ios::binary);
+template<typename T>
+void WavFile::_saveConverted(const std::string& path, DataType dataType, bool dither) {
+    static const uint16_t BITS[] = { 8, 16, 24, 32 };
 
-    if (!ifs) {
-        throw FileNotExistException(std::string("File '") + _filePath +
-                                    std::string("' doesn't exist!"));
-    }
+    Header header = _header;
+    header.audioFormat = dataType == FLT_32_DATA ? RiffLayout::WAVE_FORMAT_IEEE_FLOAT : RiffLayout::WAVE_FORMAT_PCM;
+    header.bitsPerSample = BITS[dataType];
+    header.blockAlign = header.numChannels * (header.bitsPerSample / 8);
+    header.byteRate = header.sampleRate * header.blockAlign;
 
-    ifs.seekg(std::streampos(44));
+    // Keep an extensible fmt, channel mask included, with the new sample format.
+    std::vector<char> format = getFormatChunk();
+    uint16_t tag;
+    memcpy(&tag, format.data(), sizeof (tag));
 
-    for (int i = 0; i < _header.numChannels; i++) {
-        _int16_data.push_back(std::vector<int16_t>());
+    if (tag == RiffLayout::WAVE_FORMAT_EXTENSIBLE && format.size() >= 26) {
+        memcpy(format.data() + 2, &header.numChannels, 14);
+        memcpy(format.data() + 18, &header.bitsPerSample, sizeof (header.bitsPerSample));
+        memcpy(format.data() + 24, &header.audioFormat, sizeof (header.audioFormat));
+    } else {
+        memcpy(format.data(), &header.audioFormat, 16);
     }
 
-    int16_t* buf;
+    uint64_t numFrames = _dataLoaded ? _numLoadedFrames<T>() : _mappedView<T>().numFrames();
+    bool reduces = dataType != FLT_32_DATA && (std::is_same<T, float>::value || dataType < _dataType);
 
-    try {
-        buf = new int16_t[_header.numChannels];
-    } catch (std::bad_alloc e) {
-        std::cerr << e.what() << std::endl;
-        ifs.close();
-        return;
-    }
-    for (int i = 0; i < _header.numChannels; i++){
-        _int16_data.at(i).reserve(_header.subchunk2Size/(_header.numChannels*(_header.bitsPerSample/8)));
-    }
-    try{
-    while (ifs.read((char*)buf, sizeof (buf[0])*_header.numChannels)) {
-        for (int i = 0; i < _header.numChannels; i++) {
-            _int16_data.at(i).push_back(buf[i]);
-        }
-    }
-    }
-    catch (std::bad_alloc err){
-        std::cerr << err.what() << std::endl;
-        ifs.close();
-        return;
-    }
+    switch (dataType) {
+        case INT_8_DATA:
+            _writeConverted<T, int8_t>(path, format, numFrames, dither && reduces);
+            break;
 
-    delete[] buf;
+        case INT_16_DATA:
+            _writeConverted<T, int16_t>(path, format, numFrames, dither && reduces);
+            break;
 
-//    for (int i = 0; i < _header.numChannels; i++)
-//        _int16_data.at(i).pop_back();
+        case INT_24_DATA:
+            _writeConverted<T, Int24>(path, format, numFrames, dither && reduces);
+            break;
 
-    ifs.close();
+        case FLT_32_DATA:
+            _writeConverted<T, float>(path, format, numFrames, false);
+            break;
+    }
 }
 
 
-void WavFile::_loadInt24Data() {
-    std::ifstream ifs(_filePath);
+// Each block is read into floats by channel, requantized in one go into the
+// writer's free buffer and written out while the next block is prepared.
+template<typename T, typename U>
+void WavFile::_writeConverted(const std::string& path, const std::vector<char>& format,
+                              uint64_t numFrames, bool dither) {
+    const uint64_t blockFrames = CACHE_BLOCK_FRAMES;
 
-    if (!ifs) {
-        throw FileNotExistException(std::string("File '") + _filePath +
-                                    std::string("' doesn't exist!"));
-    }
+    std::ofstream ofs(path, std::ios::out|std::ios::binary|std::ios::trunc);
 
-    char* headBuf = new char[44];
+    checkCreated(ofs, path);
 
-    ifs.read((char*)headBuf, sizeof(Header));
+    uint64_t frameSize = _header.numChannels * sizeof (U);
+    uint64_t dataSize = numFrames * frameSize;
+    SampleBuffer<float> block;
+    TpdfDither noise;
 
-    delete[] headBuf;
+    block.allocate(_header.numChannels, blockFrames, SampleBuffer<float>::INTERLEAVED);
 
-    for (int i = 0; i < _header.numChannels; i++) {
-        _int24_data.push_back(std::vector<Int24>());
-    }
+    RiffLayout::Placement placement;
 
-    Int24* buf;
+    _stats.addWritten(dataSize);
 
-    try {
-        buf = new Int24[_header.numChannels];
-    } catch (std::bad_alloc e) {
-        std::cerr << e.what() << std::endl;
-        ifs.close();
-        return;
+    {
+        StageTimer timer(_stats, WavStats::WRITE_STAGE);
+        placement = _layout.writeHead(ofs, format, dataSize);
     }
 
-    do {
-        ifs.read((char*) buf, sizeof (buf[0])*_header.numChannels);
-
-        for (int i = 0; i < _header.numChannels; i++) {
-            _int24_data.at(i).push_back(buf[i]);
-        }
-    } while (!ifs.eof());
-
-    delete[] buf;
-
-    ifs.close();
-}
+    AsyncWriter writer(ofs, blockFrames * frameSize);
 
+    for (uint64_t first = 0; first < numFrames; first += blockFrames) {
+        uint64_t count = std::min(blockFrames, numFrames - first);
+        U* out;
 
-void WavFile::_mixInt8Data(WavFile& otherFile) {
-    std::vector<std::vector<int8_t>::iterator> iters_1;
-    decltype (iters_1) iters_2;
+        {
+            StageTimer timer(_stats, WavStats::WRITE_STAGE, count);
+            out = (U*) writer.getBuffer();
+        }
 
-    for (int i = 0; i < _header.numChannels; ++i) {
-        iters_1.push_back(_int8_data.at(i).begin());
-        iters_2.push_back(otherFile._int8_data.at(i).begin());
+        StageTimer timer(_stats, WavStats::ENCODE_STAGE, count);
+        _readFloatBlock<T>(block.data(), first, count);
+        quantize(block.data(), out, count * _header.numChannels, dither ? &noise : nullptr);
+        writer.submit(count * frameSize);
     }
 
-    while (iters_1.at(0) != _int8_data.at(0).end()) {
-        for (int i = 0; i < _header.numChannels; ++i) {
-            *iters_1.at(i) += *iters_2.at(i);
-            (iters_1.at(i))++;
-            (iters_2.at(i))++;
-        }
-    }
+    StageTimer timer(_stats, WavStats::WRITE_STAGE);
+    finishWriting(writer, ofs, path);
+    _layout.writeTail(ofs, placement, dataSize, numFrames);
+
+    closeWritten(ofs, path);
 }
 
 
-void WavFile::_mixInt16Data(WavFile& otherFile) {
-    std::vector<std::vector<int16_t>::iterator> iters_1;
-    decltype (iters_1) iters_2;
+void WavFile::overVoice(WavFile & otherFile, double attack, double release, double silence, double threshold, double ratio){
+    _checkProcessingType(otherFile);
 
-    for (int i = 0; i < _header.numChannels; ++i) {
-        iters_1.push_back(_int16_data.at(i).begin());
-        iters_2.push_back(otherFile._int16_data.at(i).begin());
-    }
+    DataType type = getProcessingType();
 
-    while (iters_1.at(0) != _int16_data.at(0).end() && iters_2.at(0) != otherFile._int16_data.at(0).end()) {
-        for (int i = 0; i < _header.numChannels; ++i) {
-            *iters_1.at(i) += *iters_2.at(i);
-            (iters_1.at(i))++;
-            (iters_2.at(i))++;
-        }
+    if ((type != INT_16_DATA && type != INT_24_DATA && type != FLT_32_DATA) || otherFile.getProcessingType() != type) {
+        throw WrongDataTypeException(std::string("Files '") + _filePath +
+                                     std::string("' and '") + otherFile._filePath +
+                                     std::string("' must both contain INT_16_DATA, INT_24_DATA or FLT_32_DATA!"));
     }
-}
 
+    _ensureLoaded();
+    otherFile._ensureLoaded();
 
-void WavFile::_mixInt24Data(WavFile& otherFile) {
-    std::vector<std::vector<Int24>::iterator> iters_1;
-    decltype (iters_1) iters_2;
+    // The voice level is still judged on 16-bit samples, so float processing
+    // and 24-bit files duck at the same frames; the gains are applied without
+    // rounding to 16 bits.
+    switch (type) {
+        case FLT_32_DATA:
+            _overVoiceData<float>(otherFile, attack, release, silence, Decibel<int16_t>(threshold), Decibel<int16_t>(ratio));
+            break;
 
-    for (int i = 0; i < _header.numChannels; ++i) {
-        iters_1.push_back(_int24_data.at(i).begin());
-        iters_2.push_back(otherFile._int24_data.at(i).begin());
-    }
+        case INT_16_DATA:
+            _overVoiceData<int16_t>(otherFile, attack, release, silence, Decibel<int16_t>(threshold), Decibel<int16_t>(ratio));
+            break;
 
-    while (iters_1.at(0) != _int24_data.at(0).end()) {
-        for (int i = 0; i < _header.numChannels; ++i) {
-            *iters_1.at(i) += *iters_2.at(i);
-            (iters_1.at(i))++;
-            (iters_2.at(i))++;
-        }
+        case INT_24_DATA:
+            _overVoiceData<Int24>(otherFile, attack, release, silence, Decibel<int16_t>(threshold), Decibel<int16_t>(ratio));
+            break;
+
+        case INT_8_DATA:
+            break;
     }
 }
 
 
-void WavFile::_mixFlt32Data(WavFile& otherFile) {
-    std::vector<std::vector<float>::iterator> iters_1;
-    decltype (iters_1) iters_2;
+void WavFile::setBlockDetection(bool enabled, LevelDetector::Mode mode, double window, LevelDetector::Linking linking) {
+    _blockDetection = enabled;
+    _detectionMode = mode;
+    _detectionWindow = window;
+    _detectionLinking = linking;
+}
 
-    for (int i = 0; i < _header.numChannels; ++i) {
-        iters_1.push_back(_flt32_data.at(i).begin());
-        iters_2.push_back(otherFile._flt32_data.at(i).begin());
-    }
 
-    while (iters_1.at(0) != _flt32_data.at(0).end()) {
-        for (int i = 0; i < _header.numChannels; ++i) {
-            *iters_1.at(i) += *iters_2.at(i);
-            (iters_1.at(i))++;
-            (iters_2.at(i))++;
-        }
-    }
+bool WavFile::isBlockDetection() const {
+    return _blockDetection;
 }
 
 
-void WavFile::_addMonoInt8Data(WavFile& otherFile) {
-    std::vector<std::vector<int8_t>::iterator> iters_1;
-    std::vector<int8_t>::iterator iters_2 = otherFile._int8_data.at(0).begin();
+void WavFile::setResampleQuality(Resampler::Quality quality) {
+    _resampleQuality = quality;
+}
 
-    for (int i = 0; i < _header.numChannels; ++i) {
-        iters_1.push_back(_int8_data.at(i).begin());
-    }
 
-    while (iters_2 != otherFile._int8_data.at(0).end()) {
-        for (int i = 0; i < _header.numChannels; ++i) {
-            *iters_1.at(i) += *iters_2 / _header.numChannels;
-            (iters_1.at(i))++;
-            iters_2++;
-        }
-    }
+Resampler::Quality WavFile::getResampleQuality() const {
+    return _resampleQuality;
 }
 
 
-void WavFile::_addMonoInt16Data(WavFile& otherFile) {
-    std::vector<std::vector<int16_t>::iterator> iters_1;
-    std::vector<int16_t>::iterator iters_2 = otherFile._int16_data.at(0).begin();
+void WavFile::setOverviewBuilding(bool enabled) {
+    _overviewBuilding = enabled;
+}
 
-    for (int i = 0; i < _header.numChannels; ++i) {
-        iters_1.push_back(_int16_data.at(i).begin());
-    }
 
-    while (iters_2 != otherFile._int16_data.at(0).end()) {
-        for (int i = 0; i < _header.numChannels; ++i) {
-            *iters_1.at(i) += *iters_2 / _header.numChannels;
-            (iters_1.at(i))++;
-            iters_2++;
-        }
-    }
+bool WavFile::isOverviewBuilding() const {
+    return _overviewBuilding;
 }
 
 
-void WavFile::_addMonoInt24Data(WavFile& otherFile) {
-    std::vector<std::vector<Int24>::iterator> iters_1;
-    std::vector<Int24>::iterator iters_2 = otherFile._int24_data.at(0).begin();
-
-    for (int i = 0; i < _header.numChannels; ++i) {
-        iters_1.push_back(_int24_data.at(i).begin());
+std::shared_ptr<const Overview> WavFile::getOverview() {
+    if (_overview && _overview->describes(_filePath)) {
+        return _overview;
     }
 
-    while (iters_2 != otherFile._int24_data.at(0).end()) {
-        for (int i = 0; i < _header.numChannels; ++i) {
-            *iters_1.at(i) += *iters_2 / _header.numChannels;
-            (iters_1.at(i))++;
-            iters_2++;
+    try {
+        std::shared_ptr<const Overview> overview = std::make_shared<Overview>(Overview::load(_filePath));
+
+        if (overview->describes(_filePath)) {
+            _overview = overview;
+            return _overview;
         }
+    } catch (const BadOverviewException&) {
+        // missing or unreadable, built below
     }
+
+    _overview = _buildOverview();
+    return _overview;
 }
 
 
-void WavFile::_addMonoFlt32Data(WavFile& otherFile) {
-    std::vector<std::vector<float>::iterator> iters_1;
-    std::vector<float>::iterator iters_2 = otherFile._flt32_data.at(0).begin();
+std::shared_ptr<const Overview> WavFile::_buildOverview() {
+    bool keepMapping = isMapped();
 
-    for (int i = 0; i < _header.numChannels; ++i) {
-        iters_1.push_back(_flt32_data.at(i).begin());
+    if (!keepMapping) {
+        mapData();
     }
 
-    while (iters_2 != otherFile._flt32_data.at(0).end()) {
-        for (int i = 0; i < _header.numChannels; ++i) {
-            *iters_1.at(i) += *iters_2 / _header.numChannels;
-            (iters_1.at(i))++;
-            iters_2++;
-        }
-    }
-}
+    std::shared_ptr<Overview> overview = std::make_shared<Overview>(_header.numChannels, getNumFrames());
 
-void WavFile::save(const std::string& path) {
-    _saveInt16(path);           //TODO: make this shit work with all types
-}
+    switch (_dataType) {
+        case INT_8_DATA:
+            _scanOverview<int8_t>(*overview);
+            break;
 
-void WavFile::_saveInt16(const std::string& path){
-    std::ofstream ofs;
+        case INT_16_DATA:
+            _scanOverview<int16_t>(*overview);
+            break;
 
-    ofs.open(path.empty() ? _filePath : path, std::ios::out|std::ios::binary|std::ios::trunc);
+        case INT_24_DATA:
+            _scanOverview<Int24>(*overview);
+            break;
 
-//    if (!ofs){
-//        throw FileNotExistException(std::string("File '") + _filePath +
-//                                    std::string("' doesn't exist!"));
-//    }
+        case FLT_32_DATA:
+            _scanOverview<float>(*overview);
+            break;
+    }
 
-    ofs.write((char*)&_header, sizeof(_header));
+    overview->finish();
 
-    std::vector < std::vector < int16_t >::iterator > iterators;
+    // Without a sidecar, e.g. in a read-only directory, the overview still
+    // serves this WavFile; other ones build their own.
+    overview->save(_filePath);
 
-    for(int i = 0; i < _header.numChannels; i++){
-        iterators.push_back(_int16_data.at(i).begin());
+    if (!keepMapping) {
+        _mappedFile.reset();
     }
 
-    unsigned long long count = 0;
+    return overview;
+}
 
-    while (_dataInt16End(iterators)){
-        int16_t buf[_header.numChannels];
-        for (int i = 0; i < _header.numChannels; i++){
-            if (iterators[i] != _int16_data.at(i).end()){
-                buf[i] = *(iterators[i]);
-                iterators[i]++;
-            }
-            else{
-                buf[i] = 0;
-            }
-        }
-        ofs.write((char*)buf, sizeof(buf[0])*_header.numChannels);
 
-        count++;
-    }
+// The mapped samples, a few overview blocks per task.
+template<typename S>
+void WavFile::_scanOverview(Overview& overview) const {
+    static const uint64_t CHUNK_FRAMES = 64 * Overview::BLOCK_FRAMES;
 
-    count *= _header.numChannels * _header.bitsPerSample / 8;
+    InterleavedView<S> view = _mappedView<S>();
+    uint64_t numFrames = std::min(view.numFrames(), overview.getNumFrames());
+    uint64_t numChannels = _header.numChannels;
 
-    ofs.close();
-}
+    ThreadPool::shared().parallelFor((numFrames + CHUNK_FRAMES - 1) / CHUNK_FRAMES, [&](uint64_t chunk) {
+        uint64_t first = chunk * CHUNK_FRAMES;
+        uint64_t count = std::min(CHUNK_FRAMES, numFrames - first);
+        std::vector<float> samples(count * numChannels);
 
-void WavFile::overVoice(WavFile & otherFile, double attack, double release, double silence, double threshold, double ratio){
-    _overVoiceInt16(otherFile, attack, release, silence, Decibel<int16_t>(threshold), Decibel<int16_t>(ratio));
+        convertSamples(view.frame(first), samples.data(), count * numChannels);
+        overview.addFrames(samples.data(), first, count);
+    });
 }
 
-void WavFile::_overVoiceInt16(WavFile& otherFile, double attack, double release, double silence, Decibel<int16_t> threshold, Decibel<int16_t> ratio){
-    typedef unsigned long long ultInt;
-    typedef std::vector<int16_t>::iterator iter_type;
 
-    Decibel< int16_t > tmp;
+template<typename T>
+void WavFile::_overVoiceData(WavFile& otherFile, double attack, double release, double silence, Decibel<int16_t> threshold, Decibel<int16_t> ratio){
+    static const uint64_t GAIN_BLOCK = 65536;
 
-    std::vector< iter_type > iteratorsOrig;
-    std::vector< iter_type > iteratorsVoice;
+    DuckingEngine engine(_header.sampleRate, attack, release, silence, ratio.getVal(), OVERVOICE_PREROLL);
+    DecibelGate<int16_t> gate(threshold);
 
-    for (int i = 0; i < _header.numChannels; i++)
-        iteratorsOrig.push_back(_int16_data.at(i).begin());
+    uint16_t voiceChannels = otherFile._header.numChannels;
+    uint64_t origEnd = _numLoadedFrames<T>();
+    uint64_t voiceEnd = otherFile._numLoadedFrames<T>();
+    uint64_t q = 0;
 
-    ultInt offset = (ultInt)(attack*_header.sampleRate);
+    // A voice at another rate is resampled to this one as it is read.
+    std::vector<ResampledReader> readers;
+    std::vector<float> resampled;
 
-    for (int i = 0; i < otherFile._header.numChannels; i++){
-        otherFile._int16_data.at(i).insert(otherFile._int16_data.at(i).begin(), 9600, 0);
-    }
+    if (otherFile._header.sampleRate != _header.sampleRate) {
+        Resampler resampler(otherFile._header.sampleRate, _header.sampleRate, _resampleQuality);
+
+        for (int i = 0; i < voiceChannels; i++)
+            readers.push_back(otherFile._resampled<T>(i, resampler));
 
-    for (int i = 0; i < otherFile._header.numChannels; i++){
-        iteratorsVoice.push_back(otherFile._int16_data.at(i).begin() + offset);
+        voiceEnd = resampler.getOutputFrames(voiceEnd);
+        resampled.resize(GAIN_BLOCK);
     }
 
-    int16_t mux;
+    // Voice frames are read a block at a time, interleaved 16-bit for the
+    // legacy detector, one float array per channel for the LevelDetector.
+    std::unique_ptr<LevelDetector> detector;
+    std::vector<std::vector<float>> lanes;
+    std::vector<const float*> lanePointers;
+    std::vector<char> loud;
+    std::vector<int16_t> voice;
+    uint64_t voiceFirst = 0, voiceLast = 0;
+    std::vector<double> gains(GAIN_BLOCK);
+
+    if (_blockDetection) {
+        uint64_t windowFrames = (uint64_t) std::llround(_detectionWindow * _header.sampleRate);
+
+        detector.reset(new LevelDetector(_detectionMode, _detectionLinking, threshold.getAmplitude(),
+                                         voiceChannels, windowFrames));
+        lanes.assign(voiceChannels, std::vector<float>(GAIN_BLOCK));
+        loud.resize(GAIN_BLOCK);
+
+        for (int i = 0; i < voiceChannels; i++)
+            lanePointers.push_back(lanes[i].data());
+    } else {
+        voice.resize(GAIN_BLOCK * voiceChannels);
+    }
 
-    ultInt sl = 0;
-    double envelope = 0.;
+    // Gains are worked out a block at a time and then applied channel by channel.
+    for (uint64_t p = 0; p < origEnd && !engine.isDone(); ){
+        uint64_t n = 0;
 
-    ultInt COUNT = 0;
+        {
+            StageTimer envelopeTimer(_stats, WavStats::ENVELOPE_STAGE);
 
-    while (iteratorsOrig.at(0) != _int16_data.at(0).end() && iteratorsVoice.at(0) != otherFile._int16_data.at(0).end()){
-        mux = 0;
-        COUNT++;
-        for (unsigned i = 0; i < iteratorsVoice.size(); i++){
-            mux = std::max(mux, *( iteratorsVoice.at(i) ) );
-        }
+            for (; n < GAIN_BLOCK && p + n < origEnd; n++){
+                while (!engine.isReady()){
+                    if (q == voiceEnd){
+                        engine.endVoice();
+                        break;
+                    }
 
-        tmp.calculateRatio(mux / iteratorsVoice.size());
-        if (tmp > threshold){
-            sl=0;
-            if (envelope < ratio.getVal()){
-                envelope += ratio.getVal()/(attack*_header.sampleRate);
-            }
-            else
-            {
-                envelope = ratio.getVal();
-            }
-        }
-        else if (sl < (ultInt)(silence*_header.sampleRate) && envelope != 0){
-            if (envelope < ratio.getVal()){
-                envelope += ratio.getVal()/(attack*_header.sampleRate);
-            }
-            else
-            {
-                envelope = ratio.getVal();
-            }
-            sl++;
-        }
-        else{
-            if (sl == (ultInt)(silence*_header.sampleRate)){
-                for (unsigned i = 0; i < iteratorsOrig.size(); i++){
-                    std::reverse_iterator< iter_type > rit(iteratorsOrig.at(i));
-                    for (ultInt j = 0; j < silence*_header.sampleRate; j++){
-                        rit++;
-                        iteratorsOrig.at(i) = rit.base();
-                        *(iteratorsOrig.at(i)) = *(iteratorsOrig.at(i)) - Decibel<short>(-15);
+                    if (q == voiceLast){
+                        voiceFirst = q;
+                        voiceLast = std::min(q + GAIN_BLOCK, voiceEnd);
+
+                        for (int i = 0; i < voiceChannels; i++){
+                            if (!readers.empty()){
+                                if (detector){
+                                    readers[i].read(lanes[i].data(), voiceLast - voiceFirst);
+                                    continue;
+                                }
+
+                                uint64_t count = readers[i].read(resampled.data(), voiceLast - voiceFirst);
+
+                                for (uint64_t f = 0; f < count; f++)
+                                    voice[f * voiceChannels + i] = toGateSample(resampled[f]);
+                                continue;
+                            }
+
+                            otherFile._forPieces<T>(i, voiceFirst, voiceLast - voiceFirst, false,
+                                                    [&](ChannelView<T> src, uint64_t from, uint64_t to){
+                                if (detector){
+                                    SampleConverter<T, float> convert;
+
+                                    for (uint64_t f = from; f < to; f++)
+                                        lanes[i][f - voiceFirst] = convert(src[f - from]);
+                                    return;
+                                }
+
+                                for (uint64_t f = from; f < to; f++)
+                                    voice[(f - voiceFirst) * voiceChannels + i] = toGateSample(src[f - from]);
+                            });
+                        }
+
+                        if (detector)
+                            detector->process(lanePointers.data(), voiceLast - voiceFirst, loud.data());
                     }
-                }
 
-                for (unsigned i = 0; i < iteratorsVoice.size(); i++){
-                    std::reverse_iterator < iter_type > rit(iteratorsVoice.at(i));
-                    for (ultInt j = 0; j < silence*_header.sampleRate; j++)
-                    rit++;
-                    iteratorsVoice.at(i) = rit.base();
+                    if (detector)
+                        engine.pushVoice(loud[q - voiceFirst] != 0);
+                    else
+                        engine.pushVoice(DuckingEngine::isLoud(&voice[(q - voiceFirst) * voiceChannels], voiceChannels, gate));
+                    q++;
                 }
-                sl++;
+
+                if (engine.isDone())
+                    break;
+
+                engine.next();
+                gains[n] = engine.getGain();
             }
 
-            if (envelope > 0) envelope -= ratio.getVal()/(release*_header.sampleRate);
-            else envelope = 0;
+            envelopeTimer.setFrames(n);
         }
 
-        for (unsigned i = 0; i < iteratorsOrig.size(); i++){
-            *(iteratorsOrig.at(i)) = *(iteratorsOrig.at(i)) - Decibel<short>(envelope);
-        }
+        StageTimer gainTimer(_stats, WavStats::GAIN_STAGE, n);
 
-        for (unsigned i = 0; i < iteratorsOrig.size(); i++){
-            iteratorsOrig.at(i)++;
-        }
+        _forChannelRanges(n, [&](int i, uint64_t first, uint64_t last){
+            _forPieces<T>(i, p + first, last - first, true, [&](ChannelView<T> dst, uint64_t from, uint64_t to){
+                DecibelMath::applyGain(dst.data(), dst.stride(), gains.data() + (from - p), to - from);
+            });
+        });
 
-        for (unsigned i = 0; i < iteratorsVoice.size(); i++){
-            iteratorsVoice.at(i)++;
-        }
+        p += n;
     }
 }
 
+
+void WavFile::setNumThreads(unsigned numThreads) {
+    ThreadPool::setSharedThreads(numThreads);
+}
+
+
+void WavFile::setBufferPool(BufferPool* pool) {
+    BufferPool::setShared(pool);
+}
+
+
+WavStats WavFile::getStats() const {
+    return _stats.getStats();
+}
+
+
+void WavFile::resetStats() {
+    _stats.reset();
+}
+
+
+// Every channel is cut into the same time ranges, enough of them in all to
+// keep each thread of the pool busy with a few.
+void WavFile::_forChannelRanges(uint64_t numFrames, const std::function<void(int, uint64_t, uint64_t)>& body) {
+    ThreadPool& pool = ThreadPool::shared();
+    uint64_t numChannels = _header.numChannels;
+    uint64_t wanted = (pool.getNumThreads() * 4 + numChannels - 1) / numChannels;
+    uint64_t numRanges = std::max<uint64_t>(1, std::min(wanted, numFrames / MIN_RANGE_FRAMES));
+
+    pool.parallelFor(numChannels * numRanges, [&](uint64_t task) {
+        uint64_t r = task % numRanges;
+        body((int) (task / numRanges), numFrames * r / numRanges, numFrames * (r + 1) / numRanges);
+    });
+}
@@ -6,9 +6,21 @@
 #include <cstdint>
 #include <string>
 #include <vector>
+#include <memory>
+#include <functional>
 #include <stdexcept>
 #include "Int24/Int24.h"
 #include "Decibel/decibel.h"
+#include "MappedFile/MappedFile.h"
+#include "RiffLayout/RiffLayout.h"
+#include "SampleView/SampleView.h"
+#include "SampleBuffer/SampleBuffer.h"
+#include "BufferPool/BufferPool.h"
+#include "BlockCache/BlockCache.h"
+#include "WavStats/WavStats.h"
+#include "Resampler/Resampler.h"
+#include "Overview/Overview.h"
+#include "LevelDetector/LevelDetector.h"
 
 
 class WrongDataTypeException : public std::runtime_error {
@@ -51,6 +63,14 @@ class DifferentBitsPerSampleException : public std::runtime_error {
 };
 
 
+class WrongStorageLayoutException : public std::runtime_error {
+    public:
+        WrongStorageLayoutException(std::string errorMessage):
+            std::runtime_error(errorMessage)
+        {}
+};
+
+
 class WavFile {
     public:
         enum DataType {
@@ -60,11 +80,24 @@ class WavFile {
             FLT_32_DATA
         };
 
+        enum StorageLayout {
+            VECTOR_STORAGE,         // one std::vector per channel
+            INTERLEAVED_STORAGE,    // one aligned SampleBuffer, frame after frame
+            PLANAR_STORAGE,         // one aligned SampleBuffer, channel after channel
+            LAZY_STORAGE            // decoded from the mapping a block at a time, on first use
+        };
+
         typedef std::vector<std::vector<int8_t>>    Data_i8;
         typedef std::vector<std::vector<int16_t>>   Data_i16;
         typedef std::vector<std::vector<Int24>>     Data_i24;
         typedef std::vector<std::vector<float>>     Data_f32;
 
+        // body(view, from, to) for the visit accessors, view[0] being frame from.
+        typedef std::function<void(ChannelView<const int8_t>, uint64_t, uint64_t)>  Visitor_i8;
+        typedef std::function<void(ChannelView<const int16_t>, uint64_t, uint64_t)> Visitor_i16;
+        typedef std::function<void(ChannelView<const Int24>, uint64_t, uint64_t)>   Visitor_i24;
+        typedef std::function<void(ChannelView<const float>, uint64_t, uint64_t)>   Visitor_f32;
+
         struct Header {
                 char        chunkId[4];
                 uint32_t    chunkSize;
@@ -82,64 +115,287 @@ class WavFile {
         };
 
 
-        WavFile(const std::string& filePath) throw (FileNotExistException);
+        // overVoice() ducks ahead of the voice by this many frames (less the
+        // attack time); mix the voice back in with this delay to line it up.
+        static const uint64_t OVERVOICE_PREROLL = 9600;
+
+        // Frames per block of LAZY_STORAGE, and the default size of its cache.
+        static const uint64_t CACHE_BLOCK_FRAMES = 65536;
+        static const uint64_t DEFAULT_CACHE_SIZE = 64 << 20;
+
+
+        WavFile(const std::string& filePath) throw (FileNotExistException, BadRiffException);
         WavFile(const Header& header);
 
-        static WavFile& mix(const WavFile& out, const WavFile& in);
+        // Sum of the two files as a new one, as long as the longer of them;
+        // MixBus does the same for any number of files.
+        static WavFile  mix(WavFile& first, WavFile& second)
+                            throw (DifferentNumChannelsException, DifferentBitsPerSampleException);
+
+        // Threads used by loading, mixing, ducking and saving; 0 means one
+        // per hardware thread. Results don't depend on the count.
+        static void     setNumThreads(unsigned numThreads);
+
+        // Pool for the samples of INTERLEAVED_STORAGE, PLANAR_STORAGE and
+        // LAZY_STORAGE and for the save buffers, so that a batch of files
+        // reuses the same memory; nullptr goes back to plain allocations.
+        // VECTOR_STORAGE always uses std::vector. The pool must outlive
+        // every WavFile loaded while it is set.
+        static void     setBufferPool(BufferPool* pool);
+
+        // Time per stage, data handled, allocations and clipping since the
+        // file was opened or the stats were reset. Collected only in builds
+        // with WAVFILE_INSTRUMENTATION defined, all zero otherwise.
+        WavStats    getStats() const;
+        void        resetStats();
 
         void        loadData();
+        void        mapData() throw (FileNotExistException);
+
+        // Where loadData() decodes to; switching after loading converts the data.
+        // With LAZY_STORAGE loadData() only maps the file. Operations decode
+        // just the blocks they touch and keep them in an LRU cache of about
+        // setCacheSize() bytes; changed blocks stay in memory until saved
+        // over the source. Copies of a lazy WavFile share the cache.
+        void            setStorageLayout(StorageLayout layout);
+        StorageLayout   getStorageLayout() const;
+        void            setCacheSize(uint64_t bytes);
+        const BlockCache*   getCache() const;
+        bool        isMapped() const;
+
+        // With float processing loadData() decodes integer samples to
+        // normalized floats, mixWith(), addMonoFrom(), overVoice() and MixBus
+        // work on those without rounding or clamping, and save() quantizes
+        // once at the end, with TPDF dither unless it is turned off; the file
+        // keeps its format. The loaded samples are reached through the Flt32
+        // accessors. Files worked on together must all use it or none.
+        // Switching after loading converts the loaded data. PLANAR_STORAGE
+        // keeps every channel contiguous for vectorized loops.
+        void        setFloatProcessing(bool enabled, bool dither = true);
+        bool        isFloatProcessing() const;
+
+        // Type of the loaded samples: FLT_32_DATA with float processing,
+        // getDataType() otherwise.
+        DataType    getProcessingType() const;
 
         Header      getHeader() const;
+        DataType    getDataType() const;
+        uint64_t    getDataOffset() const;
+        uint64_t    getDataSize() const;
+        uint64_t    getNumFrames() const;
 
+        // Chunk map of the source file and the fmt body to write for the
+        // current header; the original fmt is kept while the format matches.
+        const RiffLayout&   getLayout() const;
+        std::vector<char>   getFormatChunk() const;
+
+        // Copies of the loaded data; the views and take accessors below don't copy.
         Data_i8     getInt8Data() throw (WrongDataTypeException);
         Data_i16    getInt16Data() throw (WrongDataTypeException);
         Data_i24    getInt24Data() throw (WrongDataTypeException);
         Data_f32    getFlt32Data() throw (WrongDataTypeException);
 
-        void        mixWith(WavFile& otherFile) throw (DifferentNumChannelsException,
-                                                             DifferentBitsPerSampleException);
-        void        addMonoFrom(WavFile& otherFile) throw (NotMonoException);
-
+        // Frames [first, first + numFrames) of the loaded data, cut short at
+        // the end. Only the blocks in range are decoded in LAZY_STORAGE.
+        Data_i8     getInt8Range(uint64_t first, uint64_t numFrames) throw (WrongDataTypeException);
+        Data_i16    getInt16Range(uint64_t first, uint64_t numFrames) throw (WrongDataTypeException);
+        Data_i24    getInt24Range(uint64_t first, uint64_t numFrames) throw (WrongDataTypeException);
+        Data_f32    getFlt32Range(uint64_t first, uint64_t numFrames) throw (WrongDataTypeException);
+
+        // Read-only views of one channel of the loaded data, or of frames
+        // [first, first + numFrames) of it, cut short at the end. Nothing is
+        // copied; a view stays valid until the data is changed, relaid out or
+        // dropped. LAZY_STORAGE has no contiguous channels: visit it instead.
+        ChannelView<const int8_t>   getInt8Channel(int channel, uint64_t first = 0, uint64_t numFrames = UINT64_MAX) const
+                                        throw (WrongDataTypeException, WrongStorageLayoutException, std::out_of_range);
+        ChannelView<const int16_t>  getInt16Channel(int channel, uint64_t first = 0, uint64_t numFrames = UINT64_MAX) const
+                                        throw (WrongDataTypeException, WrongStorageLayoutException, std::out_of_range);
+        ChannelView<const Int24>    getInt24Channel(int channel, uint64_t first = 0, uint64_t numFrames = UINT64_MAX) const
+                                        throw (WrongDataTypeException, WrongStorageLayoutException, std::out_of_range);
+        ChannelView<const float>    getFlt32Channel(int channel, uint64_t first = 0, uint64_t numFrames = UINT64_MAX) const
+                                        throw (WrongDataTypeException, WrongStorageLayoutException, std::out_of_range);
+
+        // Calls body on consecutive pieces of the same range, in order: one
+        // piece in memory, one per cached block in LAZY_STORAGE. Throws
+        // WrongDataTypeException and std::out_of_range as above, and lets
+        // whatever body throws through.
+        void        visitInt8Range(int channel, uint64_t first, uint64_t numFrames, const Visitor_i8& body) const;
+        void        visitInt16Range(int channel, uint64_t first, uint64_t numFrames, const Visitor_i16& body) const;
+        void        visitInt24Range(int channel, uint64_t first, uint64_t numFrames, const Visitor_i24& body) const;
+        void        visitFlt32Range(int channel, uint64_t first, uint64_t numFrames, const Visitor_f32& body) const;
+
+        // Hands the loaded data over to the caller and unloads the file.
+        // VECTOR_STORAGE is moved out as it is, other layouts copied once.
+        Data_i8     takeInt8Data() throw (WrongDataTypeException);
+        Data_i16    takeInt16Data() throw (WrongDataTypeException);
+        Data_i24    takeInt24Data() throw (WrongDataTypeException);
+        Data_f32    takeFlt32Data() throw (WrongDataTypeException);
+
+        // Zero-copy interleaved views straight into the mapped data chunk,
+        // valid while the file stays mapped. Require mapData() first, which
+        // copies a data chunk the mapping would leave misaligned for its
+        // samples instead.
+        InterleavedView<int8_t>     getMappedInt8Data() const throw (WrongDataTypeException);
+        InterleavedView<int16_t>    getMappedInt16Data() const throw (WrongDataTypeException);
+        InterleavedView<Int24>      getMappedInt24Data() const throw (WrongDataTypeException);
+        InterleavedView<float>      getMappedFlt32Data() const throw (WrongDataTypeException);
+
+        // this = this * ownGain + other * otherGain, saturating integer samples.
+        // The other file starts delayFrames into this one. Both need the same
+        // bitsPerSample and processing type. A file at another sample rate is
+        // resampled to this one block by block as it is mixed in.
+        void        mixWith(WavFile& otherFile, uint64_t delayFrames = 0, float otherGain = 1.f, float ownGain = 1.f)
+                        throw (DifferentNumChannelsException, DifferentBitsPerSampleException);
+        void        addMonoFrom(WavFile& otherFile) throw (NotMonoException, DifferentBitsPerSampleException);
+
+        // FileNotExistException when the file can't be created or written
+        // in full; nothing is left of it then.
         void        save(const std::string& path = "");
-        void        saveAs(const std::string& fileName);
 
+        // Writes the samples converted to dataType in a single pass, straight
+        // from the loaded or mapped data; the file in memory keeps its format.
+        // TPDF dither is added when the new format has less resolution than
+        // the samples, which float processing always counts as.
+        // Saving over the source file reopens it in the new format, unloaded.
+        void        saveAs(const std::string& path, DataType dataType, bool dither = true);
+
+        // A voice at another sample rate is resampled as it is read. Both
+        // files need 16-bit, 24-bit or float samples, the same for both;
+        // WrongDataTypeException otherwise.
         void overVoice(WavFile & otherFile, double attack, double release, double silence, double threshold, double ratio);
 
+        // Keys overVoice() with a LevelDetector run over blocks of voice
+        // frames, an RMS window of window seconds, instead of the positive
+        // peak over the channels divided by their number. The threshold keeps
+        // its meaning: a voice sample that passes it alone is loud.
+        void        setBlockDetection(bool enabled, LevelDetector::Mode mode = LevelDetector::PEAK_DETECTION,
+                                      double window = 0.01, LevelDetector::Linking linking = LevelDetector::LOUDEST_LINKING);
+        bool        isBlockDetection() const;
+
+        // Filter length of the resampling in mixWith() and overVoice(),
+        // STANDARD_QUALITY by default.
+        void                setResampleQuality(Resampler::Quality quality);
+        Resampler::Quality  getResampleQuality() const;
+
+        // loadData() and save() also build the Overview of the file they
+        // read or write and store it next to it (Overview::getPath()). That
+        // is a pass of its own over the mapped file once it is loaded or
+        // written; saving to another path maps and reads the new file.
+        void        setOverviewBuilding(bool enabled);
+        bool        isOverviewBuilding() const;
+
+        // Levels of the file on disk, changes in memory left out: from the
+        // sidecar while it matches the file, otherwise built in a pass over
+        // the mapped samples and the sidecar rewritten.
+        std::shared_ptr<const Overview> getOverview();
+
 
     private:
+        friend class MixBus;
+
         std::string _filePath;
+        RiffLayout  _layout;
         Header      _header;
         DataType    _dataType;
         Data_i8     _int8_data;
         Data_i16    _int16_data;
         Data_i24    _int24_data;
         Data_f32    _flt32_data;
-
-        void _loadInt8Data();
-        void _loadInt16Data();
-        void _loadInt24Data();
-        void _loadFlt32Data();
-
-        void _mixInt8Data(WavFile& otherFile);
-        void _mixInt16Data(WavFile& otherFile);
-        void _mixInt24Data(WavFile& otherFile);
-        void _mixFlt32Data(WavFile& otherFile);
-
-        void _addMonoInt8Data(WavFile& otherFile);
-        void _addMonoInt16Data(WavFile& otherFile);
-        void _addMonoInt24Data(WavFile& otherFile);
-        void _addMonoFlt32Data(WavFile& otherFile);
-
-        void _overVoiceInt16(WavFile& otherFile, double attack, double release, double silence, Decibel<int16_t> threshold, Decibel<int16_t> ratio);
-
-        void _saveInt16(const std::string& path);
-
-        bool _dataInt16End(std::vector < std::vector < int16_t >::iterator > iterators) {
-            bool result = true;
-            for (int i = 0; i < _header.numChannels; i++)
-            result &= (iterators[i] != _int16_data[i].end() );
-            return result;
-        }
+        bool        _dataLoaded;
+        bool        _floatProcessing;
+        bool        _floatDither;
+        bool        _blockDetection;
+        LevelDetector::Mode     _detectionMode;
+        LevelDetector::Linking  _detectionLinking;
+        double      _detectionWindow;
+        Resampler::Quality  _resampleQuality;
+        bool        _overviewBuilding;
+        std::shared_ptr<const Overview> _overview;
+
+        StorageLayout           _storageLayout;
+        SampleBuffer<int8_t>    _int8_buffer;
+        SampleBuffer<int16_t>   _int16_buffer;
+        SampleBuffer<Int24>     _int24_buffer;
+        SampleBuffer<float>     _flt32_buffer;
+
+        // Shared so that copies of a WavFile keep reading the same mapping.
+        std::shared_ptr<MappedFile> _mappedFile;
+        uint64_t    _dataOffset;
+        uint64_t    _dataSize;
+
+        std::shared_ptr<BlockCache> _cache;
+        uint64_t    _cacheSize;
+
+        StatsRecorder   _stats;
+
+        template<typename T>
+        InterleavedView<T> _mappedView() const;
+
+        template<typename T> std::vector<std::vector<T>>& _vectors();
+        template<typename T> SampleBuffer<T>& _buffer();
+
+        // Storage independent access to the loaded samples of type T
+        template<typename T> ChannelView<T> _channel(int i);
+        template<typename T> uint64_t _numLoadedFrames();
+        template<typename T> void _allocate(uint64_t numFrames);
+        template<typename S, typename D> void _deinterleave();
+        template<typename T> void _relayout(StorageLayout layout);
+        template<typename T> std::vector<std::vector<T>> _copyRange(uint64_t first, uint64_t numFrames);
+        template<typename T> void _decodeBlock(uint64_t index, T* block);
+        template<typename T> void _readMapped(uint64_t first, uint64_t numFrames, T* const* channels) const;
+        template<typename S, typename D> void _convertMapped(uint64_t first, uint64_t numFrames, D* const* channels) const;
+        template<typename S, typename D> void _convertLoaded();
+        template<typename T> ChannelView<const T> _channelRange(int channel, uint64_t first, uint64_t numFrames) const;
+        template<typename T> void _visitRange(int channel, uint64_t first, uint64_t numFrames,
+                                              const std::function<void(ChannelView<const T>, uint64_t, uint64_t)>& body) const;
+        template<typename T> std::vector<std::vector<T>> _takeData();
+
+        // Calls body(view, from, to) on consecutive pieces of frames [first,
+        // first + numFrames) of a channel, view[0] being frame from. Loaded
+        // storage is one piece; lazy storage is one per block, and writing
+        // marks the blocks dirty.
+        template<typename T> void _forPieces(int channel, uint64_t first, uint64_t numFrames, bool write,
+                                             const std::function<void(ChannelView<T>, uint64_t, uint64_t)>& body);
+
+        // The same over all channels at once: body(channels, from, to) with
+        // channels[c][0] being frame from of channel c. Needs an array per
+        // channel, so not for INTERLEAVED_STORAGE.
+        template<typename T> void _forFrames(uint64_t first, uint64_t numFrames, bool write,
+                                             const std::function<void(T* const*, uint64_t, uint64_t)>& body);
+
+        template<typename T> void _mixData(WavFile& otherFile, uint64_t delayFrames, float otherGain, float ownGain);
+        template<typename T> void _mixResampled(WavFile& otherFile, uint64_t delayFrames, float otherGain, float ownGain);
+        template<typename T> ResampledReader _resampled(int channel, const Resampler& resampler);
+        template<typename T> void _addMonoData(WavFile& otherFile);
+        template<typename T> void _saveData(const std::string& path);
+        template<typename T> void _readFloatBlock(float* block, uint64_t first, uint64_t numFrames);
+        template<typename S> void _readMappedBlock(float* block, uint64_t first, uint64_t numFrames);
+        template<typename T> void _saveConverted(const std::string& path, DataType dataType, bool dither);
+        template<typename S> void _scanOverview(Overview& overview) const;
+        template<typename T, typename U> void _writeConverted(const std::string& path, const std::vector<char>& format,
+                                                              uint64_t numFrames, bool dither);
+
+        void _parseLayout();
+        void _readDataType();
+        void _dropData();
+        std::shared_ptr<const Overview> _buildOverview();
+        // Against the loaded samples, or with mapped against the file itself.
+        void _checkDataType(DataType dataType, const char* name, bool mapped = false) const throw (WrongDataTypeException);
+        void _checkProcessingType(const WavFile& otherFile) const throw (DifferentBitsPerSampleException);
+        void _checkChannel(int channel) const throw (std::out_of_range);
+        bool _isClean(uint64_t blockIndex) const;
+        static void _readFormat(const std::vector<char>& format, Header& header);
+
+        // Smallest stretch of frames worth handing to another thread.
+        static const uint64_t MIN_RANGE_FRAMES = 16384;
+
+        void _forChannelRanges(uint64_t numFrames, const std::function<void(int, uint64_t, uint64_t)>& body);
+
+        void _ensureLoaded();
+        void _saveMapped(const std::string& path);
+
+        template<typename T>
+        void _overVoiceData(WavFile& otherFile, double attack, double release, double silence, Decibel<int16_t> threshold, Decibel<int16_t> ratio);
 };
 
 
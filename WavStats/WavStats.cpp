@@ -0,0 +1,55 @@
+#include "WavStats.h"
+
+
+const bool StatsRecorder::ENABLED;
+
+
+WavStats::WavStats() {
+    reset();
+}
+
+
+void WavStats::reset() {
+    for (int i = 0; i < NUM_STAGES; i++) {
+        nanoseconds[i] = 0;
+        frames[i] = 0;
+    }
+
+    bytesRead = 0;
+    bytesWritten = 0;
+    allocations = 0;
+    allocatedBytes = 0;
+    clippedSamples = 0;
+}
+
+
+WavStats& WavStats::operator +=(const WavStats& other) {
+    for (int i = 0; i < NUM_STAGES; i++) {
+        nanoseconds[i] += other.nanoseconds[i];
+        frames[i] += other.frames[i];
+    }
+
+    bytesRead += other.bytesRead;
+    bytesWritten += other.bytesWritten;
+    allocations += other.allocations;
+    allocatedBytes += other.allocatedBytes;
+    clippedSamples += other.clippedSamples;
+
+    return *this;
+}
+
+
+const char* WavStats::getStageName(Stage stage) {
+    switch (stage) {
+        case PARSE_STAGE:       return "parse";
+        case DECODE_STAGE:      return "decode";
+        case MIX_STAGE:         return "mix";
+        case ENVELOPE_STAGE:    return "envelope";
+        case GAIN_STAGE:        return "gain";
+        case ENCODE_STAGE:      return "encode";
+        case WRITE_STAGE:       return "write";
+        case NUM_STAGES:        break;
+    }
+
+    return "";
+}
@@ -0,0 +1,233 @@
+#ifndef WAVSTATS_H
+#define WAVSTATS_H
+
+
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include "Int24/Int24.h"
+#include "Pcm24/Pcm24.h"
+#include "SampleView/SampleView.h"
+
+#ifdef WAVFILE_INSTRUMENTATION
+#include <atomic>
+#include <chrono>
+#endif
+
+
+// Where a WavFile spent its time and how much data went through it. Stages
+// are timed on the thread that called into WavFile, so they add up to the
+// wall time of the calls, except for DECODE_STAGE of lazy storage: blocks
+// are decoded on first use, inside other stages, and timed on whichever
+// worker thread needed them.
+struct WavStats {
+    enum Stage {
+        PARSE_STAGE,        // reading the chunk map and header
+        DECODE_STAGE,       // loadData(), or decoding lazy blocks
+        MIX_STAGE,          // mixWith(), addMonoFrom(), MixBus
+        ENVELOPE_STAGE,     // overVoice() working out the ducking gains
+        GAIN_STAGE,         // overVoice() applying them
+        ENCODE_STAGE,       // interleaving and converting samples to save
+        WRITE_STAGE,        // waiting for the file to be written
+        NUM_STAGES
+    };
+
+    uint64_t    nanoseconds[NUM_STAGES];
+    uint64_t    frames[NUM_STAGES];
+    uint64_t    bytesRead;          // of sample data decoded
+    uint64_t    bytesWritten;       // of sample data saved
+    uint64_t    allocations;        // of sample storage
+    uint64_t    allocatedBytes;
+    uint64_t    clippedSamples;     // mixed samples that ended up at full scale
+
+    WavStats();
+
+    void        reset();
+    WavStats&   operator +=(const WavStats& other);
+
+    static const char*  getStageName(Stage stage);
+};
+
+
+// Thread safe accumulator behind WavFile::getStats(). Built without
+// WAVFILE_INSTRUMENTATION it holds nothing and every call is an empty
+// inline function, so instrumented code compiles down to what it was.
+class StatsRecorder {
+    public:
+#ifdef WAVFILE_INSTRUMENTATION
+        static const bool ENABLED = true;
+
+        StatsRecorder() {
+            reset();
+        }
+
+        StatsRecorder(const StatsRecorder& other) {
+            *this = other;
+        }
+
+        StatsRecorder& operator =(const StatsRecorder& other) {
+            for (int i = 0; i < NUM_VALUES; i++) {
+                _values[i].store(other._values[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+            return *this;
+        }
+
+        void addStage(WavStats::Stage stage, uint64_t nanoseconds, uint64_t frames) {
+            _add(NANOSECONDS + stage, nanoseconds);
+            _add(FRAMES + stage, frames);
+        }
+
+        void addRead(uint64_t bytes) { _add(BYTES_READ, bytes); }
+        void addWritten(uint64_t bytes) { _add(BYTES_WRITTEN, bytes); }
+        void addClipped(uint64_t samples) { _add(CLIPPED_SAMPLES, samples); }
+
+        void addAllocation(uint64_t bytes) {
+            _add(ALLOCATIONS, 1);
+            _add(ALLOCATED_BYTES, bytes);
+        }
+
+        WavStats getStats() const {
+            WavStats stats;
+
+            for (int i = 0; i < WavStats::NUM_STAGES; i++) {
+                stats.nanoseconds[i] = _values[NANOSECONDS + i].load(std::memory_order_relaxed);
+                stats.frames[i] = _values[FRAMES + i].load(std::memory_order_relaxed);
+            }
+
+            stats.bytesRead = _values[BYTES_READ].load(std::memory_order_relaxed);
+            stats.bytesWritten = _values[BYTES_WRITTEN].load(std::memory_order_relaxed);
+            stats.allocations = _values[ALLOCATIONS].load(std::memory_order_relaxed);
+            stats.allocatedBytes = _values[ALLOCATED_BYTES].load(std::memory_order_relaxed);
+            stats.clippedSamples = _values[CLIPPED_SAMPLES].load(std::memory_order_relaxed);
+
+            return stats;
+        }
+
+        void reset() {
+            for (int i = 0; i < NUM_VALUES; i++) {
+                _values[i].store(0, std::memory_order_relaxed);
+            }
+        }
+
+    private:
+        enum {
+            NANOSECONDS = 0,
+            FRAMES = NANOSECONDS + WavStats::NUM_STAGES,
+            BYTES_READ = FRAMES + WavStats::NUM_STAGES,
+            BYTES_WRITTEN,
+            ALLOCATIONS,
+            ALLOCATED_BYTES,
+            CLIPPED_SAMPLES,
+            NUM_VALUES
+        };
+
+        std::atomic<uint64_t>   _values[NUM_VALUES];
+
+        void _add(int value, uint64_t amount) {
+            _values[value].fetch_add(amount, std::memory_order_relaxed);
+        }
+#else
+        static const bool ENABLED = false;
+
+        void addStage(WavStats::Stage, uint64_t, uint64_t) {}
+        void addRead(uint64_t) {}
+        void addWritten(uint64_t) {}
+        void addClipped(uint64_t) {}
+        void addAllocation(uint64_t) {}
+
+        WavStats getStats() const { return WavStats(); }
+        void reset() {}
+#endif
+};
+
+
+// Adds the time from construction to destruction to a stage.
+class StageTimer {
+    public:
+        StageTimer(const StageTimer&) = delete;
+        StageTimer& operator =(const StageTimer&) = delete;
+
+#ifdef WAVFILE_INSTRUMENTATION
+        StageTimer(StatsRecorder& recorder, WavStats::Stage stage, uint64_t frames = 0):
+            _recorder(recorder),
+            _stage(stage),
+            _frames(frames),
+            _start(std::chrono::steady_clock::now())
+        {}
+
+        ~StageTimer() {
+            std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - _start;
+            _recorder.addStage(_stage, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), _frames);
+        }
+
+        void setFrames(uint64_t frames) { _frames = frames; }
+
+    private:
+        StatsRecorder&                          _recorder;
+        WavStats::Stage                         _stage;
+        uint64_t                                _frames;
+        std::chrono::steady_clock::time_point   _start;
+#else
+        StageTimer(StatsRecorder&, WavStats::Stage, uint64_t = 0) {}
+
+        void setFrames(uint64_t) {}
+#endif
+};
+
+
+// Samples of a mixed range that sit at full scale, where saturation would
+// have left them; float counts what went past 1.
+template<typename T>
+inline uint64_t countClipped(ChannelView<T> view, uint64_t n) {
+    const T lo = std::numeric_limits<T>::min();
+    const T hi = std::numeric_limits<T>::max();
+    uint64_t clipped = 0;
+
+    for (uint64_t i = 0; i < n; i++) {
+        clipped += view[i] == lo || view[i] == hi;
+    }
+
+    return clipped;
+}
+
+
+// 8-bit samples are unsigned bytes, full scale at 0 and 255.
+template<>
+inline uint64_t countClipped<int8_t>(ChannelView<int8_t> view, uint64_t n) {
+    uint64_t clipped = 0;
+
+    for (uint64_t i = 0; i < n; i++) {
+        uint8_t value = (uint8_t) view[i];
+        clipped += value == 0 || value == 255;
+    }
+
+    return clipped;
+}
+
+
+template<>
+inline uint64_t countClipped<Int24>(ChannelView<Int24> view, uint64_t n) {
+    uint64_t clipped = 0;
+
+    for (uint64_t i = 0; i < n; i++) {
+        int value = view[i];
+        clipped += value == Pcm24::MIN_VALUE || value == Pcm24::MAX_VALUE;
+    }
+
+    return clipped;
+}
+
+
+template<>
+inline uint64_t countClipped<float>(ChannelView<float> view, uint64_t n) {
+    uint64_t clipped = 0;
+
+    for (uint64_t i = 0; i < n; i++) {
+        clipped += std::fabs(view[i]) > 1.f;
+    }
+
+    return clipped;
+}
+
+
+#endif // WAVSTATS_H
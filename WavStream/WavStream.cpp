@@ -0,0 +1,616 @@
+#include "WavStream.h"
+#include "MixKernels/MixKernels.h"
+#include "DuckingEngine/DuckingEngine.h"
+#include "FrameKernels/FrameKernels.h"
+#include "Resampler/Resampler.h"
+#include "Pcm24/Pcm24.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+
+WavReader::WavReader(const std::string& filePath) throw (FileNotExistException, BadRiffException):
+    _filePath(filePath),
+    _position(0)
+{
+    WavFile file(_filePath);
+
+    _header = file.getHeader();
+    _dataType = file.getDataType();
+    _frameSize = (uint64_t) _header.numChannels * (_header.bitsPerSample / 8);
+
+    _ifs.open(_filePath, std::ios::in | std::ios::binary | std::ios::ate);
+
+    if (!_ifs || _frameSize == 0) {
+        throw FileNotExistException(std::string("File '") + _filePath +
+                                    std::string("' doesn't exist!"));
+    }
+
+    uint64_t fileSize = (uint64_t) _ifs.tellg();
+    uint64_t available = fileSize > file.getDataOffset() ? fileSize - file.getDataOffset() : 0;
+    uint64_t dataSize = file.getDataSize();
+
+    if (dataSize == 0 || dataSize > available) {
+        dataSize = available;
+    }
+
+    _numFrames = dataSize / _frameSize;
+    _ifs.seekg(std::streampos(file.getDataOffset()));
+}
+
+
+uint64_t WavReader::readFrames(void* buffer, uint64_t maxFrames) {
+    uint64_t numFrames = std::min(maxFrames, _numFrames - _position);
+
+    _ifs.read((char*) buffer, numFrames * _frameSize);
+    numFrames = (uint64_t) _ifs.gcount() / _frameSize;
+    _position += numFrames;
+
+    return numFrames;
+}
+
+
+WavWriter::WavWriter(const std::string& filePath, const WavFile::Header& header,
+                     uint64_t expectedFrames) throw (FileNotExistException):
+    _filePath(filePath),
+    _header(header),
+    _frameSize((uint64_t) header.numChannels * (header.bitsPerSample / 8)),
+    _numFrames(0)
+{
+    std::vector<char> format(16);
+    memcpy(format.data(), &_header.audioFormat, 16);
+
+    _open(filePath, format, expectedFrames);
+}
+
+
+WavWriter::WavWriter(const std::string& filePath, const WavFile& source,
+                     uint64_t expectedFrames) throw (FileNotExistException):
+    _filePath(filePath),
+    _header(source.getHeader()),
+    _layout(source.getLayout()),
+    _frameSize((uint64_t) _header.numChannels * (_header.bitsPerSample / 8)),
+    _numFrames(0)
+{
+    _open(filePath, source.getFormatChunk(), expectedFrames);
+}
+
+
+void WavWriter::_open(const std::string& filePath, const std::vector<char>& format, uint64_t expectedFrames) {
+    _ofs.open(filePath, std::ios::out | std::ios::binary | std::ios::trunc);
+
+    if (!_ofs) {
+        throw FileNotExistException(std::string("File '") + filePath +
+                                    std::string("' can't be created!"));
+    }
+
+    uint64_t expectedSize = expectedFrames == RiffLayout::UNKNOWN_SIZE ?
+                            RiffLayout::UNKNOWN_SIZE : expectedFrames * _frameSize;
+
+    _placement = _layout.writeHead(_ofs, format, expectedSize);
+    _writer.reset(new AsyncWriter(_ofs));
+}
+
+
+WavWriter::~WavWriter() {
+    try {
+        close();
+    } catch (const FileNotExistException&) {
+    }
+}
+
+
+void WavWriter::writeFrames(const void* buffer, uint64_t numFrames) {
+    _writer->write((const char*) buffer, numFrames * _frameSize);
+    _numFrames += numFrames;
+}
+
+
+void WavWriter::close() throw (FileNotExistException) {
+    if (!_ofs.is_open()) {
+        return;
+    }
+
+    bool written = true;
+
+    try {
+        _writer->finish();
+    } catch (const std::ios_base::failure&) {
+        written = false;
+    }
+
+    _layout.writeTail(_ofs, _placement, _numFrames * _frameSize, _numFrames);
+    _ofs.close();
+
+    if (!written || !_ofs) {
+        std::remove(_filePath.c_str());
+        throw FileNotExistException(std::string("File '") + _filePath +
+                                    std::string("' can't be written!"));
+    }
+}
+
+
+// Samples to normalized floats and back the way WavFile's float processing
+// converts them, rounded to nearest without dither, so that a resampled mix
+// comes out as it does in WavFile::mixWith().
+static inline float toFloat(int8_t sample) { return ((uint8_t) sample - 128) * (1.f / 128); }
+static inline float toFloat(int16_t sample) { return sample * (1.f / 32768); }
+static inline float toFloat(const Int24& sample) { return (int) sample * (1.f / 8388608); }
+static inline float toFloat(float sample) { return sample; }
+
+
+// The 16-bit sample WavFile::overVoice() judges the voice level on.
+static inline int16_t toGateSample(int16_t sample) { return sample; }
+static inline int16_t toGateSample(const Int24& sample) { return (int16_t) ((int) sample >> 8); }
+static inline int16_t toGateSample(float sample) {
+    return (int16_t) std::min(std::max(sample * 32768.f, -32768.f), 32767.f);
+}
+
+
+static void quantize(const float* src, int8_t* dst, uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        dst[i] = (int8_t) (uint8_t) (lrintf(std::min(std::max(src[i] * 128.f, -128.f), 127.f)) + 128);
+    }
+}
+
+
+static void quantize(const float* src, int16_t* dst, uint64_t n) { Pcm24::pack(src, dst, n); }
+static void quantize(const float* src, Int24* dst, uint64_t n) { Pcm24::pack(src, dst, n); }
+static void quantize(const float* src, float* dst, uint64_t n) { std::copy(src, src + n, dst); }
+
+
+// The channels of a file at another sample rate, a ResampledReader each, all
+// fed from the one WavReader: the frames read are kept until every channel
+// has taken them.
+template<typename T>
+class ResampledChannels {
+    public:
+        ResampledChannels(WavReader& reader, uint32_t sampleRate):
+            _reader(reader),
+            _inputFirst(0)
+        {
+            const WavFile::Header& header = _reader.getHeader();
+            Resampler resampler(header.sampleRate, sampleRate);
+
+            _fetched.assign(header.numChannels, 0);
+
+            for (int c = 0; c < header.numChannels; c++) {
+                _readers.emplace_back(resampler, _reader.getNumFrames(), [this, c](float* dst, uint64_t first, uint64_t numFrames) {
+                    _fetch(c, dst, first, numFrames);
+                });
+            }
+        }
+
+        // The next resampled frames of channel c; fewer only at the end.
+        uint64_t read(int c, float* dst, uint64_t numFrames) { return _readers[c].read(dst, numFrames); }
+
+    private:
+        static const uint64_t READ_FRAMES = 16384;
+
+        WavReader&                      _reader;
+        std::vector<ResampledReader>    _readers;
+        std::vector<uint64_t>           _fetched;   // input frames each channel has taken
+        std::vector<float>  _input;                 // interleaved, from frame _inputFirst on
+        uint64_t            _inputFirst;
+        std::vector<T>      _raw;
+
+        // Input frames [first, first + numFrames) of channel c. Channels ask
+        // for the same frames in the same order, one after the other.
+        void _fetch(int c, float* dst, uint64_t first, uint64_t numFrames) {
+            uint16_t numChannels = _reader.getHeader().numChannels;
+
+            while (_inputFirst + _input.size() / numChannels < first + numFrames) {
+                uint64_t count = _reader.readBlock(_raw, READ_FRAMES);
+
+                if (count == 0) {
+                    break;
+                }
+
+                for (const T& sample : _raw) {
+                    _input.push_back(toFloat(sample));
+                }
+            }
+
+            const float* src = _input.data() + (first - _inputFirst) * numChannels + c;
+            uint64_t available = std::min(numFrames, _inputFirst + _input.size() / numChannels - first);
+
+            for (uint64_t f = 0; f < available; f++) {
+                dst[f] = src[f * numChannels];
+            }
+
+            std::fill(dst + available, dst + numFrames, 0.f);
+
+            _fetched[c] = first + numFrames;
+
+            uint64_t done = std::min(*std::min_element(_fetched.begin(), _fetched.end()),
+                                     _inputFirst + _input.size() / numChannels);
+            _input.erase(_input.begin(), _input.begin() + (done - _inputFirst) * numChannels);
+            _inputFirst = done;
+        }
+};
+
+
+// otherFile[f - delay] is added to frame f, as far as otherFile goes. A file
+// at another sample rate is resampled as it is read.
+template<typename T>
+class MixStage : public BlockStage<T> {
+    public:
+        MixStage(const std::string& otherPath, uint32_t sampleRate, uint64_t delayFrames,
+                 float otherGain, float ownGain):
+            _other(otherPath),
+            _delayFrames(delayFrames),
+            _otherGain(otherGain),
+            _ownGain(ownGain),
+            _position(0)
+        {
+            if (_other.getHeader().sampleRate != sampleRate) {
+                _resampled.reset(new ResampledChannels<T>(_other, sampleRate));
+            }
+        }
+
+        void process(std::vector<T>& block) {
+            uint16_t numChannels = _other.getHeader().numChannels;
+            uint64_t numFrames = block.size() / numChannels;
+            uint64_t first = std::max(_position, _delayFrames);
+
+            if (first < _position + numFrames) {
+                if (!_resampled) {
+                    _other.readBlock(_buf, _position + numFrames - first);
+                } else {
+                    _readResampled(_position + numFrames - first);
+                }
+
+                T* dst = block.data() + (first - _position) * numChannels;
+                MixKernels::mix(dst, _buf.data(), _buf.size(), _ownGain, _otherGain);
+            }
+
+            _position += numFrames;
+        }
+
+    private:
+        WavReader       _other;
+        uint64_t        _delayFrames;
+        float           _otherGain;
+        float           _ownGain;
+        uint64_t        _position;
+        std::vector<T>  _buf;
+
+        std::unique_ptr<ResampledChannels<T>>   _resampled;
+        std::vector<T>      _raw;
+        std::vector<float>  _samples;
+
+        // The next numFrames resampled frames, rounded to T, into _buf.
+        void _readResampled(uint64_t numFrames) {
+            uint16_t numChannels = _other.getHeader().numChannels;
+            uint64_t count = numFrames;
+
+            _samples.resize(numFrames);
+            _raw.resize(numFrames);
+            _buf.resize(numFrames * numChannels);
+
+            for (int c = 0; c < numChannels; c++) {
+                count = _resampled->read(c, _samples.data(), numFrames);
+                quantize(_samples.data(), _raw.data(), count);
+
+                for (uint64_t f = 0; f < count; f++) {
+                    _buf[f * numChannels + c] = _raw[f];
+                }
+            }
+
+            _buf.resize(count * numChannels);
+        }
+};
+
+
+// Adds the mono sample to every channel, scaled down by the channel count.
+template<typename T>
+class AddMonoStage : public BlockStage<T> {
+    public:
+        AddMonoStage(const std::string& monoPath, uint16_t numChannels):
+            _mono(monoPath),
+            _numChannels(numChannels)
+        {}
+
+        void process(std::vector<T>& block) {
+            _mono.readBlock(_buf, block.size() / _numChannels);
+
+            for (uint16_t c = 0; c < _numChannels; c++) {
+                FrameKernels::addShare(ChannelView<T>(block.data() + c, _numChannels, _buf.size()), _buf.data(),
+                                       _buf.size(), _numChannels);
+            }
+        }
+
+    private:
+        WavReader       _mono;
+        uint16_t        _numChannels;
+        std::vector<T>  _buf;
+};
+
+
+// WavFile::overVoice() over blocks. The engine only looks ahead in
+// the voice, so every block goes back out whole. The voice level is judged
+// on 16-bit samples, as in WavFile.
+template<typename T>
+class OverVoiceStage : public BlockStage<T> {
+    public:
+        OverVoiceStage(const std::string& voicePath, const WavFile::Header& header,
+                       double attack, double release, double silence, double threshold, double ratio):
+            _voice(voicePath),
+            _numChannels(header.numChannels),
+            _threshold(Decibel<int16_t>(threshold)),
+            _engine(header.sampleRate, attack, release, silence, ratio, WavFile::OVERVOICE_PREROLL),
+            _voicePos(0)
+        {
+            if (_voice.getHeader().sampleRate != header.sampleRate) {
+                _resampled.reset(new ResampledChannels<T>(_voice, header.sampleRate));
+            }
+        }
+
+        void process(std::vector<T>& block) {
+            uint16_t voiceChannels = _voice.getHeader().numChannels;
+            uint64_t numFrames = block.size() / _numChannels;
+            uint64_t f = 0;
+
+            _gains.resize(numFrames);
+
+            for (; f < numFrames; f++) {
+                while (!_engine.isReady()) {
+                    if (_voicePos == _voiceBuf.size() && !_readVoice()) {
+                        _engine.endVoice();
+                        break;
+                    }
+
+                    _engine.pushVoice(DuckingEngine::isLoud(&_voiceBuf[_voicePos], voiceChannels, _threshold));
+                    _voicePos += voiceChannels;
+                }
+
+                if (_engine.isDone()) {
+                    break;
+                }
+
+                _engine.next();
+                _gains[f] = _engine.getGain();
+            }
+
+            for (uint16_t i = 0; i < _numChannels; i++) {
+                DecibelMath::applyGain(block.data() + i, _numChannels, _gains.data(), f);
+            }
+        }
+
+    private:
+        WavReader               _voice;
+        uint16_t                _numChannels;
+        DecibelGate<int16_t>    _threshold;
+        DuckingEngine           _engine;
+        std::vector<int16_t>    _voiceBuf;
+        std::size_t             _voicePos;
+        std::vector<double>     _gains;
+
+        std::unique_ptr<ResampledChannels<T>>   _resampled;
+        std::vector<T>          _raw;
+        std::vector<float>      _samples;
+
+        // The next voice frames as 16-bit gate samples, into _voiceBuf.
+        bool _readVoice() {
+            uint16_t voiceChannels = _voice.getHeader().numChannels;
+            uint64_t count = 0;
+
+            _voicePos = 0;
+
+            if (!_resampled) {
+                count = _voice.readBlock(_raw, DEFAULT_READ_FRAMES);
+                _voiceBuf.resize(_raw.size());
+
+                for (std::size_t i = 0; i < _raw.size(); i++) {
+                    _voiceBuf[i] = toGateSample(_raw[i]);
+                }
+
+                return count > 0;
+            }
+
+            _samples.resize(DEFAULT_READ_FRAMES);
+            _voiceBuf.resize(DEFAULT_READ_FRAMES * voiceChannels);
+
+            for (int c = 0; c < voiceChannels; c++) {
+                count = _resampled->read(c, _samples.data(), DEFAULT_READ_FRAMES);
+
+                for (uint64_t f = 0; f < count; f++) {
+                    _voiceBuf[f * voiceChannels + c] = toGateSample(_samples[f]);
+                }
+            }
+
+            _voiceBuf.resize(count * voiceChannels);
+
+            return count > 0;
+        }
+
+        static const uint64_t DEFAULT_READ_FRAMES = 65536;
+};
+
+
+StreamPipeline::StreamPipeline(const std::string& inputPath, uint64_t blockFrames)
+    throw (FileNotExistException, BadRiffException):
+    _inputPath(inputPath),
+    _blockFrames(blockFrames)
+{
+    WavFile file(_inputPath);
+
+    _header = file.getHeader();
+    _dataType = file.getDataType();
+}
+
+
+StreamPipeline& StreamPipeline::mixWith(const std::string& otherPath, uint64_t delayFrames,
+                                        float otherGain, float ownGain)
+    throw (FileNotExistException, BadRiffException,
+           DifferentNumChannelsException, DifferentBitsPerSampleException) {
+    WavFile::Header otherHeader = WavFile(otherPath).getHeader();
+
+    if (_header.numChannels != otherHeader.numChannels) {
+        throw DifferentNumChannelsException(std::string("Files '") + _inputPath +
+                                            std::string("' and '") + otherPath +
+                                            std::string("' have different numChannels!"));
+    }
+
+    if (_header.bitsPerSample != otherHeader.bitsPerSample) {
+        throw DifferentBitsPerSampleException(std::string("Files '") + _inputPath +
+                                              std::string("' and '") + otherPath +
+                                              std::string("' have different bitsPerSample!"));
+    }
+
+    StageSpec spec = StageSpec();
+    spec.type = MIX_STAGE;
+    spec.path = otherPath;
+    spec.delayFrames = delayFrames;
+    spec.otherGain = otherGain;
+    spec.ownGain = ownGain;
+    _stages.push_back(spec);
+
+    return *this;
+}
+
+
+StreamPipeline& StreamPipeline::addMonoFrom(const std::string& monoPath)
+    throw (FileNotExistException, BadRiffException, NotMonoException) {
+    WavFile::Header monoHeader = WavFile(monoPath).getHeader();
+
+    if (monoHeader.numChannels != 1) {
+        throw NotMonoException(std::string("File '") + monoPath +
+                               std::string("' haven't mono track!"));
+    }
+
+    StageSpec spec = StageSpec();
+    spec.type = ADD_MONO_STAGE;
+    spec.path = monoPath;
+    _stages.push_back(spec);
+
+    return *this;
+}
+
+
+StreamPipeline& StreamPipeline::overVoice(const std::string& voicePath, double attack, double release,
+                                          double silence, double threshold, double ratio)
+    throw (FileNotExistException, BadRiffException, WrongDataTypeException) {
+    WavFile voice(voicePath);
+
+    if ((_dataType != WavFile::INT_16_DATA && _dataType != WavFile::INT_24_DATA && _dataType != WavFile::FLT_32_DATA) ||
+        voice.getDataType() != _dataType) {
+        throw WrongDataTypeException(std::string("Files '") + _inputPath +
+                                     std::string("' and '") + voicePath +
+                                     std::string("' must both contain INT_16_DATA, INT_24_DATA or FLT_32_DATA!"));
+    }
+
+    StageSpec spec = StageSpec();
+    spec.type = OVER_VOICE_STAGE;
+    spec.path = voicePath;
+    spec.attack = attack;
+    spec.release = release;
+    spec.silence = silence;
+    spec.threshold = threshold;
+    spec.ratio = ratio;
+    _stages.push_back(spec);
+
+    return *this;
+}
+
+
+void StreamPipeline::save(const std::string& path) {
+    switch (_dataType) {
+        case WavFile::INT_8_DATA:
+            _run<int8_t>(path);
+            break;
+
+        case WavFile::INT_16_DATA:
+            _run<int16_t>(path);
+            break;
+
+        case WavFile::INT_24_DATA:
+            _run<Int24>(path);
+            break;
+
+        case WavFile::FLT_32_DATA:
+            _run<float>(path);
+            break;
+    }
+}
+
+
+template<typename T>
+static BlockStage<T>* makeOverVoiceStage(const std::string& voicePath, const WavFile::Header& header,
+                                         double attack, double release, double silence,
+                                         double threshold, double ratio) {
+    return new OverVoiceStage<T>(voicePath, header, attack, release, silence, threshold, ratio);
+}
+
+
+template<>
+BlockStage<int8_t>* makeOverVoiceStage<int8_t>(const std::string&, const WavFile::Header&,
+                                               double, double, double, double, double) {
+    return nullptr;     // rejected by StreamPipeline::overVoice()
+}
+
+
+template<typename T>
+void StreamPipeline::_run(const std::string& path) {
+    WavReader reader(_inputPath);
+    std::vector<std::unique_ptr<BlockStage<T>>> stages;
+
+    for (const StageSpec& spec : _stages) {
+        switch (spec.type) {
+            case MIX_STAGE:
+                stages.emplace_back(new MixStage<T>(spec.path, _header.sampleRate, spec.delayFrames,
+                                                    spec.otherGain, spec.ownGain));
+                break;
+
+            case ADD_MONO_STAGE:
+                stages.emplace_back(new AddMonoStage<T>(spec.path, _header.numChannels));
+                break;
+
+            case OVER_VOICE_STAGE:
+                stages.emplace_back(makeOverVoiceStage<T>(spec.path, _header, spec.attack, spec.release,
+                                                          spec.silence, spec.threshold, spec.ratio));
+                break;
+        }
+    }
+
+    // Never truncate a file that is still being read; go through a temporary.
+    std::string target = path.empty() ? _inputPath : path;
+    bool readsTarget = target == _inputPath;
+
+    for (const StageSpec& spec : _stages) {
+        readsTarget |= target == spec.path;
+    }
+
+    std::string outPath = readsTarget ? target + ".part" : target;
+
+    WavWriter writer(outPath, WavFile(_inputPath), reader.getNumFrames());
+    std::vector<T> block;
+
+    while (reader.readBlock(block, _blockFrames) > 0) {
+        for (auto& stage : stages) {
+            stage->process(block);
+        }
+
+        writer.writeBlock(block);
+    }
+
+    // Drain stages front to back so held frames still pass the later ones.
+    for (std::size_t i = 0; i < stages.size(); i++) {
+        stages[i]->finish(block);
+
+        for (std::size_t j = i + 1; j < stages.size(); j++) {
+            stages[j]->process(block);
+        }
+
+        writer.writeBlock(block);
+    }
+
+    writer.close();
+
+    if (readsTarget) {
+        stages.clear();
+        std::remove(target.c_str());
+        std::rename(outPath.c_str(), target.c_str());
+    }
+}
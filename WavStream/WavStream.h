@@ -0,0 +1,158 @@
+#ifndef WAVSTREAM_H
+#define WAVSTREAM_H
+
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include "WavFile/WavFile.h"
+#include "AsyncWriter/AsyncWriter.h"
+
+
+// Pulls interleaved frames from the data chunk of a WAV file, one block at
+// a time, without ever holding more than the caller's block in memory.
+class WavReader {
+    public:
+        WavReader(const std::string& filePath) throw (FileNotExistException, BadRiffException);
+
+        const WavFile::Header&  getHeader() const { return _header; }
+        WavFile::DataType       getDataType() const { return _dataType; }
+        uint64_t                getNumFrames() const { return _numFrames; }
+        uint64_t                tell() const { return _position; }
+
+        uint64_t    readFrames(void* buffer, uint64_t maxFrames);
+
+        template<typename T>
+        uint64_t readBlock(std::vector<T>& block, uint64_t maxFrames) {
+            block.resize(maxFrames * _header.numChannels);
+            uint64_t numFrames = readFrames(block.data(), maxFrames);
+            block.resize(numFrames * _header.numChannels);
+            return numFrames;
+        }
+
+    private:
+        std::string         _filePath;
+        std::ifstream       _ifs;
+        WavFile::Header     _header;
+        WavFile::DataType   _dataType;
+        uint64_t            _frameSize;
+        uint64_t            _numFrames;
+        uint64_t            _position;
+};
+
+
+// Appends interleaved frames to a new WAV file and patches the chunk sizes
+// on close(). Given a source file, its fmt and other chunks are carried over.
+// Knowing the frame count up front lets small outputs skip the ds64 reserve.
+// Frames are written out by a background thread.
+class WavWriter {
+    public:
+        WavWriter(const std::string& filePath, const WavFile::Header& header,
+                  uint64_t expectedFrames = RiffLayout::UNKNOWN_SIZE) throw (FileNotExistException);
+        WavWriter(const std::string& filePath, const WavFile& source,
+                  uint64_t expectedFrames = RiffLayout::UNKNOWN_SIZE) throw (FileNotExistException);
+        ~WavWriter();
+
+        void        writeFrames(const void* buffer, uint64_t numFrames);
+
+        // FileNotExistException if anything failed to be written; the file
+        // is removed then. The destructor closes without throwing.
+        void        close() throw (FileNotExistException);
+
+        uint64_t    getNumFrames() const { return _numFrames; }
+
+        template<typename T>
+        void writeBlock(const std::vector<T>& block) {
+            writeFrames(block.data(), block.size() / _header.numChannels);
+        }
+
+    private:
+        std::string             _filePath;
+        std::ofstream           _ofs;
+        WavFile::Header         _header;
+        RiffLayout              _layout;
+        RiffLayout::Placement   _placement;
+        std::unique_ptr<AsyncWriter>    _writer;
+        uint64_t                _frameSize;
+        uint64_t                _numFrames;
+
+        void _open(const std::string& filePath, const std::vector<char>& format, uint64_t expectedFrames);
+};
+
+
+// One step of a StreamPipeline working on interleaved blocks of T.
+template<typename T>
+class BlockStage {
+    public:
+        virtual ~BlockStage() {}
+
+        // Processes one block in place. A stage that needs to look back may
+        // hold frames and hand back fewer than it was given.
+        virtual void process(std::vector<T>& block) = 0;
+
+        // Hands back whatever the stage still holds once the input is exhausted.
+        virtual void finish(std::vector<T>& block) { block.clear(); }
+};
+
+
+// Block-by-block counterpart of loadData()/overVoice()/mixWith()/addMonoFrom()/save().
+// Operations are queued and run in a single pass by save(), so peak memory
+// depends on blockFrames rather than on the length of the files. Output is
+// byte-identical to running the same operations on loaded WavFiles.
+class StreamPipeline {
+    public:
+        static const uint64_t DEFAULT_BLOCK_FRAMES = 65536;
+
+        StreamPipeline(const std::string& inputPath, uint64_t blockFrames = DEFAULT_BLOCK_FRAMES)
+            throw (FileNotExistException, BadRiffException);
+
+        // A file at another sample rate is resampled as it is read, with
+        // WavFile's default quality.
+        StreamPipeline& mixWith(const std::string& otherPath, uint64_t delayFrames = 0,
+                                float otherGain = 1.f, float ownGain = 1.f)
+            throw (FileNotExistException, BadRiffException,
+                   DifferentNumChannelsException, DifferentBitsPerSampleException);
+        StreamPipeline& addMonoFrom(const std::string& monoPath)
+            throw (FileNotExistException, BadRiffException, NotMonoException);
+        // 16-bit, 24-bit or float, the same for both files; a voice at
+        // another sample rate is resampled as it is read.
+        StreamPipeline& overVoice(const std::string& voicePath, double attack, double release,
+                                  double silence, double threshold, double ratio)
+            throw (FileNotExistException, BadRiffException, WrongDataTypeException);
+
+        void save(const std::string& path);
+
+    private:
+        enum StageType {
+            MIX_STAGE,
+            ADD_MONO_STAGE,
+            OVER_VOICE_STAGE
+        };
+
+        struct StageSpec {
+            StageType   type;
+            std::string path;
+            uint64_t    delayFrames;
+            float       otherGain;
+            float       ownGain;
+            double      attack;
+            double      release;
+            double      silence;
+            double      threshold;
+            double      ratio;
+        };
+
+        std::string             _inputPath;
+        WavFile::Header         _header;
+        WavFile::DataType       _dataType;
+        uint64_t                _blockFrames;
+        std::vector<StageSpec>  _stages;
+
+        template<typename T>
+        void _run(const std::string& path);
+};
+
+
+#endif // WAVSTREAM_H
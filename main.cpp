@@ -9,7 +9,7 @@ int main() {
     second.loadData();
 
     first.overVoice(second, 0.2, 1.3, 0.4, -30, 15);
-    first.mixWith(second);
+    first.mixWith(second, WavFile::OVERVOICE_PREROLL);
     first.save("result.wav");
 
     return 0;